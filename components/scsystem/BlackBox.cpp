@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <BlackBox.h>
+
+namespace scsystem
+{
+
+	static const uint32_t BLACKBOX_MAGIC = 0x32584242;   // "BBX2"
+
+	/**
+	 * @brief Layout of the black box in RTC slow memory.
+	 */
+	struct BlackBoxState {
+		uint32_t       magic;
+		uint32_t       bootCount;
+		uint32_t       nextRecord;
+		uint32_t       nextTaskRecord;
+		BlackBoxRecord records[BlackBox::NUM_RECORDS];
+		BlackBoxRecord taskRecords[BlackBox::NUM_TASK_RECORDS];
+	};
+
+	static RTC_NOINIT_ATTR BlackBoxState rtcState;
+
+	// Slot allocation lives in normal RAM where atomics are supported;
+	// rtcState.nextRecord and rtcState.nextTaskRecord mirror it for the next boot.
+	static std::atomic<uint32_t> nextRecord {0};
+	static std::atomic<uint32_t> nextTaskRecord {0};
+	static std::atomic<uint32_t> heapMinimum {UINT32_MAX};
+	static bool isRecording = false;
+
+	static BlackBoxRecord previousRecords[BlackBox::NUM_RECORDS + BlackBox::NUM_TASK_RECORDS];
+	static size_t numPreviousRecords = 0;
+	static uint32_t previousBootCount = 0;
+	static esp_reset_reason_t previousResetReason = ESP_RST_UNKNOWN;
+
+	static void* lastTask[portNUM_PROCESSORS];
+
+
+	static uint32_t IRAM_ATTR packChars(const char* text) {
+		uint32_t value = 0;
+		for (int i = 0; i < 4 && text != nullptr && text[i] != 0; i++) {
+			value |= (uint32_t)(uint8_t)text[i] << (8 * i);
+		}
+		return value;
+	} // packChars
+
+
+	static void unpackChars(uint32_t value, char* text) {
+		for (int i = 0; i < 4; i++) {
+			char c = (char)(value >> (8 * i));
+			text[i] = (c >= 0x20 && c < 0x7f) ? c : (c == 0 ? 0 : '?');
+		}
+		text[4] = 0;
+	} // unpackChars
+
+
+	/**
+	 * @brief Copy the records of a ring of the previous run to previousRecords.
+	 */
+	static void copyPreviousRecords(const BlackBoxRecord* ring, size_t size, uint32_t end) {
+		uint32_t start = end > size ? end - size : 0;
+		for (uint32_t i = start; i < end; i++) {
+			const BlackBoxRecord& record = ring[i % size];
+			if (record.type != BLACKBOX_EMPTY) {
+				previousRecords[numPreviousRecords++] = record;
+			}
+		}
+	} // copyPreviousRecords
+
+
+	/**
+	 * @brief Sort previousRecords by time, keeping the order of equal times.
+	 * Merges the two rings and repairs the order if a mirrored counter lagged behind.
+	 */
+	static void sortPreviousRecords() {
+		for (size_t i = 1; i < numPreviousRecords; i++) {
+			BlackBoxRecord record = previousRecords[i];
+			size_t j = i;
+			while (j > 0 && previousRecords[j - 1].timeMs > record.timeMs) {
+				previousRecords[j] = previousRecords[j - 1];
+				j--;
+			}
+			previousRecords[j] = record;
+		}
+	} // sortPreviousRecords
+
+
+	/**
+	 * @brief Claim the next slot of a ring and write the record.
+	 * The mirror in RTC memory is derived from the claimed index, so it never
+	 * needs a read-modify-write that could interleave with other writers.
+	 */
+	static void IRAM_ATTR appendRecord(BlackBoxRecord* ring, size_t size, std::atomic<uint32_t>& counter,
+		uint32_t* rtcNext, uint8_t type, uint16_t code, uint32_t value) {
+		uint32_t index = counter.fetch_add(1, std::memory_order_relaxed);
+		*rtcNext = index + 1;
+
+		BlackBoxRecord& record = ring[index % size];
+		record.type = BLACKBOX_EMPTY;   // mark as incomplete while writing
+		record.timeMs = (uint32_t)(esp_timer_get_time() / 1000);
+		record.core = (uint8_t)xPortGetCoreID();
+		record.code = code;
+		record.value = value;
+		record.type = type;
+	} // appendRecord
+
+
+	static const char* resetReasonToString(esp_reset_reason_t reason) {
+		switch (reason) {
+			case ESP_RST_POWERON:   return "power on";
+			case ESP_RST_EXT:       return "external pin";
+			case ESP_RST_SW:        return "software";
+			case ESP_RST_PANIC:     return "panic";
+			case ESP_RST_INT_WDT:   return "interrupt watchdog";
+			case ESP_RST_TASK_WDT:  return "task watchdog";
+			case ESP_RST_WDT:       return "watchdog";
+			case ESP_RST_DEEPSLEEP: return "deep sleep";
+			case ESP_RST_BROWNOUT:  return "brownout";
+			case ESP_RST_SDIO:      return "SDIO";
+			default:                return "unknown";
+		}
+	} // resetReasonToString
+
+
+	/**
+	 * @brief Start recording.
+	 *
+	 * If the RTC memory holds a recording of the previous run (i.e. the chip was
+	 * not powered off), it is saved for getPreviousRecords() and printed. Must be
+	 * called once, early during boot, before anything is recorded.
+	 */
+	void BlackBox::begin() {
+		previousResetReason = esp_reset_reason();
+		numPreviousRecords = 0;
+
+		if (rtcState.magic == BLACKBOX_MAGIC && previousResetReason != ESP_RST_POWERON) {
+			copyPreviousRecords(rtcState.records, NUM_RECORDS, rtcState.nextRecord);
+			copyPreviousRecords(rtcState.taskRecords, NUM_TASK_RECORDS, rtcState.nextTaskRecord);
+			sortPreviousRecords();
+			previousBootCount = rtcState.bootCount;
+			rtcState.bootCount++;
+		} else {
+			previousBootCount = 0;
+			rtcState.bootCount = 1;
+		}
+
+		memset(rtcState.records, 0, sizeof(rtcState.records));
+		memset(rtcState.taskRecords, 0, sizeof(rtcState.taskRecords));
+		rtcState.nextRecord = 0;
+		rtcState.nextTaskRecord = 0;
+		rtcState.magic = BLACKBOX_MAGIC;
+		nextRecord.store(0);
+		nextTaskRecord.store(0);
+		isRecording = true;
+
+		if (numPreviousRecords > 0) {
+			dump();
+		}
+		recordHeapMinimum();
+	} // begin
+
+
+	/**
+	 * @brief Print the recording of the previous run.
+	 */
+	void BlackBox::dump() {
+		printf("--- Black box: boot %u, reset reason: %s, %d records ---\n",
+			previousBootCount, resetReasonToString(previousResetReason), numPreviousRecords);
+		for (size_t i = 0; i < numPreviousRecords; i++) {
+			const BlackBoxRecord& record = previousRecords[i];
+			char name[5];
+			switch (record.type) {
+				case BLACKBOX_LMIC_EVENT:
+					printf("%8u ms [%d] LMIC event %u\n", record.timeMs, record.core, record.code);
+					break;
+
+				case BLACKBOX_TASK_SWITCH:
+					unpackChars(record.value, name);
+					printf("%8u ms [%d] task %s\n", record.timeMs, record.core, name);
+					break;
+
+				case BLACKBOX_HEAP_MINIMUM:
+					printf("%8u ms [%d] heap minimum %u\n", record.timeMs, record.core, record.value);
+					break;
+
+				case BLACKBOX_FATAL:
+					unpackChars(record.value, name);
+					printf("%8u ms [%d] FATAL %s...:%u\n", record.timeMs, record.core, name, record.code);
+					break;
+
+				default:
+					printf("%8u ms [%d] type %u, code %u, value 0x%08x\n",
+						record.timeMs, record.core, record.type, record.code, record.value);
+					break;
+			}
+		}
+		printf("---\n");
+	} // dump
+
+
+	/**
+	 * @brief Get the records of the previous run, oldest first.
+	 * @param [out] records Array receiving the records.
+	 * @param [in] maxRecords The size of the array.
+	 * @return The number of records copied.
+	 */
+	size_t BlackBox::getPreviousRecords(BlackBoxRecord* records, size_t maxRecords) {
+		size_t count = numPreviousRecords < maxRecords ? numPreviousRecords : maxRecords;
+		memcpy(records, previousRecords + numPreviousRecords - count, count * sizeof(BlackBoxRecord));
+		return count;
+	} // getPreviousRecords
+
+
+	/**
+	 * @brief Add an entry.
+	 * Lock-free; safe to call from any task and from the scheduler trace hooks.
+	 * @param [in] type The record type (BlackBoxRecordType or BLACKBOX_USER and above).
+	 * @param [in] code Type specific code.
+	 * @param [in] value Type specific value.
+	 */
+	void IRAM_ATTR BlackBox::record(uint8_t type, uint16_t code, uint32_t value) {
+		if (!isRecording) {
+			return;
+		}
+
+		appendRecord(rtcState.records, NUM_RECORDS, nextRecord, &rtcState.nextRecord, type, code, value);
+	} // record
+
+
+	void BlackBox::recordLmicEvent(int event) {
+		record(BLACKBOX_LMIC_EVENT, (uint16_t)event, 0);
+		recordHeapMinimum();
+	} // recordLmicEvent
+
+
+	void BlackBox::recordFatal(const char* file, uint16_t line) {
+		const char* baseName = file != nullptr ? strrchr(file, '/') : nullptr;
+		record(BLACKBOX_FATAL, line, packChars(baseName != nullptr ? baseName + 1 : file));
+	} // recordFatal
+
+
+	/**
+	 * @brief Record the minimum free heap if it has dropped since the last call.
+	 */
+	void BlackBox::recordHeapMinimum() {
+		uint32_t minimum = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+		uint32_t previous = heapMinimum.load(std::memory_order_relaxed);
+		if (minimum < previous && heapMinimum.compare_exchange_strong(previous, minimum, std::memory_order_relaxed)) {
+			record(BLACKBOX_HEAP_MINIMUM, 0, minimum);
+		}
+	} // recordHeapMinimum
+
+
+	/**
+	 * @brief Record the task now running on this core, if it changed.
+	 * Called from the scheduler via blackBoxTaskSwitchedIn(). The records go to
+	 * their own ring as they are far more frequent than all others.
+	 * Runs from IRAM and does not call any FreeRTOS function as the flash cache
+	 * may be disabled.
+	 * @param [in] task The task control block of the task switched in.
+	 */
+	void IRAM_ATTR BlackBox::recordTaskSwitch(void* task) {
+		int core = xPortGetCoreID();
+		if (task == lastTask[core]) {
+			return;
+		}
+		lastTask[core] = task;
+		if (!isRecording) {
+			return;
+		}
+		appendRecord(rtcState.taskRecords, NUM_TASK_RECORDS, nextTaskRecord, &rtcState.nextTaskRecord,
+			BLACKBOX_TASK_SWITCH, 0, packChars((const char*)static_cast<StaticTask_t*>(task)->ucDummy7));
+	} // recordTaskSwitch
+
+}
+
+
+// StaticTask_t mirrors the private TCB layout, ucDummy7 being pcTaskName
+extern "C" void IRAM_ATTR blackBoxTaskSwitchedIn(void* task) {
+	scsystem::BlackBox::recordTaskSwitch(task);
+}
@@ -0,0 +1,404 @@
+#include <string.h>
+
+#include <Cbor.h>
+
+namespace scsystem
+{
+
+	static const uint8_t CBOR_MAJOR_UNSIGNED = 0;
+	static const uint8_t CBOR_MAJOR_NEGATIVE = 1;
+	static const uint8_t CBOR_MAJOR_BYTES    = 2;
+	static const uint8_t CBOR_MAJOR_TEXT     = 3;
+	static const uint8_t CBOR_MAJOR_ARRAY    = 4;
+	static const uint8_t CBOR_MAJOR_MAP      = 5;
+	static const uint8_t CBOR_MAJOR_SIMPLE   = 7;
+
+	static const uint8_t CBOR_INFO_UINT8     = 24;
+	static const uint8_t CBOR_INFO_UINT16    = 25;
+	static const uint8_t CBOR_INFO_UINT32    = 26;
+	static const uint8_t CBOR_INFO_UINT64    = 27;
+
+	static const uint8_t CBOR_SIMPLE_FALSE   = 20;
+	static const uint8_t CBOR_SIMPLE_TRUE    = 21;
+	static const uint8_t CBOR_SIMPLE_NULL    = 22;
+	static const uint8_t CBOR_SIMPLE_HALF    = 25;
+	static const uint8_t CBOR_SIMPLE_SINGLE  = 26;
+	static const uint8_t CBOR_SIMPLE_DOUBLE  = 27;
+
+
+	static uint32_t floatToBits(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	} // floatToBits
+
+
+	static float bitsToFloat(uint32_t bits) {
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	} // bitsToFloat
+
+
+	/**
+	 * @brief Convert a float to IEEE 754 half precision if no information is lost.
+	 * @param [in] value The value to convert.
+	 * @param [out] half The half precision representation.
+	 * @return True if the half precision value represents the float exactly.
+	 */
+	static bool floatToHalf(float value, uint16_t* half) {
+		uint32_t bits     = floatToBits(value);
+		uint16_t sign     = (bits >> 16) & 0x8000;
+		int32_t  exponent = (bits >> 23) & 0xff;
+		uint32_t mantissa = bits & 0x7fffff;
+
+		if (exponent == 0xff) {
+			// infinity or NaN (NaN is canonicalized)
+			*half = sign | 0x7c00 | (mantissa != 0 ? 0x0200 : 0);
+			return true;
+		}
+		if (exponent == 0) {
+			// zero is exact, float subnormals are far below the half range
+			*half = sign;
+			return mantissa == 0;
+		}
+
+		int32_t halfExponent = exponent - 127 + 15;
+		if (halfExponent >= 0x1f) {
+			return false;
+		}
+		if (halfExponent >= 1) {
+			*half = sign | (halfExponent << 10) | (mantissa >> 13);
+			return (mantissa & 0x1fff) == 0;
+		}
+
+		// half precision subnormal
+		uint32_t shift = 14 - halfExponent;
+		if (shift > 24) {
+			return false;
+		}
+		mantissa |= 0x800000;
+		*half = sign | (mantissa >> shift);
+		return (mantissa & ((1u << shift) - 1)) == 0;
+	} // floatToHalf
+
+
+	static float halfToFloat(uint16_t half) {
+		uint32_t sign     = (uint32_t)(half & 0x8000) << 16;
+		int32_t  exponent = (half >> 10) & 0x1f;
+		uint32_t mantissa = half & 0x3ff;
+
+		if (exponent == 0x1f) {
+			return bitsToFloat(sign | 0x7f800000 | (mantissa << 13));
+		}
+		if (exponent == 0) {
+			if (mantissa == 0) {
+				return bitsToFloat(sign);
+			}
+			// normalize the subnormal
+			exponent = 1;
+			while ((mantissa & 0x400) == 0) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			mantissa &= 0x3ff;
+		}
+		return bitsToFloat(sign | ((uint32_t)(exponent - 15 + 127) << 23) | (mantissa << 13));
+	} // halfToFloat
+
+
+	/**
+	 * @brief Create an encoder writing into the given buffer.
+	 * @param [in] buffer The output buffer (or nullptr to only compute the size).
+	 * @param [in] capacity The size of the output buffer.
+	 */
+	CborWriter::CborWriter(uint8_t* buffer, size_t capacity):
+		m_buffer {buffer}, m_capacity {buffer != nullptr ? capacity : 0}, m_size {0}
+	{
+	} // CborWriter
+
+
+	/**
+	 * @brief Discard everything written so far and start over.
+	 */
+	void CborWriter::reset() {
+		m_size = 0;
+	} // reset
+
+
+	void CborWriter::put(uint8_t byte) {
+		if (m_size < m_capacity) {
+			m_buffer[m_size] = byte;
+		}
+		m_size++;
+	} // put
+
+
+	void CborWriter::put(const uint8_t* data, size_t length) {
+		if (m_size + length <= m_capacity) {
+			memcpy(m_buffer + m_size, data, length);
+		}
+		m_size += length;
+	} // put
+
+
+	/**
+	 * @brief Write the initial byte and argument of an item using the shortest form.
+	 * @param [in] majorType The CBOR major type (0..7).
+	 * @param [in] value The argument (value, length or count).
+	 */
+	void CborWriter::writeHead(uint8_t majorType, uint64_t value) {
+		uint8_t type = majorType << 5;
+		if (value < CBOR_INFO_UINT8) {
+			put(type | (uint8_t)value);
+		} else if (value <= 0xff) {
+			put(type | CBOR_INFO_UINT8);
+			put((uint8_t)value);
+		} else if (value <= 0xffff) {
+			put(type | CBOR_INFO_UINT16);
+			put((uint8_t)(value >> 8));
+			put((uint8_t)value);
+		} else if (value <= 0xffffffff) {
+			put(type | CBOR_INFO_UINT32);
+			for (int shift = 24; shift >= 0; shift -= 8) {
+				put((uint8_t)(value >> shift));
+			}
+		} else {
+			put(type | CBOR_INFO_UINT64);
+			for (int shift = 56; shift >= 0; shift -= 8) {
+				put((uint8_t)(value >> shift));
+			}
+		}
+	} // writeHead
+
+
+	CborWriter& CborWriter::writeUnsigned(uint64_t value) {
+		writeHead(CBOR_MAJOR_UNSIGNED, value);
+		return *this;
+	} // writeUnsigned
+
+
+	CborWriter& CborWriter::writeInt(int64_t value) {
+		if (value < 0) {
+			// -1 - value, without overflowing for INT64_MIN
+			writeHead(CBOR_MAJOR_NEGATIVE, ~(uint64_t)value);
+		} else {
+			writeHead(CBOR_MAJOR_UNSIGNED, (uint64_t)value);
+		}
+		return *this;
+	} // writeInt
+
+
+	CborWriter& CborWriter::writeBool(bool value) {
+		put((CBOR_MAJOR_SIMPLE << 5) | (value ? CBOR_SIMPLE_TRUE : CBOR_SIMPLE_FALSE));
+		return *this;
+	} // writeBool
+
+
+	CborWriter& CborWriter::writeNull() {
+		put((CBOR_MAJOR_SIMPLE << 5) | CBOR_SIMPLE_NULL);
+		return *this;
+	} // writeNull
+
+
+	/**
+	 * @brief Write a floating point value.
+	 * The value is written as a 3 byte half precision float if that is exact,
+	 * and as a 5 byte single precision float otherwise.
+	 * @param [in] value The value to write.
+	 */
+	CborWriter& CborWriter::writeFloat(float value) {
+		uint16_t half;
+		if (floatToHalf(value, &half)) {
+			put((CBOR_MAJOR_SIMPLE << 5) | CBOR_SIMPLE_HALF);
+			put((uint8_t)(half >> 8));
+			put((uint8_t)half);
+		} else {
+			uint32_t bits = floatToBits(value);
+			put((CBOR_MAJOR_SIMPLE << 5) | CBOR_SIMPLE_SINGLE);
+			for (int shift = 24; shift >= 0; shift -= 8) {
+				put((uint8_t)(bits >> shift));
+			}
+		}
+		return *this;
+	} // writeFloat
+
+
+	CborWriter& CborWriter::writeBytes(const uint8_t* data, size_t length) {
+		writeHead(CBOR_MAJOR_BYTES, length);
+		put(data, length);
+		return *this;
+	} // writeBytes
+
+
+	CborWriter& CborWriter::writeText(const char* text) {
+		return writeText(text, strlen(text));
+	} // writeText
+
+
+	CborWriter& CborWriter::writeText(const char* text, size_t length) {
+		writeHead(CBOR_MAJOR_TEXT, length);
+		put((const uint8_t*)text, length);
+		return *this;
+	} // writeText
+
+
+	/**
+	 * @brief Start an array.
+	 * @param [in] count The number of items that will follow.
+	 */
+	CborWriter& CborWriter::beginArray(size_t count) {
+		writeHead(CBOR_MAJOR_ARRAY, count);
+		return *this;
+	} // beginArray
+
+
+	/**
+	 * @brief Start a map.
+	 * @param [in] count The number of key/value pairs that will follow.
+	 */
+	CborWriter& CborWriter::beginMap(size_t count) {
+		writeHead(CBOR_MAJOR_MAP, count);
+		return *this;
+	} // beginMap
+
+
+	/**
+	 * @brief Create a decoder for the given payload.
+	 * @param [in] buffer The encoded payload.
+	 * @param [in] length The length of the payload.
+	 */
+	CborReader::CborReader(const uint8_t* buffer, size_t length):
+		m_buffer {buffer}, m_length {length}, m_pos {0}, m_failed {false}
+	{
+	} // CborReader
+
+
+	bool CborReader::readArgument(uint8_t info, uint64_t* value) {
+		if (info < CBOR_INFO_UINT8) {
+			*value = info;
+			return true;
+		}
+		if (info > CBOR_INFO_UINT64) {
+			// reserved values and indefinite lengths are not part of the subset
+			return false;
+		}
+
+		size_t numBytes = 1 << (info - CBOR_INFO_UINT8);
+		if (m_length - m_pos < numBytes) {
+			return false;
+		}
+
+		uint64_t result = 0;
+		for (size_t i = 0; i < numBytes; i++) {
+			result = (result << 8) | m_buffer[m_pos++];
+		}
+		*value = result;
+		return true;
+	} // readArgument
+
+
+	/**
+	 * @brief Decode the next item.
+	 * @param [out] item The decoded item.
+	 * @return True if an item was decoded, false at the end of the payload or if
+	 * the payload is malformed (see failed()).
+	 */
+	bool CborReader::next(CborItem* item) {
+		if (m_failed || atEnd()) {
+			return false;
+		}
+
+		uint8_t initial = m_buffer[m_pos++];
+		uint8_t majorType = initial >> 5;
+		uint8_t info = initial & 0x1f;
+		uint64_t argument = 0;
+
+		memset(item, 0, sizeof(*item));
+
+		if (majorType == CBOR_MAJOR_SIMPLE) {
+			switch (info) {
+				case CBOR_SIMPLE_FALSE:
+					item->type = CBOR_FALSE;
+					return true;
+
+				case CBOR_SIMPLE_TRUE:
+					item->type = CBOR_TRUE;
+					return true;
+
+				case CBOR_SIMPLE_NULL:
+					item->type = CBOR_NULL;
+					return true;
+
+				case CBOR_SIMPLE_HALF:
+				case CBOR_SIMPLE_SINGLE:
+				case CBOR_SIMPLE_DOUBLE:
+					if (!readArgument(info, &argument)) {
+						break;
+					}
+					item->type = CBOR_FLOAT;
+					if (info == CBOR_SIMPLE_HALF) {
+						item->floatValue = halfToFloat((uint16_t)argument);
+					} else if (info == CBOR_SIMPLE_SINGLE) {
+						item->floatValue = bitsToFloat((uint32_t)argument);
+					} else {
+						double doubleValue;
+						memcpy(&doubleValue, &argument, sizeof(doubleValue));
+						item->floatValue = (float)doubleValue;
+					}
+					return true;
+
+				default:
+					break;
+			}
+			m_failed = true;
+			return false;
+		}
+
+		if (!readArgument(info, &argument)) {
+			m_failed = true;
+			return false;
+		}
+
+		switch (majorType) {
+			case CBOR_MAJOR_UNSIGNED:
+				item->type = CBOR_UNSIGNED;
+				item->uintValue = argument;
+				item->intValue = (int64_t)argument;
+				return true;
+
+			case CBOR_MAJOR_NEGATIVE:
+				item->type = CBOR_NEGATIVE;
+				item->intValue = -1 - (int64_t)argument;
+				return true;
+
+			case CBOR_MAJOR_BYTES:
+			case CBOR_MAJOR_TEXT:
+				if (argument > m_length - m_pos) {
+					m_failed = true;
+					return false;
+				}
+				item->type = majorType == CBOR_MAJOR_BYTES ? CBOR_BYTES : CBOR_TEXT;
+				item->data = m_buffer + m_pos;
+				item->length = (size_t)argument;
+				m_pos += (size_t)argument;
+				return true;
+
+			case CBOR_MAJOR_ARRAY:
+				item->type = CBOR_ARRAY;
+				item->length = (size_t)argument;
+				return true;
+
+			case CBOR_MAJOR_MAP:
+				item->type = CBOR_MAP;
+				item->length = (size_t)argument;
+				return true;
+
+			default:
+				// tags (major type 6) are not part of the subset
+				m_failed = true;
+				return false;
+		}
+	} // next
+
+}
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include <Cbor.h>
+#include <Metrics.h>
+
+namespace scsystem
+{
+
+	static const char* LOG_TAG = "Metrics";
+
+	static const size_t EXPORT_BUFFER_SIZE = 1024;
+
+	// Head of the registry. Constant initialized, so metrics defined as static
+	// objects in other translation units can safely link themselves in.
+	static std::atomic<Metric*> metricsHead {nullptr};
+
+
+	static inline uint32_t currentShard() {
+		return xPortGetCoreID();
+	} // currentShard
+
+
+	Metric::Metric(const char* name, MetricType type):
+		m_name {name}, m_type {type}, m_next {nullptr}
+	{
+		Metrics::link(this);
+	} // Metric
+
+
+	Counter::Counter(const char* name):
+		Metric {name, METRIC_COUNTER}
+	{
+		for (int i = 0; i < portNUM_PROCESSORS; i++) {
+			m_shards[i].store(0, std::memory_order_relaxed);
+		}
+	} // Counter
+
+
+	/**
+	 * @brief Increment the counter.
+	 * Safe to call from any task on any core; never blocks.
+	 * @param [in] delta The amount to add.
+	 */
+	void Counter::increment(uint32_t delta) {
+		m_shards[currentShard()].fetch_add(delta, std::memory_order_relaxed);
+	} // increment
+
+
+	uint64_t Counter::get() const {
+		uint64_t total = 0;
+		for (int i = 0; i < portNUM_PROCESSORS; i++) {
+			total += m_shards[i].load(std::memory_order_relaxed);
+		}
+		return total;
+	} // get
+
+
+	Gauge::Gauge(const char* name):
+		Metric {name, METRIC_GAUGE}, m_value {0}, m_max {0}
+	{
+	} // Gauge
+
+
+	void Gauge::updateMax(int32_t value) {
+		int32_t max = m_max.load(std::memory_order_relaxed);
+		while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+		}
+	} // updateMax
+
+
+	/**
+	 * @brief Set the current value.
+	 * @param [in] value The new value.
+	 */
+	void Gauge::set(int32_t value) {
+		m_value.store(value, std::memory_order_relaxed);
+		updateMax(value);
+	} // set
+
+
+	/**
+	 * @brief Add to the current value.
+	 * @param [in] delta The amount to add (may be negative).
+	 */
+	void Gauge::add(int32_t delta) {
+		int32_t value = m_value.fetch_add(delta, std::memory_order_relaxed) + delta;
+		updateMax(value);
+	} // add
+
+
+	int32_t Gauge::get() const {
+		return m_value.load(std::memory_order_relaxed);
+	} // get
+
+
+	int32_t Gauge::getMax() const {
+		return m_max.load(std::memory_order_relaxed);
+	} // getMax
+
+
+	Histogram::Histogram(const char* name):
+		Metric {name, METRIC_HISTOGRAM}, m_max {0}
+	{
+		for (int i = 0; i < portNUM_PROCESSORS; i++) {
+			for (size_t j = 0; j < NUM_BUCKETS; j++) {
+				m_shards[i].buckets[j].store(0, std::memory_order_relaxed);
+			}
+			m_shards[i].sumLow.store(0, std::memory_order_relaxed);
+			m_shards[i].sumHigh.store(0, std::memory_order_relaxed);
+		}
+	} // Histogram
+
+
+	/**
+	 * @brief Get the bucket a value is counted in.
+	 * @param [in] value The sample value.
+	 * @return The bucket index (0..NUM_BUCKETS-1).
+	 */
+	size_t Histogram::bucketIndex(uint32_t value) {
+		if (value < (1u << SUB_BUCKET_BITS)) {
+			return value;
+		}
+		uint32_t msb = 31 - __builtin_clz(value);
+		uint32_t sub = (value >> (msb - SUB_BUCKET_BITS)) & ((1u << SUB_BUCKET_BITS) - 1);
+		return ((msb - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) | sub;
+	} // bucketIndex
+
+
+	/**
+	 * @brief Get the smallest value counted in a bucket.
+	 * @param [in] index The bucket index.
+	 * @return The lower bound of the bucket.
+	 */
+	uint32_t Histogram::bucketLowerBound(size_t index) {
+		if (index < (1u << SUB_BUCKET_BITS)) {
+			return index;
+		}
+		uint32_t msb = (index >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+		uint32_t sub = index & ((1u << SUB_BUCKET_BITS) - 1);
+		return (1u << msb) | (sub << (msb - SUB_BUCKET_BITS));
+	} // bucketLowerBound
+
+
+	/**
+	 * @brief Record a sample.
+	 * Safe to call from any task on any core; never blocks.
+	 * @param [in] value The sample value.
+	 */
+	void Histogram::record(uint32_t value) {
+		Shard& shard = m_shards[currentShard()];
+		shard.buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+		uint32_t oldSum = shard.sumLow.fetch_add(value, std::memory_order_relaxed);
+		if (oldSum + value < oldSum) {
+			shard.sumHigh.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		uint32_t max = m_max.load(std::memory_order_relaxed);
+		while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+		}
+	} // record
+
+
+	uint64_t Histogram::getBucketCount(size_t index) const {
+		uint64_t total = 0;
+		for (int i = 0; i < portNUM_PROCESSORS; i++) {
+			total += m_shards[i].buckets[index].load(std::memory_order_relaxed);
+		}
+		return total;
+	} // getBucketCount
+
+
+	uint64_t Histogram::getCount() const {
+		uint64_t total = 0;
+		for (size_t j = 0; j < NUM_BUCKETS; j++) {
+			total += getBucketCount(j);
+		}
+		return total;
+	} // getCount
+
+
+	uint64_t Histogram::getSum() const {
+		uint64_t total = 0;
+		for (int i = 0; i < portNUM_PROCESSORS; i++) {
+			total += ((uint64_t)m_shards[i].sumHigh.load(std::memory_order_relaxed) << 32)
+				| m_shards[i].sumLow.load(std::memory_order_relaxed);
+		}
+		return total;
+	} // getSum
+
+
+	uint32_t Histogram::getMax() const {
+		return m_max.load(std::memory_order_relaxed);
+	} // getMax
+
+
+	/**
+	 * @brief Estimate a percentile.
+	 * @param [in] percent The percentile (0..100).
+	 * @return The lower bound of the bucket containing the percentile, or 0 if there are no samples.
+	 */
+	uint32_t Histogram::getPercentile(uint32_t percent) const {
+		uint64_t total = getCount();
+		if (total == 0) {
+			return 0;
+		}
+
+		uint64_t target = (total * percent + 99) / 100;
+		uint64_t seen = 0;
+		for (size_t j = 0; j < NUM_BUCKETS; j++) {
+			uint64_t count = getBucketCount(j);
+			seen += count;
+			if (seen >= target && count != 0) {
+				return bucketLowerBound(j);
+			}
+		}
+		return getMax();
+	} // getPercentile
+
+
+	/**
+	 * @brief Get the first registered metric.
+	 * Use Metric::getNext() to iterate.
+	 */
+	Metric* Metrics::first() {
+		return metricsHead.load(std::memory_order_acquire);
+	} // first
+
+
+	/**
+	 * @brief Add a metric to the registry.
+	 * Called by the Metric constructor.
+	 * @param [in] metric The metric to add.
+	 */
+	void Metrics::link(Metric* metric) {
+		Metric* head = metricsHead.load(std::memory_order_relaxed);
+		do {
+			metric->m_next = head;
+		} while (!metricsHead.compare_exchange_weak(head, metric, std::memory_order_release, std::memory_order_relaxed));
+	} // link
+
+
+	/**
+	 * @brief Format a text snapshot of all metrics, one line per metric.
+	 * @param [out] buffer The output buffer. The result is always zero terminated.
+	 * @param [in] length The size of the output buffer.
+	 * @return The number of characters written (excluding the terminator).
+	 */
+	size_t Metrics::writeText(char* buffer, size_t length) {
+		if (length == 0) {
+			return 0;
+		}
+
+		size_t pos = 0;
+		buffer[0] = 0;
+		for (Metric* metric = first(); metric != nullptr && pos < length; metric = metric->getNext()) {
+			int n = 0;
+			switch (metric->getType()) {
+				case METRIC_COUNTER: {
+					Counter* counter = static_cast<Counter*>(metric);
+					n = snprintf(buffer + pos, length - pos, "%s %llu\n",
+						metric->getName(), (unsigned long long)counter->get());
+					break;
+				}
+
+				case METRIC_GAUGE: {
+					Gauge* gauge = static_cast<Gauge*>(metric);
+					n = snprintf(buffer + pos, length - pos, "%s %d max=%d\n",
+						metric->getName(), gauge->get(), gauge->getMax());
+					break;
+				}
+
+				case METRIC_HISTOGRAM: {
+					Histogram* histogram = static_cast<Histogram*>(metric);
+					n = snprintf(buffer + pos, length - pos, "%s count=%llu sum=%llu max=%u p50=%u p90=%u p99=%u\n",
+						metric->getName(),
+						(unsigned long long)histogram->getCount(), (unsigned long long)histogram->getSum(),
+						histogram->getMax(), histogram->getPercentile(50), histogram->getPercentile(90),
+						histogram->getPercentile(99));
+					break;
+				}
+			}
+
+			if (n < 0 || (size_t)n >= length - pos) {
+				// truncated: drop the partial line
+				buffer[pos] = 0;
+				break;
+			}
+			pos += n;
+		}
+		return pos;
+	} // writeText
+
+
+	/**
+	 * @brief Encode a compact binary snapshot of all metrics as a CBOR map.
+	 *
+	 * Keys are the metric names. Counters map to an unsigned integer, gauges to
+	 * [value, max] and histograms to [count, sum, max, p50, p90, p99].
+	 *
+	 * @param [out] buffer The output buffer (or nullptr to only compute the size).
+	 * @param [in] length The size of the output buffer.
+	 * @return The size of the complete snapshot; if larger than length the buffer content is incomplete.
+	 */
+	size_t Metrics::writeBinary(uint8_t* buffer, size_t length) {
+		size_t count = 0;
+		for (Metric* metric = first(); metric != nullptr; metric = metric->getNext()) {
+			count++;
+		}
+
+		CborWriter writer(buffer, length);
+		writer.beginMap(count);
+		for (Metric* metric = first(); metric != nullptr; metric = metric->getNext()) {
+			writer.writeText(metric->getName());
+			switch (metric->getType()) {
+				case METRIC_COUNTER:
+					writer.writeUnsigned(static_cast<Counter*>(metric)->get());
+					break;
+
+				case METRIC_GAUGE: {
+					Gauge* gauge = static_cast<Gauge*>(metric);
+					writer.beginArray(2).writeInt(gauge->get()).writeInt(gauge->getMax());
+					break;
+				}
+
+				case METRIC_HISTOGRAM: {
+					Histogram* histogram = static_cast<Histogram*>(metric);
+					writer.beginArray(6)
+						.writeUnsigned(histogram->getCount())
+						.writeUnsigned(histogram->getSum())
+						.writeUnsigned(histogram->getMax())
+						.writeUnsigned(histogram->getPercentile(50))
+						.writeUnsigned(histogram->getPercentile(90))
+						.writeUnsigned(histogram->getPercentile(99));
+					break;
+				}
+			}
+		}
+		return writer.size();
+	} // writeBinary
+
+
+	/**
+	 * @brief Create an exporter.
+	 * @param [in] periodMs The export period in milliseconds.
+	 * @param [in] binary Export the binary (CBOR) snapshot instead of the text snapshot.
+	 * @param [in] sink The function receiving the snapshot (nullptr for stdout).
+	 * @param [in] context Passed to the sink.
+	 */
+	MetricsExporter::MetricsExporter(uint32_t periodMs, bool binary, Metrics::Sink sink, void* context):
+		m_periodMs {periodMs}, m_binary {binary}, m_sink {sink != nullptr ? sink : stdoutSink},
+		m_context {context}, m_handle {nullptr}
+	{
+	} // MetricsExporter
+
+
+	MetricsExporter::~MetricsExporter() {
+		stop();
+	} // ~MetricsExporter
+
+
+	/**
+	 * @brief Start the export task.
+	 * @param [in] priority The priority of the export task.
+	 * @param [in] stackSize The stack size of the export task.
+	 */
+	void MetricsExporter::start(uint8_t priority, uint16_t stackSize) {
+		if (m_handle != nullptr) {
+			return;
+		}
+		if (xTaskCreate(exportTask, "metrics_export", stackSize, this, priority, &m_handle) != pdPASS) {
+			ESP_LOGE(LOG_TAG, "Failed to create export task");
+			m_handle = nullptr;
+		}
+	} // start
+
+
+	/**
+	 * @brief Stop the export task.
+	 */
+	void MetricsExporter::stop() {
+		if (m_handle != nullptr) {
+			vTaskDelete(m_handle);
+			m_handle = nullptr;
+		}
+	} // stop
+
+
+	/**
+	 * @brief Take a snapshot and pass it to the sink immediately.
+	 */
+	void MetricsExporter::exportNow() {
+		uint8_t buffer[EXPORT_BUFFER_SIZE];
+		size_t length;
+		if (m_binary) {
+			length = Metrics::writeBinary(buffer, sizeof(buffer));
+			if (length > sizeof(buffer)) {
+				ESP_LOGW(LOG_TAG, "Binary snapshot needs %d bytes, dropped", length);
+				return;
+			}
+		} else {
+			length = Metrics::writeText((char*) buffer, sizeof(buffer));
+		}
+		m_sink(buffer, length, m_context);
+	} // exportNow
+
+
+	void MetricsExporter::exportTask(void* data) {
+		MetricsExporter* exporter = static_cast<MetricsExporter*>(data);
+		while (true) {
+			vTaskDelay(exporter->m_periodMs / portTICK_PERIOD_MS);
+			exporter->exportNow();
+		}
+	} // exportTask
+
+
+	void MetricsExporter::stdoutSink(const uint8_t* data, size_t length, void* context) {
+		fwrite(data, 1, length, stdout);
+		fflush(stdout);
+	} // stdoutSink
+
+}
@@ -0,0 +1,173 @@
+#include <Tlv.h>
+
+namespace scsystem
+{
+
+	static const uint8_t TLV_TAG_BITS    = 5;
+	static const uint8_t TLV_WIDTH_BITS  = 5;
+	static const uint8_t TLV_HEADER_BITS = TLV_TAG_BITS + TLV_WIDTH_BITS;
+
+
+	/**
+	 * @brief Create an encoder writing into the given buffer.
+	 * @param [in] buffer The output buffer (or nullptr to only compute the size).
+	 * @param [in] capacity The size of the output buffer.
+	 */
+	TlvWriter::TlvWriter(uint8_t* buffer, size_t capacity):
+		m_buffer {buffer}, m_capacity {buffer != nullptr ? capacity : 0}, m_bitPos {0}
+	{
+	} // TlvWriter
+
+
+	/**
+	 * @brief Discard everything written so far and start over.
+	 */
+	void TlvWriter::reset() {
+		m_bitPos = 0;
+	} // reset
+
+
+	void TlvWriter::putBits(uint32_t value, uint8_t bits) {
+		while (bits > 0) {
+			size_t  byteIndex = m_bitPos / 8;
+			uint8_t bitOffset = m_bitPos % 8;
+			uint8_t chunk     = 8 - bitOffset;
+			if (chunk > bits) {
+				chunk = bits;
+			}
+
+			uint8_t part = (uint8_t)((value >> (bits - chunk)) & ((1u << chunk) - 1));
+			if (byteIndex < m_capacity) {
+				if (bitOffset == 0) {
+					m_buffer[byteIndex] = 0;
+				}
+				m_buffer[byteIndex] |= part << (8 - bitOffset - chunk);
+			}
+
+			m_bitPos += chunk;
+			bits -= chunk;
+		}
+	} // putBits
+
+
+	/**
+	 * @brief Write an unsigned field.
+	 * @param [in] tag The field tag (0..31).
+	 * @param [in] value The value; bits above the given width are dropped.
+	 * @param [in] bits The width of the value (1..32).
+	 */
+	TlvWriter& TlvWriter::writeUnsigned(uint8_t tag, uint32_t value, uint8_t bits) {
+		if (bits == 0) {
+			bits = 1;
+		} else if (bits > 32) {
+			bits = 32;
+		}
+		putBits(tag & MAX_TAG, TLV_TAG_BITS);
+		putBits(bits - 1, TLV_WIDTH_BITS);
+		putBits(value, bits);
+		return *this;
+	} // writeUnsigned
+
+
+	/**
+	 * @brief Write a signed field using zigzag encoding.
+	 * @param [in] tag The field tag (0..31).
+	 * @param [in] value The value.
+	 * @param [in] bits The width of the zigzag encoded value (1..32).
+	 */
+	TlvWriter& TlvWriter::writeSigned(uint8_t tag, int32_t value, uint8_t bits) {
+		return writeUnsigned(tag, zigzagEncode(value), bits);
+	} // writeSigned
+
+
+	TlvWriter& TlvWriter::writeBool(uint8_t tag, bool value) {
+		return writeUnsigned(tag, value ? 1 : 0, 1);
+	} // writeBool
+
+
+	/**
+	 * @brief Get the smallest width that holds the given value.
+	 * @param [in] value The value.
+	 * @return The number of bits (at least 1).
+	 */
+	uint8_t TlvWriter::bitsRequired(uint32_t value) {
+		uint8_t bits = 1;
+		while (bits < 32 && (value >> bits) != 0) {
+			bits++;
+		}
+		return bits;
+	} // bitsRequired
+
+
+	uint32_t TlvWriter::zigzagEncode(int32_t value) {
+		return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	} // zigzagEncode
+
+
+	/**
+	 * @brief Create a decoder for the given payload.
+	 * @param [in] buffer The encoded payload.
+	 * @param [in] length The length of the payload in bytes.
+	 */
+	TlvReader::TlvReader(const uint8_t* buffer, size_t length):
+		m_buffer {buffer}, m_bitLength {length * 8}, m_bitPos {0}
+	{
+	} // TlvReader
+
+
+	uint32_t TlvReader::getBits(uint8_t bits) {
+		uint32_t value = 0;
+		while (bits > 0) {
+			uint8_t bitOffset = m_bitPos % 8;
+			uint8_t chunk     = 8 - bitOffset;
+			if (chunk > bits) {
+				chunk = bits;
+			}
+
+			uint8_t byte = m_buffer[m_bitPos / 8];
+			value = (value << chunk) | ((byte >> (8 - bitOffset - chunk)) & ((1u << chunk) - 1));
+
+			m_bitPos += chunk;
+			bits -= chunk;
+		}
+		return value;
+	} // getBits
+
+
+	/**
+	 * @brief Are there any fields left?
+	 * @return True if only padding (or nothing) remains.
+	 */
+	bool TlvReader::atEnd() const {
+		return m_bitLength - m_bitPos < TLV_HEADER_BITS;
+	} // atEnd
+
+
+	/**
+	 * @brief Decode the next field.
+	 * @param [out] tag The field tag.
+	 * @param [out] value The raw value (use zigzagDecode() for signed fields).
+	 * @param [out] bits The width of the value.
+	 * @return True if a field was decoded, false at the end or if the field is truncated.
+	 */
+	bool TlvReader::next(uint8_t* tag, uint32_t* value, uint8_t* bits) {
+		if (atEnd()) {
+			return false;
+		}
+
+		*tag  = (uint8_t)getBits(TLV_TAG_BITS);
+		*bits = (uint8_t)getBits(TLV_WIDTH_BITS) + 1;
+		if (m_bitLength - m_bitPos < *bits) {
+			m_bitPos = m_bitLength;
+			return false;
+		}
+		*value = getBits(*bits);
+		return true;
+	} // next
+
+
+	int32_t TlvReader::zigzagDecode(uint32_t value) {
+		return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+	} // zigzagDecode
+
+}
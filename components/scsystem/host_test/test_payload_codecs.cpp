@@ -0,0 +1,314 @@
+/**
+ * Host test of the CBOR and TLV payload codecs (round trips, limits and sizing passes).
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Cbor.h>
+#include <Tlv.h>
+
+using namespace scsystem;
+
+// Stride of the sweep over all float bit patterns (prime, so all mantissa bits vary)
+static const uint64_t SWEEP_STRIDE = 251;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+
+static uint32_t floatToBits(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+} // floatToBits
+
+
+static float bitsToFloat(uint32_t bits) {
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+} // bitsToFloat
+
+
+/**
+ * @brief Every float must decode to the same bit pattern (NaN to a NaN), using
+ * the 3 byte half precision form whenever that is exact.
+ */
+static void testFloats() {
+	printf("CBOR floats\n");
+	uint8_t buffer[8];
+	uint32_t checked = 0;
+	uint32_t half = 0;
+	int sweepFailures = 0;
+
+	for (uint64_t bits = 0; bits <= UINT32_MAX; bits += SWEEP_STRIDE) {
+		float value = bitsToFloat((uint32_t)bits);
+		CborWriter writer(buffer, sizeof(buffer));
+		writer.writeFloat(value);
+
+		CborReader reader(writer.data(), writer.size());
+		CborItem item;
+		bool ok = reader.next(&item) && item.type == CBOR_FLOAT && reader.atEnd()
+			&& (writer.size() == 3 || writer.size() == 5)
+			&& (isnan(value) ? isnan(item.floatValue) : floatToBits(item.floatValue) == (uint32_t)bits);
+		if (!ok) {
+			if (sweepFailures < 10) {
+				printf("  %a encoded in %u bytes, decoded as %a\n", value, (unsigned)writer.size(), item.floatValue);
+			}
+			sweepFailures++;
+		}
+		checked++;
+		half += writer.size() == 3;
+	}
+	printf("  %u values (%u as half precision), %d failures\n", checked, half, sweepFailures);
+	failures += sweepFailures;
+
+	// boundaries of the half precision range
+	const struct {
+		float    value;
+		size_t   size;
+	} cases[] = {
+		{ 0.0f, 3 },
+		{ -0.0f, 3 },
+		{ 1.5f, 3 },
+		{ 65504.0f, 3 },             // largest half
+		{ 65536.0f, 5 },
+		{ 6.103515625e-05f, 3 },     // smallest normal half
+		{ 5.9604644775390625e-08f, 3 }, // smallest subnormal half
+		{ 2.98023223876953125e-08f, 5 },
+		{ 0.1f, 5 },
+		{ INFINITY, 3 },
+		{ -INFINITY, 3 },
+		{ NAN, 3 },
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		CborWriter writer(buffer, sizeof(buffer));
+		writer.writeFloat(cases[i].value);
+		CHECK(writer.size() == cases[i].size);
+	}
+} // testFloats
+
+
+/**
+ * @brief Integers at the limits of each argument size and of int64/uint64.
+ */
+static void testIntegers() {
+	printf("CBOR integer limits\n");
+	const struct {
+		int64_t  value;
+		size_t   size;
+	} ints[] = {
+		{ 0, 1 },
+		{ 23, 1 },
+		{ 24, 2 },
+		{ -24, 1 },
+		{ -25, 2 },
+		{ 255, 2 },
+		{ 256, 3 },
+		{ -256, 2 },
+		{ -257, 3 },
+		{ 65535, 3 },
+		{ 65536, 5 },
+		{ 4294967295LL, 5 },
+		{ 4294967296LL, 9 },
+		{ -4294967296LL, 5 },
+		{ -4294967297LL, 9 },
+		{ INT64_MAX, 9 },
+		{ INT64_MIN, 9 },
+	};
+	uint8_t buffer[16];
+
+	for (size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+		CborWriter writer(buffer, sizeof(buffer));
+		writer.writeInt(ints[i].value);
+		CHECK(writer.size() == ints[i].size);
+
+		CborReader reader(writer.data(), writer.size());
+		CborItem item;
+		CHECK(reader.next(&item));
+		CHECK(item.type == (ints[i].value < 0 ? CBOR_NEGATIVE : CBOR_UNSIGNED));
+		CHECK(item.intValue == ints[i].value);
+		CHECK(reader.atEnd());
+	}
+
+	CborWriter writer(buffer, sizeof(buffer));
+	writer.writeUnsigned(UINT64_MAX);
+	CHECK(writer.size() == 9);
+	CborReader reader(writer.data(), writer.size());
+	CborItem item;
+	CHECK(reader.next(&item));
+	CHECK(item.type == CBOR_UNSIGNED);
+	CHECK(item.uintValue == UINT64_MAX);
+
+	// truncated argument
+	CborReader truncated(writer.data(), writer.size() - 1);
+	CHECK(!truncated.next(&item));
+	CHECK(truncated.failed());
+} // testIntegers
+
+
+static void writeDocument(CborWriter& writer) {
+	static const uint8_t blob[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+	writer.beginMap(4)
+		.writeText("t").writeFloat(21.5f)
+		.writeText("id").writeBytes(blob, sizeof(blob))
+		.writeText("ok").writeBool(true)
+		.writeText("v").beginArray(3)
+			.writeInt(-1000).writeUnsigned(100000).writeNull();
+} // writeDocument
+
+
+/**
+ * @brief The sizing pass and an overflowing buffer must report the size of the
+ * complete payload without writing past the buffer.
+ */
+static void testSizing() {
+	printf("CBOR sizing pass and overflow\n");
+	CborWriter sizing(nullptr, 0);
+	writeDocument(sizing);
+	size_t size = sizing.size();
+	CHECK(size == 36);
+	CHECK(sizing.overflowed());
+
+	uint8_t buffer[64];
+	CborWriter writer(buffer, sizeof(buffer));
+	writeDocument(writer);
+	CHECK(writer.size() == size);
+	CHECK(!writer.overflowed());
+
+	// decode the complete payload
+	CborReader reader(writer.data(), writer.size());
+	CborItem item;
+	CHECK(reader.next(&item) && item.type == CBOR_MAP && item.length == 4);
+	CHECK(reader.next(&item) && item.type == CBOR_TEXT && item.length == 1 && item.data[0] == 't');
+	CHECK(reader.next(&item) && item.type == CBOR_FLOAT && item.floatValue == 21.5f);
+	CHECK(reader.next(&item) && item.type == CBOR_TEXT && item.length == 2);
+	CHECK(reader.next(&item) && item.type == CBOR_BYTES && item.length == 10 && item.data[9] == 10);
+	CHECK(reader.next(&item) && item.type == CBOR_TEXT);
+	CHECK(reader.next(&item) && item.type == CBOR_TRUE);
+	CHECK(reader.next(&item) && item.type == CBOR_TEXT);
+	CHECK(reader.next(&item) && item.type == CBOR_ARRAY && item.length == 3);
+	CHECK(reader.next(&item) && item.type == CBOR_NEGATIVE && item.intValue == -1000);
+	CHECK(reader.next(&item) && item.type == CBOR_UNSIGNED && item.uintValue == 100000);
+	CHECK(reader.next(&item) && item.type == CBOR_NULL);
+	CHECK(reader.atEnd() && !reader.failed());
+
+	// every buffer shorter than the payload overflows and keeps the bytes after it untouched
+	for (size_t capacity = 0; capacity < size; capacity++) {
+		uint8_t guarded[64];
+		memset(guarded, 0xa5, sizeof(guarded));
+		CborWriter small(guarded, capacity);
+		writeDocument(small);
+		CHECK(small.size() == size);
+		CHECK(small.overflowed());
+		for (size_t i = capacity; i < sizeof(guarded); i++) {
+			CHECK(guarded[i] == 0xa5);
+		}
+	}
+
+	writer.reset();
+	CHECK(writer.size() == 0);
+} // testSizing
+
+
+/**
+ * @brief Fields of all widths, the clamping of 0 and >32 bits, zigzag encoding
+ * and the TLV sizing pass.
+ */
+static void testTlv() {
+	printf("TLV fields of 0 to 32 bits\n");
+	uint8_t buffer[128];
+	TlvWriter writer(buffer, sizeof(buffer));
+	size_t bitSize = 0;
+
+	for (uint8_t bits = 0; bits <= 32; bits++) {
+		uint32_t value = bits == 0 ? 0 : 0xa5a5a5a5u >> (32 - bits);
+		writer.writeUnsigned(bits & TlvWriter::MAX_TAG, value, bits);
+		bitSize += 10 + (bits == 0 ? 1 : bits);
+	}
+	writer.writeUnsigned(7, 0xffffffffu, 40);  // clamped to 32 bits
+	writer.writeUnsigned(8, 0xffu, 4);         // excess bits are dropped
+	writer.writeSigned(9, INT32_MIN, 32);
+	writer.writeSigned(10, -1, 1);
+	writer.writeBool(11, true);
+	bitSize += 42 + 14 + 42 + 11 + 11;
+	CHECK(writer.bitSize() == bitSize);
+	CHECK(writer.size() == (bitSize + 7) / 8);
+	CHECK(!writer.overflowed());
+
+	TlvReader reader(writer.data(), writer.size());
+	uint8_t tag;
+	uint32_t value;
+	uint8_t bits;
+	for (uint8_t width = 0; width <= 32; width++) {
+		uint32_t expected = width == 0 ? 0 : 0xa5a5a5a5u >> (32 - width);
+		CHECK(reader.next(&tag, &value, &bits));
+		CHECK(tag == (width & TlvWriter::MAX_TAG));
+		CHECK(bits == (width == 0 ? 1 : width));
+		CHECK(value == expected);
+	}
+	CHECK(reader.next(&tag, &value, &bits) && tag == 7 && bits == 32 && value == 0xffffffffu);
+	CHECK(reader.next(&tag, &value, &bits) && tag == 8 && bits == 4 && value == 0xf);
+	CHECK(reader.next(&tag, &value, &bits) && tag == 9 && TlvReader::zigzagDecode(value) == INT32_MIN);
+	CHECK(reader.next(&tag, &value, &bits) && tag == 10 && TlvReader::zigzagDecode(value) == -1);
+	CHECK(reader.next(&tag, &value, &bits) && tag == 11 && value == 1);
+	CHECK(reader.atEnd());
+	CHECK(!reader.next(&tag, &value, &bits));
+
+	// truncated payload
+	TlvReader truncated(writer.data(), 2);
+	CHECK(truncated.next(&tag, &value, &bits) && bits == 1);
+	CHECK(!truncated.next(&tag, &value, &bits));
+	CHECK(truncated.atEnd());
+
+	// zigzag and width helpers
+	CHECK(TlvWriter::zigzagEncode(0) == 0);
+	CHECK(TlvWriter::zigzagEncode(-1) == 1);
+	CHECK(TlvWriter::zigzagEncode(1) == 2);
+	CHECK(TlvWriter::zigzagEncode(INT32_MAX) == 0xfffffffeu);
+	CHECK(TlvWriter::zigzagEncode(INT32_MIN) == 0xffffffffu);
+	CHECK(TlvWriter::bitsRequired(0) == 1);
+	CHECK(TlvWriter::bitsRequired(1) == 1);
+	CHECK(TlvWriter::bitsRequired(2) == 2);
+	CHECK(TlvWriter::bitsRequired(0x80000000u) == 32);
+
+	// sizing pass and overflow
+	TlvWriter sizing(nullptr, 0);
+	uint8_t guarded[8];
+	memset(guarded, 0xa5, sizeof(guarded));
+	TlvWriter small(guarded, 3);
+	for (int i = 0; i < 4; i++) {
+		sizing.writeUnsigned(i, 0x1234, 13);
+		small.writeUnsigned(i, 0x1234, 13);
+	}
+	CHECK(sizing.size() == 12);
+	CHECK(sizing.overflowed());
+	CHECK(small.size() == 12);
+	CHECK(small.overflowed());
+	for (size_t i = 3; i < sizeof(guarded); i++) {
+		CHECK(guarded[i] == 0xa5);
+	}
+	TlvReader partial(small.data(), 3);
+	CHECK(partial.next(&tag, &value, &bits) && tag == 0 && bits == 13 && value == 0x1234);
+} // testTlv
+
+
+int main() {
+	testFloats();
+	testIntegers();
+	testSizing();
+	testTlv();
+
+	printf(failures == 0 ? "PASSED\n" : "FAILED\n");
+	return failures == 0 ? 0 : 1;
+} // main
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace scsystem
+{
+
+	enum BlackBoxRecordType {
+		BLACKBOX_EMPTY        = 0,
+		BLACKBOX_LMIC_EVENT   = 1,   // code: LMIC event (ev_t)
+		BLACKBOX_TASK_SWITCH  = 2,   // value: first 4 characters of the task name
+		BLACKBOX_HEAP_MINIMUM = 3,   // value: new minimum of free heap (bytes)
+		BLACKBOX_FATAL        = 4,   // code: source line, value: first 4 characters of the file name
+		BLACKBOX_USER         = 16   // first type available to the application
+	};
+
+
+	/**
+	 * @brief A single black box entry (12 bytes).
+	 */
+	struct BlackBoxRecord {
+		uint32_t timeMs;   // time since boot
+		uint8_t  type;     // BlackBoxRecordType
+		uint8_t  core;     // core that recorded the entry
+		uint16_t code;
+		uint32_t value;
+	};
+
+
+	/**
+	 * @brief Crash recorder in RTC slow memory.
+	 *
+	 * The last NUM_RECORDS entries are kept in a ring in RTC slow memory, which
+	 * is not initialized on a software, watchdog or panic reset. On the next
+	 * boot, begin() prints the entries of the previous run together with the
+	 * reset reason and then starts a new recording.
+	 *
+	 * Recording claims a slot with a single atomic increment and writes 12 bytes,
+	 * so it can stay enabled permanently, including from the LMIC task. Task
+	 * switches are recorded by the FreeRTOS trace hook traceTASK_SWITCHED_IN,
+	 * which the component's CMakeLists.txt defines for the C sources of the
+	 * whole build (see BlackBoxTrace.h). They are kept in a separate ring of
+	 * NUM_TASK_RECORDS entries so they cannot push out the other records.
+	 *
+	 * The hook runs inside the scheduler, possibly while the flash cache is
+	 * disabled (e.g. during NVS writes), so its code path is in IRAM and reads
+	 * the task name directly from the task control block.
+	 */
+	class BlackBox {
+
+		public:
+			static const size_t NUM_RECORDS = 64;
+			static const size_t NUM_TASK_RECORDS = 16;
+
+			static void   begin();
+			static void   dump();
+			static size_t getPreviousRecords(BlackBoxRecord* records, size_t maxRecords);
+
+			static void   record(uint8_t type, uint16_t code, uint32_t value);
+			static void   recordLmicEvent(int event);
+			static void   recordFatal(const char* file, uint16_t line);
+			static void   recordHeapMinimum();
+			static void   recordTaskSwitch(void* task);
+
+	};
+
+}
+
+extern "C" void blackBoxTaskSwitchedIn(void* task);
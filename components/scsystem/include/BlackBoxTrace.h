@@ -0,0 +1,17 @@
+#pragma once
+
+/*
+ * FreeRTOS trace hook recording task switches in the black box.
+ *
+ * Included into all C sources of the build by the component's CMakeLists.txt,
+ * so FreeRTOS' tasks.c picks up the definition. The macro is expanded in
+ * vTaskSwitchContext(), where pxCurrentTCB holds the task switched in.
+ * Must be valid C.
+ */
+
+#ifdef __cplusplus
+extern "C"
+#endif
+void blackBoxTaskSwitchedIn(void* task);
+
+#define traceTASK_SWITCHED_IN() blackBoxTaskSwitchedIn(pxCurrentTCB[xPortGetCoreID()])
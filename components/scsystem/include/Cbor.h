@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace scsystem
+{
+
+	/**
+	 * @brief Streaming encoder for a compact subset of CBOR (RFC 7049).
+	 *
+	 * Supported items: unsigned and negative integers, byte and text strings,
+	 * definite length arrays and maps, false/true/null and floats (emitted as
+	 * half precision when that is lossless, single precision otherwise).
+	 *
+	 * The encoder never allocates: it writes straight into the buffer given to
+	 * the constructor. When the buffer is too small the encoder keeps counting,
+	 * so size() always reports the number of bytes the complete payload needs
+	 * and overflowed() tells if the buffer holds all of them. Passing a null
+	 * buffer with a capacity of 0 gives a pure sizing pass, e.g. to choose a
+	 * data rate before encoding for real.
+	 */
+	class CborWriter {
+
+		public:
+			CborWriter(uint8_t* buffer, size_t capacity);
+
+			void           reset();
+
+			CborWriter&    writeUnsigned(uint64_t value);
+			CborWriter&    writeInt(int64_t value);
+			CborWriter&    writeBool(bool value);
+			CborWriter&    writeNull();
+			CborWriter&    writeFloat(float value);
+			CborWriter&    writeBytes(const uint8_t* data, size_t length);
+			CborWriter&    writeText(const char* text);
+			CborWriter&    writeText(const char* text, size_t length);
+			CborWriter&    beginArray(size_t count);
+			CborWriter&    beginMap(size_t count);
+
+			const uint8_t* data() const { return m_buffer; }
+			size_t         size() const { return m_size; }
+			bool           overflowed() const { return m_size > m_capacity; }
+
+		private:
+			void           writeHead(uint8_t majorType, uint64_t value);
+			void           put(uint8_t byte);
+			void           put(const uint8_t* data, size_t length);
+
+			uint8_t*       m_buffer;
+			size_t         m_capacity;
+			size_t         m_size;
+
+	};
+
+
+	/**
+	 * @brief Type of an item returned by CborReader.
+	 */
+	enum CborType {
+		CBOR_UNSIGNED,
+		CBOR_NEGATIVE,
+		CBOR_BYTES,
+		CBOR_TEXT,
+		CBOR_ARRAY,
+		CBOR_MAP,
+		CBOR_FALSE,
+		CBOR_TRUE,
+		CBOR_NULL,
+		CBOR_FLOAT
+	};
+
+
+	/**
+	 * @brief A single decoded CBOR item.
+	 *
+	 * Depending on the type, the value is in one of the fields:
+	 * * CBOR_UNSIGNED: uintValue
+	 * * CBOR_NEGATIVE: intValue
+	 * * CBOR_BYTES, CBOR_TEXT: data and length (pointing into the decoded buffer)
+	 * * CBOR_ARRAY, CBOR_MAP: length (number of items or key/value pairs that follow)
+	 * * CBOR_FLOAT: floatValue
+	 */
+	struct CborItem {
+		CborType       type;
+		uint64_t       uintValue;
+		int64_t        intValue;
+		float          floatValue;
+		const uint8_t* data;
+		size_t         length;
+	};
+
+
+	/**
+	 * @brief Pull decoder matching CborWriter.
+	 *
+	 * Only depends on the C library so that the same code decodes uplinks on
+	 * the host side (network server integration, test tools). Items are returned
+	 * one at a time in the order they were written; nesting is left to the
+	 * caller, which knows the expected layout from the array and map counts.
+	 */
+	class CborReader {
+
+		public:
+			CborReader(const uint8_t* buffer, size_t length);
+
+			bool           next(CborItem* item);
+			bool           atEnd() const { return m_pos == m_length; }
+			bool           failed() const { return m_failed; }
+
+		private:
+			bool           readArgument(uint8_t info, uint64_t* value);
+
+			const uint8_t* m_buffer;
+			size_t         m_length;
+			size_t         m_pos;
+			bool           m_failed;
+
+	};
+
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace scsystem
+{
+
+	enum MetricType {
+		METRIC_COUNTER,
+		METRIC_GAUGE,
+		METRIC_HISTOGRAM
+	};
+
+
+	/**
+	 * @brief Base class of all metrics.
+	 *
+	 * Metrics are meant to be defined as static objects. The constructor links
+	 * them into the global registry (see Metrics) without taking a lock, so they
+	 * can be defined in any translation unit. Metrics must not be destroyed.
+	 */
+	class Metric {
+
+		public:
+			const char* getName() const { return m_name; }
+			MetricType  getType() const { return m_type; }
+			Metric*     getNext() const { return m_next; }
+
+		protected:
+			Metric(const char* name, MetricType type);
+
+		private:
+			friend class Metrics;
+
+			const char* m_name;
+			MetricType  m_type;
+			Metric*     m_next;
+
+	};
+
+
+	/**
+	 * @brief Monotonic event counter.
+	 *
+	 * Each core increments its own shard, so concurrent updates from both cores
+	 * never contend on the same word. Reading sums the shards.
+	 */
+	class Counter: public Metric {
+
+		public:
+			Counter(const char* name);
+
+			void     increment(uint32_t delta = 1);
+			uint64_t get() const;
+
+		private:
+			std::atomic<uint32_t> m_shards[portNUM_PROCESSORS];
+
+	};
+
+
+	/**
+	 * @brief Instantaneous value (e.g. a queue depth) with its high-water mark.
+	 */
+	class Gauge: public Metric {
+
+		public:
+			Gauge(const char* name);
+
+			void     set(int32_t value);
+			void     add(int32_t delta);
+			int32_t  get() const;
+			int32_t  getMax() const;
+
+		private:
+			void     updateMax(int32_t value);
+
+			std::atomic<int32_t> m_value;
+			std::atomic<int32_t> m_max;
+
+	};
+
+
+	/**
+	 * @brief Log-linear histogram of unsigned 32 bit samples.
+	 *
+	 * Values 0..3 have their own buckets; above that every power of two is split
+	 * into 4 linear sub-buckets, which bounds the relative bucket width to 25%.
+	 * Like Counter, every core records into its own shard.
+	 */
+	class Histogram: public Metric {
+
+		public:
+			static const size_t SUB_BUCKET_BITS = 2;
+			static const size_t NUM_BUCKETS = (32 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+			Histogram(const char* name);
+
+			void     record(uint32_t value);
+
+			uint64_t getCount() const;
+			uint64_t getSum() const;
+			uint32_t getMax() const;
+			uint64_t getBucketCount(size_t index) const;
+			uint32_t getPercentile(uint32_t percent) const;
+
+			static size_t   bucketIndex(uint32_t value);
+			static uint32_t bucketLowerBound(size_t index);
+
+		private:
+			struct Shard {
+				std::atomic<uint32_t> buckets[NUM_BUCKETS];
+				std::atomic<uint32_t> sumLow;
+				std::atomic<uint32_t> sumHigh;
+			};
+
+			Shard                 m_shards[portNUM_PROCESSORS];
+			std::atomic<uint32_t> m_max;
+
+	};
+
+
+	/**
+	 * @brief Registry of all metrics and snapshot formatting.
+	 */
+	class Metrics {
+
+		public:
+			typedef void (*Sink)(const uint8_t* data, size_t length, void* context);
+
+			static Metric* first();
+			static void    link(Metric* metric);
+
+			static size_t  writeText(char* buffer, size_t length);
+			static size_t  writeBinary(uint8_t* buffer, size_t length);
+
+	};
+
+
+	/**
+	 * @brief Periodically writes a snapshot of all metrics to a sink.
+	 *
+	 * The default sink writes the text snapshot to stdout, i.e. the console
+	 * UART. To export over another UART or in an uplink, pass a sink that calls
+	 * uart_write_bytes() or queues the (binary) snapshot for transmission.
+	 */
+	class MetricsExporter {
+
+		public:
+			MetricsExporter(uint32_t periodMs, bool binary = false, Metrics::Sink sink = nullptr, void* context = nullptr);
+			~MetricsExporter();
+
+			void start(uint8_t priority = 2, uint16_t stackSize = 4096);
+			void stop();
+			void exportNow();
+
+		private:
+			static void exportTask(void* data);
+			static void stdoutSink(const uint8_t* data, size_t length, void* context);
+
+			uint32_t      m_periodMs;
+			bool          m_binary;
+			Metrics::Sink m_sink;
+			void*         m_context;
+			TaskHandle_t  m_handle;
+
+	};
+
+}
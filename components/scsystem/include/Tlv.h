@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace scsystem
+{
+
+	/**
+	 * @brief Encoder for bit-packed tag/length/value records.
+	 *
+	 * Denser than CBOR when the value ranges are known in advance. Each field is
+	 * written MSB first as:
+	 *
+	 * * 5 bits: tag (0..31)
+	 * * 5 bits: value width in bits minus one (1..32 bits)
+	 * * n bits: value
+	 *
+	 * Fields are not byte aligned; only the end of the payload is padded with
+	 * zero bits. As padding is always shorter than a field header, no terminator
+	 * is needed. Signed values are zigzag encoded so that small negative numbers
+	 * stay small.
+	 *
+	 * Like CborWriter, the encoder never allocates and keeps counting when the
+	 * buffer is full, so size() reports the space the complete payload needs.
+	 */
+	class TlvWriter {
+
+		public:
+			static const uint8_t MAX_TAG = 31;
+
+			TlvWriter(uint8_t* buffer, size_t capacity);
+
+			void           reset();
+
+			TlvWriter&     writeUnsigned(uint8_t tag, uint32_t value, uint8_t bits);
+			TlvWriter&     writeSigned(uint8_t tag, int32_t value, uint8_t bits);
+			TlvWriter&     writeBool(uint8_t tag, bool value);
+
+			static uint8_t bitsRequired(uint32_t value);
+			static uint32_t zigzagEncode(int32_t value);
+
+			const uint8_t* data() const { return m_buffer; }
+			size_t         size() const { return (m_bitPos + 7) / 8; }
+			size_t         bitSize() const { return m_bitPos; }
+			bool           overflowed() const { return size() > m_capacity; }
+
+		private:
+			void           putBits(uint32_t value, uint8_t bits);
+
+			uint8_t*       m_buffer;
+			size_t         m_capacity;
+			size_t         m_bitPos;
+
+	};
+
+
+	/**
+	 * @brief Decoder matching TlvWriter.
+	 *
+	 * Only depends on the C library so it can be used on the host side as well.
+	 */
+	class TlvReader {
+
+		public:
+			TlvReader(const uint8_t* buffer, size_t length);
+
+			bool           next(uint8_t* tag, uint32_t* value, uint8_t* bits);
+			bool           atEnd() const;
+
+			static int32_t zigzagDecode(uint32_t value);
+
+		private:
+			uint32_t       getBits(uint8_t bits);
+
+			const uint8_t* m_buffer;
+			size_t         m_bitLength;
+			size_t         m_bitPos;
+
+	};
+
+}
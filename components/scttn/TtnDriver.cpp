@@ -3,7 +3,11 @@
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_system.h"
 #include "nvs_flash.h"
+#include "BlackBox.h"
+#include "Metrics.h"
 #include "TtnDriver.h"
 
 // Pins PARA TTGO T-Beam 
@@ -18,16 +22,57 @@
 #define TTN_PIN_DIO0      26
 #define TTN_PIN_DIO1      33
 
-const unsigned JOIN_RETRY_INTERVAL = 30;
+const EventBits_t JOINED_BIT = 1 << 0;
+const uint32_t JOIN_TASK_STACK_SIZE = 8 * 1024;
+const UBaseType_t JOIN_TASK_PRIORITY = 3;
+
+static scsystem::Counter joinAttemptsMetric {"ttn.join.attempts"};
+static scsystem::Counter joinFailuresMetric {"ttn.join.failures"};
+static scsystem::Histogram joinTimeMetric {"ttn.join.time_ms"};
+static scsystem::Gauge txQueueMetric {"ttn.txqueue.depth"};
+static scsystem::Gauge eventQueueMetric {"ttn.eventqueue.highwater"};
+static scsystem::Counter radioIrqMetric {"ttn.radio.irqs"};
+
+// Se ejecuta en la tarea de LMIC con cada evento; userData es el TheThingsNetwork del driver
+static void recordLmicEvent(int event, void* userData)
+{
+    TheThingsNetwork* ttn = static_cast<TheThingsNetwork*>(userData);
+
+    scsystem::BlackBox::recordLmicEvent(event);
+
+    // Las metricas de colas e interrupciones se muestrean aqui: hay eventos con cada
+    // transmision y recepcion, y la libreria TTN no depende de scsystem
+    static uint32_t lastRadioIrqs = 0;
+    uint32_t radioIrqs = ttn->radioInterruptCount();
+    radioIrqMetric.increment(radioIrqs - lastRadioIrqs);
+    lastRadioIrqs = radioIrqs;
+
+    uint32_t dropped;
+    uint32_t highWater;
+    ttn->getEventQueueStats(&dropped, &highWater);
+    eventQueueMetric.set((int32_t)highWater);
+    txQueueMetric.set((int32_t)ttn->queuedMessageCount());
+}
 
 namespace scttn
 {
 
     TtnDriver::TtnDriver(const TtnProvisioning& ttnProvisioningParameter):
-        ttnProvisioning {ttnProvisioningParameter}
+        ttnProvisioning {ttnProvisioningParameter},
+        joinState {JoinState::Idle},
+        joinAttempts {0},
+        retryDelayMs {0},
+        progressCallback {nullptr},
+        progressContext {nullptr},
+        taskFactory {nullptr},
+        joinTask {nullptr},
+        joinEvents {xEventGroupCreate()}
     {
 
         esp_err_t err;
+
+        // Emit the black box of the previous run and start recording
+        scsystem::BlackBox::begin();
         
         // Initialize the GPIO ISR handler service
         printf("TtnDriver::init(): gpio_install_isr_service()\n");
@@ -52,6 +97,8 @@ namespace scttn
         ESP_ERROR_CHECK(err);
 
         // Configure the SX127x pins
+        ttn.onEvent(recordLmicEvent, &ttn);
+        ttn.onFatalError(scsystem::BlackBox::recordFatal);
         ttn.configurePins(TTN_SPI_HOST, TTN_PIN_NSS, TTN_PIN_RXTX, TTN_PIN_RST, TTN_PIN_DIO0, TTN_PIN_DIO1);
 
         // The below line can be commented after the first run as the data is saved in NVS
@@ -62,21 +109,120 @@ namespace scttn
 
     }
 
-    void TtnDriver::connect(ITtnTaskFactory& ttnTaskFacyoty) {
+    void TtnDriver::setJoinBackoff(const JoinBackoff& backoff) {
+        joinBackoff = backoff;
+    }
+
+    void TtnDriver::onJoinProgress(JoinProgressCallback callback, void* context) {
+        progressContext = context;
+        progressCallback = callback;
+    }
+
+    // No bloquea: el join se hace en una tarea propia y, cuando se consigue,
+    // esa misma tarea crea la tarea de la aplicacion con la factoria.
+    void TtnDriver::connect(ITtnTaskFactory& ttnTaskFactory) {
 
         // Debug
         printf("start: TtnDriver::connect(...)\n");
 
-        // Se intenta el join de forma indefinida
-        while (!ttn.join()) {
-            printf("Joining...\n");
-            vTaskDelay(JOIN_RETRY_INTERVAL * 1000 / portTICK_PERIOD_MS);
+        if (joinTask != nullptr) {
+            printf("TtnDriver::connect(): join ya en curso\n");
+            return;
         }
 
+        taskFactory = &ttnTaskFactory;
+        xTaskCreate(joinTaskFunction, "ttn_join", JOIN_TASK_STACK_SIZE, this, JOIN_TASK_PRIORITY, &joinTask);
+
+    }
+
+    JoinProgress TtnDriver::getJoinProgress() const {
+        JoinProgress progress;
+        progress.state = joinState;
+        progress.attempts = joinAttempts;
+        progress.retryDelayMs = retryDelayMs;
+        return progress;
+    }
+
+    bool TtnDriver::waitForJoin(TickType_t ticksToWait) {
+        EventBits_t bits = xEventGroupWaitBits(joinEvents, JOINED_BIT, pdFALSE, pdTRUE, ticksToWait);
+        return (bits & JOINED_BIT) != 0;
+    }
+
+    void TtnDriver::joinTaskFunction(void* pvParameter) {
+        TtnDriver* driver = static_cast<TtnDriver*>(pvParameter);
+        driver->join();
+
         // Ya estamo en la red, podemos empezar
         printf("Joined!\n");
-        ttnTaskFacyoty.createAndLaunch(ttn);
+        driver->taskFactory->createAndLaunch(driver->ttn);
 
+        driver->joinTask = nullptr;
+        vTaskDelete(nullptr);
+    }
+
+    // Se intenta el join de forma indefinida, con esperas crecientes entre intentos
+    void TtnDriver::join() {
+
+        retryDelayMs = 0;
+
+        // Si venimos de deep sleep o de un reinicio, se reanuda la sesion guardada sin join
+        if (ttn.resumeSession()) {
+            printf("Sesion reanudada\n");
+            setJoinState(JoinState::Joined);
+            xEventGroupSetBits(joinEvents, JOINED_BIT);
+            return;
+        }
+
+        while (true) {
+            joinAttempts = joinAttempts + 1;
+            joinAttemptsMetric.increment();
+            setJoinState(JoinState::Joining);
+            int64_t joinStart = esp_timer_get_time();
+            bool joined = ttn.join();
+            joinTimeMetric.record((uint32_t)((esp_timer_get_time() - joinStart) / 1000));
+            if (joined) {
+                break;
+            }
+
+            joinFailuresMetric.increment();
+            retryDelayMs = nextRetryDelay();
+            printf("Join fallido, reintento en %u ms\n", retryDelayMs);
+            setJoinState(JoinState::WaitingRetry);
+            vTaskDelay(pdMS_TO_TICKS(retryDelayMs));
+        }
+
+        // Copia en NVS para sobrevivir tambien a un corte de alimentacion
+        ttn.saveSession(true);
+
+        retryDelayMs = 0;
+        setJoinState(JoinState::Joined);
+        xEventGroupSetBits(joinEvents, JOINED_BIT);
+
+    }
+
+    // Espera exponencial (initial * multiplier^(n-1), limitada a max) con jitter aleatorio
+    uint32_t TtnDriver::nextRetryDelay() {
+
+        uint64_t delay = joinBackoff.initialDelayMs;
+        for (uint32_t i = 1; i < joinAttempts && delay < joinBackoff.maxDelayMs; i++) {
+            delay *= joinBackoff.multiplier;
+        }
+        if (delay > joinBackoff.maxDelayMs) {
+            delay = joinBackoff.maxDelayMs;
+        }
+
+        uint8_t jitterPercent = joinBackoff.jitterPercent > 100 ? 100 : joinBackoff.jitterPercent;
+        uint32_t jitterRange = (uint32_t)(delay * jitterPercent / 100);
+        uint32_t jitter = jitterRange > 0 ? esp_random() % (jitterRange + 1) : 0;
+        return (uint32_t)delay - jitterRange + jitter;
+
+    }
+
+    void TtnDriver::setJoinState(JoinState state) {
+        joinState = state;
+        if (progressCallback != nullptr) {
+            progressCallback(getJoinProgress(), progressContext);
+        }
     }
 
-}
\ No newline at end of file
+}
@@ -1,21 +1,71 @@
 #pragma once
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
 #include "TheThingsNetwork.h"
 #include "TtnProvisioning.h"
 #include "TtnTaskFactory.h"
 
 namespace scttn
 {
+
+    // Parametros del reintento del join: el intervalo crece exponencialmente
+    // hasta maxDelayMs y se reparte aleatoriamente para que los dispositivos
+    // no reintenten todos a la vez tras la caida de un gateway.
+    struct JoinBackoff
+    {
+        uint32_t initialDelayMs = 15 * 1000;
+        uint32_t maxDelayMs = 30 * 60 * 1000;
+        uint8_t multiplier = 2;
+        uint8_t jitterPercent = 50;     // el intervalo se elige entre (100 - jitter)% y 100%
+    };
+
+    enum class JoinState
+    {
+        Idle,
+        Joining,
+        WaitingRetry,
+        Joined
+    };
+
+    struct JoinProgress
+    {
+        JoinState state;
+        uint32_t attempts;
+        uint32_t retryDelayMs;          // espera hasta el siguiente intento (WaitingRetry)
+    };
+
+    typedef void (*JoinProgressCallback)(const JoinProgress& progress, void* context);
+
     class TtnDriver 
     {
 
         public:
             TtnDriver(const TtnProvisioning& ttnProvisioningParameter);
+            void setJoinBackoff(const JoinBackoff& backoff);
+            void onJoinProgress(JoinProgressCallback callback, void* context = nullptr);
             void connect(ITtnTaskFactory& ttnTaskFactory);
+            JoinProgress getJoinProgress() const;
+            bool waitForJoin(TickType_t ticksToWait = portMAX_DELAY);
 
         private:
             TtnProvisioning ttnProvisioning;
             TheThingsNetwork ttn;
+            JoinBackoff joinBackoff;
+            volatile JoinState joinState;
+            volatile uint32_t joinAttempts;
+            volatile uint32_t retryDelayMs;
+            JoinProgressCallback progressCallback;
+            void* progressContext;
+            ITtnTaskFactory* taskFactory;
+            TaskHandle_t joinTask;
+            EventGroupHandle_t joinEvents;
+
+            static void joinTaskFunction(void* pvParameter);
+            void join();
+            uint32_t nextRetryDelay();
+            void setJoinState(JoinState state);
 
     };
 
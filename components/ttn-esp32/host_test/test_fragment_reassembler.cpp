@@ -0,0 +1,190 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host test of the fragmentation protocol (reassembly and resend requests).
+ *******************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "TTNFragmentReassembler.h"
+
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// Splits the buffer into fragments the way 'TTNFragmenter' does
+static std::vector<std::vector<uint8_t>> fragment(uint8_t id, const std::vector<uint8_t>& buffer, size_t fragmentSize)
+{
+    size_t count = (buffer.size() + fragmentSize - 1) / fragmentSize;
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t index = 0; index < count; index++)
+    {
+        size_t offset = index * fragmentSize;
+        size_t size = buffer.size() - offset < fragmentSize ? buffer.size() - offset : fragmentSize;
+        std::vector<uint8_t> frame;
+        frame.push_back(id);
+        frame.push_back((uint8_t)index);
+        frame.push_back((uint8_t)count);
+        frame.insert(frame.end(), buffer.begin() + offset, buffer.begin() + offset + size);
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+static std::vector<uint8_t> testBuffer(size_t length)
+{
+    std::vector<uint8_t> buffer(length);
+    for (size_t i = 0; i < length; i++)
+        buffer[i] = (uint8_t)(i * 7 + 3);
+    return buffer;
+}
+
+static void testInOrder()
+{
+    printf("in-order transfer\n");
+    std::vector<uint8_t> buffer = testBuffer(100);
+    std::vector<std::vector<uint8_t>> frames = fragment(5, buffer, 8);
+    TTNFragmentReassembler reassembler;
+
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        bool complete = reassembler.addFragment(frames[i].data(), frames[i].size());
+        CHECK(complete == (i == frames.size() - 1));
+    }
+
+    CHECK(reassembler.isComplete());
+    CHECK(reassembler.transferId() == 5);
+    CHECK(reassembler.data() == buffer);
+
+    uint8_t request[33];
+    CHECK(reassembler.buildResendRequest(request, sizeof(request)) == 1);
+    CHECK(request[0] == 5);
+}
+
+static void testResendRequest()
+{
+    printf("missing, duplicate and out-of-order fragments\n");
+    std::vector<uint8_t> buffer = testBuffer(20 * 10 - 4);
+    std::vector<std::vector<uint8_t>> frames = fragment(9, buffer, 10);
+    TTNFragmentReassembler reassembler;
+
+    // fragments 3, 9 and 17 are lost, the others arrive in reverse order, some twice
+    for (int i = (int)frames.size() - 1; i >= 0; i--)
+    {
+        if (i == 3 || i == 9 || i == 17)
+            continue;
+        CHECK(!reassembler.addFragment(frames[i].data(), frames[i].size()));
+        if (i % 4 == 0)
+            CHECK(!reassembler.addFragment(frames[i].data(), frames[i].size()));
+    }
+    CHECK(!reassembler.isComplete());
+    CHECK(reassembler.data().empty());
+
+    uint8_t request[33];
+    CHECK(reassembler.buildResendRequest(request, 3) == 0); // buffer too small
+    CHECK(reassembler.buildResendRequest(request, sizeof(request)) == 4);
+    CHECK(request[0] == 9);
+    CHECK(request[1] == 0x08);
+    CHECK(request[2] == 0x02);
+    CHECK(request[3] == 0x02);
+
+    CHECK(!reassembler.addFragment(frames[17].data(), frames[17].size()));
+    CHECK(!reassembler.addFragment(frames[3].data(), frames[3].size()));
+    CHECK(reassembler.addFragment(frames[9].data(), frames[9].size()));
+    CHECK(reassembler.data() == buffer);
+    CHECK(reassembler.buildResendRequest(request, sizeof(request)) == 1);
+}
+
+static void testNewTransfer()
+{
+    printf("new transfer discards the previous one\n");
+    std::vector<std::vector<uint8_t>> first = fragment(1, testBuffer(30), 10);
+    std::vector<uint8_t> buffer = testBuffer(25);
+    std::vector<std::vector<uint8_t>> second = fragment(2, buffer, 10);
+    TTNFragmentReassembler reassembler;
+
+    reassembler.addFragment(first[0].data(), first[0].size());
+    reassembler.addFragment(first[1].data(), first[1].size());
+    CHECK(!reassembler.addFragment(second[2].data(), second[2].size()));
+    CHECK(reassembler.transferId() == 2);
+
+    // a late fragment of the first transfer starts over again
+    CHECK(!reassembler.addFragment(first[2].data(), first[2].size()));
+    CHECK(reassembler.transferId() == 1);
+
+    for (size_t i = 0; i < second.size(); i++)
+        reassembler.addFragment(second[i].data(), second[i].size());
+    CHECK(reassembler.isComplete());
+    CHECK(reassembler.data() == buffer);
+
+    reassembler.reset();
+    CHECK(!reassembler.isComplete());
+    uint8_t request[33];
+    CHECK(reassembler.buildResendRequest(request, sizeof(request)) == 0);
+}
+
+static void testInvalidFrames()
+{
+    printf("invalid frames\n");
+    TTNFragmentReassembler reassembler;
+    const uint8_t tooShort[] = { 1, 0 };
+    const uint8_t noFragments[] = { 1, 0, 0, 0x55 };
+    const uint8_t indexOutOfRange[] = { 1, 2, 2, 0x55 };
+
+    CHECK(!reassembler.addFragment(tooShort, sizeof(tooShort)));
+    CHECK(!reassembler.addFragment(noFragments, sizeof(noFragments)));
+    CHECK(!reassembler.addFragment(indexOutOfRange, sizeof(indexOutOfRange)));
+
+    uint8_t request[33];
+    CHECK(reassembler.buildResendRequest(request, sizeof(request)) == 0); // no transfer started
+}
+
+static void testMaxFragments()
+{
+    printf("maximum number of fragments\n");
+    std::vector<uint8_t> buffer = testBuffer(TTN_MAX_FRAGMENTS * 2);
+    std::vector<std::vector<uint8_t>> frames = fragment(200, buffer, 2);
+    CHECK(frames.size() == TTN_MAX_FRAGMENTS);
+    TTNFragmentReassembler reassembler;
+
+    for (size_t i = 0; i < frames.size() - 1; i++)
+        reassembler.addFragment(frames[i].data(), frames[i].size());
+
+    uint8_t request[33];
+    CHECK(reassembler.buildResendRequest(request, 32) == 0);
+    CHECK(reassembler.buildResendRequest(request, sizeof(request)) == 33);
+    CHECK(request[32] == 0x40); // fragment 254
+    for (int i = 1; i < 32; i++)
+        CHECK(request[i] == 0);
+
+    CHECK(reassembler.addFragment(frames.back().data(), frames.back().size()));
+    CHECK(reassembler.data() == buffer);
+}
+
+int main()
+{
+    testInOrder();
+    testResendRequest();
+    testNewTransfer();
+    testInvalidFrames();
+    testMaxFragments();
+
+    printf(failures == 0 ? "PASSED\n" : "FAILED\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host test and benchmark of the float-packing functions of lmic_util.
+ *******************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lmic_util.h"
+
+
+// Stride of the sweep over all float bit patterns (prime, so all mantissa bits vary)
+#define SWEEP_STRIDE 251
+// Number of values per benchmark run
+#define BENCH_VALUES 4096
+// Number of benchmark runs
+#define BENCH_RUNS 2000
+
+typedef uint16_t (*ScalarEncoder)(float);
+typedef void (*ArrayEncoder)(uint16_t*, const float*, size_t);
+typedef float (*ScalarDecoder)(uint16_t);
+typedef void (*ArrayDecoder)(float*, const uint16_t*, size_t);
+
+struct Format
+{
+    const char* name;
+    unsigned fractionBits;
+    int isSigned;
+    ScalarEncoder encode;
+    ArrayEncoder encodeArray;
+    ScalarDecoder decode;
+    ArrayDecoder decodeArray;
+};
+
+static const struct Format formats[] = {
+    { "sflt16", 11, 1, LMIC_f2sflt16, LMIC_f2sflt16_n, LMIC_sflt162f, LMIC_sflt162f_n },
+    { "sflt12", 7, 1, LMIC_f2sflt12, LMIC_f2sflt12_n, LMIC_sflt122f, LMIC_sflt122f_n },
+    { "uflt16", 12, 0, LMIC_f2uflt16, LMIC_f2uflt16_n, LMIC_uflt162f, LMIC_uflt162f_n },
+    { "uflt12", 8, 0, LMIC_f2uflt12, LMIC_f2uflt12_n, LMIC_uflt122f, LMIC_uflt122f_n },
+};
+
+static volatile uint16_t sink;
+
+static float bitsToFloat(uint32_t bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The array encoder must match the scalar encoder bit for bit
+// for all finite inputs that are not subnormal.
+static int testEncoderMatch(const struct Format* format)
+{
+    int failures = 0;
+    uint32_t checked = 0;
+
+    for (uint64_t bits = 0; bits <= UINT32_MAX; bits += SWEEP_STRIDE)
+    {
+        float f = bitsToFloat((uint32_t)bits);
+        if (isnan(f) || (f != 0 && !isnormal(f)))
+            continue;
+
+        uint16_t expected = format->encode(f);
+        uint16_t actual;
+        format->encodeArray(&actual, &f, 1);
+        checked++;
+        if (actual != expected)
+        {
+            if (failures < 10)
+                printf("  %s: %a encoded as 0x%04x instead of 0x%04x\n", format->name, f, actual, expected);
+            failures++;
+        }
+    }
+
+    printf("%s: array encoder vs. scalar encoder: %u values, %d mismatches\n", format->name, checked, failures);
+    return failures;
+}
+
+// The array decoder must match the scalar decoder, and each decoded value must
+// be within 2^-fractionBits (relative) of the encoded input. Values below 2^-15
+// and saturated values are out of range of the formats and are skipped.
+static int testRoundTrip(const struct Format* format)
+{
+    int failures = 0;
+    uint32_t checked = 0;
+    double maxError = 0;
+    const double smallest = ldexp(1.0, -15);
+
+    for (uint64_t bits = 0; bits <= UINT32_MAX; bits += SWEEP_STRIDE)
+    {
+        float f = bitsToFloat((uint32_t)bits);
+        double magnitude = fabs(f);
+        if (isnan(f) || magnitude < smallest || magnitude >= 1.0 || (!format->isSigned && f < 0))
+            continue;
+
+        uint16_t encoded;
+        format->encodeArray(&encoded, &f, 1);
+        float decoded = format->decode(encoded);
+        float decodedArray;
+        format->decodeArray(&decodedArray, &encoded, 1);
+        checked++;
+
+        double error = fabs((double)decoded - f) / magnitude;
+        if (error > maxError)
+            maxError = error;
+        if (error > ldexp(1.0, -(int)format->fractionBits) || memcmp(&decoded, &decodedArray, sizeof(float)) != 0)
+        {
+            if (failures < 10)
+                printf("  %s: %a decoded as %a (array: %a)\n", format->name, f, decoded, decodedArray);
+            failures++;
+        }
+    }
+
+    printf("%s: round trip: %u values, max. relative error %.3g (limit %.3g), %d failures\n",
+        format->name, checked, maxError, ldexp(1.0, -(int)format->fractionBits), failures);
+    return failures;
+}
+
+static void benchmark(const struct Format* format)
+{
+    static float values[BENCH_VALUES];
+    static uint16_t encoded[BENCH_VALUES];
+    static float decoded[BENCH_VALUES];
+
+    srand(1);
+    for (int i = 0; i < BENCH_VALUES; i++)
+        values[i] = (float)rand() / RAND_MAX * (format->isSigned ? 2.0f : 1.0f) - (format->isSigned ? 1.0f : 0.0f);
+
+    double start = now();
+    for (int run = 0; run < BENCH_RUNS; run++)
+        for (int i = 0; i < BENCH_VALUES; i++)
+            sink = format->encode(values[i]);
+    double scalarEncode = now() - start;
+
+    start = now();
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        format->encodeArray(encoded, values, BENCH_VALUES);
+        sink = encoded[run % BENCH_VALUES];
+    }
+    double arrayEncode = now() - start;
+
+    start = now();
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        format->decodeArray(decoded, encoded, BENCH_VALUES);
+        sink = (uint16_t)decoded[run % BENCH_VALUES];
+    }
+    double arrayDecode = now() - start;
+
+    double n = (double)BENCH_VALUES * BENCH_RUNS;
+    printf("%s: scalar encoder %.2f ns/value, array encoder %.2f ns/value, array decoder %.2f ns/value\n",
+        format->name, scalarEncode / n * 1e9, arrayEncode / n * 1e9, arrayDecode / n * 1e9);
+}
+
+int main()
+{
+    int failures = 0;
+    size_t numFormats = sizeof(formats) / sizeof(formats[0]);
+
+    for (size_t i = 0; i < numFormats; i++)
+    {
+        failures += testEncoderMatch(&formats[i]);
+        failures += testRoundTrip(&formats[i]);
+    }
+
+    for (size_t i = 0; i < numFormats; i++)
+        benchmark(&formats[i]);
+
+    printf(failures == 0 ? "PASSED\n" : "FAILED\n");
+    return failures == 0 ? 0 : 1;
+}
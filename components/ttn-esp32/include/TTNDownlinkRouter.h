@@ -0,0 +1,142 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Dispatching of received messages by port.
+ *******************************************************************************/
+
+#ifndef _TTNDOWNLINKROUTER_H_
+#define _TTNDOWNLINKROUTER_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "TheThingsNetwork.h"
+
+/**
+ * @brief Maximum number of handlers of a router
+ */
+#define TTN_MAX_PORT_HANDLERS 16
+
+/**
+ * @brief Handler for messages received on a port
+ *
+ * The downlink is released by the router when the handler returns.
+ *
+ * @param downlink  received message
+ * @param context   value passed to 'addHandler'
+ */
+typedef void (*TTNPortHandler)(const TTNDownlink* downlink, void* context);
+
+/**
+ * @brief Dispatches received messages to handlers registered per port
+ *
+ * Handlers are registered for a single port or a range of ports, each with its own
+ * context pointer, so separate modules can own separate ports. A table indexed by the
+ * port selects the handler in constant time.
+ *
+ * Received messages are queued by the router. The handlers run in the router's own task
+ * (see 'start') or in the application task calling 'dispatch', never in the LMIC
+ * background task or within 'transmitMessage'.
+ *
+ * Only one router can be connected to a 'TheThingsNetwork' instance.
+ */
+class TTNDownlinkRouter
+{
+public:
+    /**
+     * @brief Construct a new router
+     *
+     * @param queueSize  number of received messages that can wait for dispatching
+     */
+    TTNDownlinkRouter(uint8_t queueSize = 4);
+
+    /**
+     * @brief Destroy the router
+     */
+    ~TTNDownlinkRouter();
+
+    /**
+     * @brief Register a handler for a single port
+     *
+     * @param port     port (1 to 223)
+     * @param handler  handler function
+     * @param context  value passed to the handler
+     * @return true    if the handler has been registered
+     * @return false   if the port is invalid or already assigned, or if the maximum number of handlers has been reached
+     */
+    bool addHandler(port_t port, TTNPortHandler handler, void* context = nullptr);
+
+    /**
+     * @brief Register a handler for a range of ports
+     *
+     * The range must not overlap the ports of the handlers registered before.
+     *
+     * @param firstPort  first port of the range (1 to 223)
+     * @param lastPort   last port of the range (inclusive, 1 to 223)
+     * @param handler    handler function
+     * @param context    value passed to the handler
+     * @return true      if the handler has been registered
+     * @return false     if the range is invalid or overlaps the ports of another handler,
+     *                   or if the maximum number of handlers has been reached
+     */
+    bool addHandler(port_t firstPort, port_t lastPort, TTNPortHandler handler, void* context = nullptr);
+
+    /**
+     * @brief Connect the router to the device and start a task running the handlers
+     *
+     * @param ttn        device whose received messages are dispatched
+     * @param priority   priority of the task
+     * @param stackSize  stack size of the task, in bytes
+     * @param core       core the task is pinned to (or tskNO_AFFINITY)
+     */
+    void start(TheThingsNetwork& ttn, UBaseType_t priority = 5, uint32_t stackSize = 4096, BaseType_t core = tskNO_AFFINITY);
+
+    /**
+     * @brief Connect the router to the device without starting a task
+     *
+     * The application must call 'dispatch' repeatedly in the task that should run the handlers.
+     *
+     * @param ttn  device whose received messages are dispatched
+     */
+    void connect(TheThingsNetwork& ttn);
+
+    /**
+     * @brief Wait for the next received message and pass it to its handler
+     *
+     * @param ticksToWait  maximum time to wait
+     * @return true        if a message has been dispatched
+     * @return false       if no message has been received within the specified time
+     */
+    bool dispatch(TickType_t ticksToWait = portMAX_DELAY);
+
+    /**
+     * @brief Get the number of messages dropped because the queue was full or no handler was registered
+     *
+     * @return number of dropped messages
+     */
+    uint32_t droppedCount();
+
+private:
+    struct Handler
+    {
+        TTNPortHandler handler;
+        void* context;
+    };
+
+    static void downlinkReceived(TTNDownlink* downlink, void* userData);
+    static void dispatchTask(void* param);
+
+    QueueHandle_t queue;
+    uint8_t portTable[256]; // index + 1 into 'handlers', 0 if no handler
+    Handler handlers[TTN_MAX_PORT_HANDLERS];
+    uint8_t numHandlers;
+    uint32_t numDropped;
+};
+
+#endif
@@ -0,0 +1,114 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Reassembly of fragmented uplinks (see 'sendFragmented').
+ *******************************************************************************/
+
+#ifndef _TTNFRAGMENTREASSEMBLER_H_
+#define _TTNFRAGMENTREASSEMBLER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * @brief Size of the header of each fragment
+ *
+ * Each fragment starts with the transfer ID, the fragment index and the
+ * number of fragments of the transfer (one byte each), followed by the data.
+ */
+#define TTN_FRAGMENT_HEADER_SIZE 3
+
+/**
+ * @brief Maximum number of fragments of a transfer
+ */
+#define TTN_MAX_FRAGMENTS 255
+
+/**
+ * @brief Reassembles a buffer sent with 'TheThingsNetwork::sendFragmented'
+ *
+ * The class only uses the C++ standard library. It is intended for the
+ * receiving side (e.g. an application server), but can also be used on
+ * the device to test the protocol.
+ *
+ * The receiving side requests missing fragments with a downlink on the port of
+ * the transfer. The downlink consists of the transfer ID followed by a bitmap
+ * with a bit set for each missing fragment (bit 0 of the first byte for
+ * fragment 0). A downlink without set bits acknowledges the transfer.
+ * 'buildResendRequest' creates this downlink.
+ */
+class TTNFragmentReassembler
+{
+public:
+    /**
+     * @brief Construct a new reassembler
+     */
+    TTNFragmentReassembler();
+
+    /**
+     * @brief Add a received fragment
+     *
+     * A fragment with a different transfer ID starts a new transfer, discarding the
+     * fragments received so far.
+     *
+     * @param frame   payload of the uplink (incl. fragment header)
+     * @param length  length of the payload
+     * @return true   if the transfer is complete
+     * @return false  if fragments are still missing or the frame is not a valid fragment
+     */
+    bool addFragment(const uint8_t* frame, size_t length);
+
+    /**
+     * @brief Check if all fragments of the current transfer have been received
+     *
+     * @return true   if the transfer is complete
+     * @return false  if fragments are missing or no transfer has started
+     */
+    bool isComplete() const;
+
+    /**
+     * @brief Get the ID of the current transfer
+     *
+     * @return transfer ID
+     */
+    uint8_t transferId() const;
+
+    /**
+     * @brief Create the downlink requesting the missing fragments
+     *
+     * If the transfer is complete, the downlink acknowledges the transfer.
+     *
+     * @param request    buffer receiving the downlink payload
+     * @param maxLength  size of the buffer (33 bytes are sufficient for all transfers)
+     * @return length of the downlink payload (0 if no transfer has started or the buffer is too small)
+     */
+    size_t buildResendRequest(uint8_t* request, size_t maxLength) const;
+
+    /**
+     * @brief Get the reassembled data
+     *
+     * @return data (empty if the transfer is not complete)
+     */
+    std::vector<uint8_t> data() const;
+
+    /**
+     * @brief Discard the current transfer
+     */
+    void reset();
+
+private:
+    bool active;
+    uint8_t id;
+    uint8_t numFragments;
+    size_t numReceived;
+    std::vector<std::vector<uint8_t>> fragments;
+    std::vector<bool> received;
+};
+
+#endif
@@ -24,17 +24,32 @@
 
 typedef uint8_t port_t;
 
+/**
+ * @brief Maximum size of the application payload of a message
+ */
+#define TTN_MAX_PAYLOAD_SIZE 243
+
 /**
  * @brief Response codes
  */
 enum TTNResponseCode
 {
   kTTNErrorTransmissionFailed = -1,
+  kTTNErrorPayloadTooLarge = -2,
   kTTNErrorUnexpected = -10,
   kTTNSuccessfulTransmission = 1,
   kTTNSuccessfulReceive = 2
 };
 
+/**
+ * @brief Priority of queued messages
+ */
+enum TTNPriority
+{
+  kTTNPriorityNormal = 0,
+  kTTNPriorityAlarm = 1
+};
+
 /**
  * @brief Callback for recieved messages
  * 
@@ -44,6 +59,472 @@ enum TTNResponseCode
  */
 typedef void (*TTNMessageCallback)(const uint8_t* payload, size_t length, port_t port);
 
+/**
+ * @brief Received message in a buffer of the downlink pool
+ * 
+ * The buffer is owned by the receiver of the 'TTNDownlinkCallback'. It can be
+ * passed to other tasks and must eventually be returned to the pool by calling
+ * 'release()'. The pool size is configured with 'make menuconfig'.
+ */
+struct TTNDownlink
+{
+    port_t port;
+    uint8_t length;
+    uint8_t payload[TTN_MAX_PAYLOAD_SIZE];
+
+    /**
+     * @brief Return the buffer to the pool
+     * 
+     * The downlink must not be accessed afterwards.
+     */
+    void release();
+};
+
+/**
+ * @brief Callback for received messages in pooled buffers
+ * 
+ * @param downlink  received message; ownership passes to the callback
+ * @param userData  value passed to 'onDownlink'
+ */
+typedef void (*TTNDownlinkCallback)(TTNDownlink* downlink, void* userData);
+
+/**
+ * @brief Callback for completed transmissions of queued messages
+ * 
+ * Called in the LMIC background task when the transmission of a message added with
+ * 'enqueueMessage' has completed, including the subsequent receive windows. It must
+ * return quickly. It may queue further messages.
+ * 
+ * @param result    kTTNSuccessfulTransmission or kTTNErrorTransmissionFailed
+ * @param userData  value passed to 'enqueueMessage'
+ */
+typedef void (*TTNTransmitCallback)(TTNResponseCode result, void* userData);
+
+/**
+ * @brief Provider of the next message (see 'setFrameProvider')
+ * 
+ * Called in the LMIC background task when the transmit queue is empty and the previous
+ * transmission has completed, including its receive windows. It must return quickly.
+ * 
+ * @param payload    buffer receiving the bytes to be transmitted
+ * @param maxLength  size of the buffer (maximum payload at the current data rate)
+ * @param port       receives the port (initialized with 1)
+ * @param confirm    receives the flag indicating if a confirmation should be requested (initialized with 'false')
+ * @param userData   value passed to 'setFrameProvider'
+ * @return number of bytes to be transmitted, or 0 if there is no further message
+ */
+typedef size_t (*TTNFrameProvider)(uint8_t* payload, size_t maxLength, port_t* port, bool* confirm, void* userData);
+
+/**
+ * @brief Callback for LMIC events
+ * 
+ * Called in the LMIC background task for every LMIC event, e.g. for diagnostics.
+ * It must return quickly and must not call any 'TheThingsNetwork' functions.
+ * 
+ * @param event     LMIC event ('ev_t' value, e.g. EV_JOINED or EV_TXCOMPLETE)
+ * @param userData  value passed to 'onEvent'
+ */
+typedef void (*TTNEventCallback)(int event, void* userData);
+
+/**
+ * @brief Callback for fatal LMIC errors
+ * 
+ * Called when an assertion in the LMIC stack fails, just before LMIC stops.
+ * 
+ * @param file  source file of the failed assertion
+ * @param line  source line of the failed assertion
+ */
+typedef void (*TTNFatalErrorCallback)(const char* file, uint16_t line);
+
+/**
+ * @brief Retry policy for confirmed messages (see 'sendConfirmed')
+ */
+struct TTNRetryPolicy
+{
+    /** @brief Maximum number of transmissions (incl. the first one) */
+    uint8_t maxAttempts = 4;
+    /** @brief Delay before the first retry, in ms */
+    uint32_t initialBackoff = 10000;
+    /** @brief Maximum delay between retries, in ms */
+    uint32_t maxBackoff = 600000;
+    /** @brief Factor the delay is multiplied with after each retry */
+    uint8_t backoffMultiplier = 2;
+    /** @brief Flag indicating if the data rate is lowered by one step after every second failed attempt (ignored if ADR is enabled) */
+    bool dataRateFallback = true;
+    /** @brief Maximum time on air of all attempts together, in ms (0 for no limit) */
+    uint32_t airtimeBudget = 0;
+};
+
+/**
+ * @brief Outcome of a confirmed message sent with 'sendConfirmed'
+ */
+struct TTNRetryResult
+{
+    /** @brief kTTNSuccessfulTransmission if the message has been acknowledged, kTTNErrorTransmissionFailed otherwise */
+    TTNResponseCode result;
+    /** @brief Number of transmissions */
+    uint8_t attempts;
+    /** @brief Time on air of all transmissions, in ms */
+    uint32_t airtime;
+    /** @brief Data rate used by the last transmission */
+    uint8_t dataRate;
+    /** @brief Flag indicating that the retries were stopped as the airtime budget would have been exceeded */
+    bool budgetExhausted;
+};
+
+/**
+ * @brief Callback for the outcome of a confirmed message sent with 'sendConfirmed'
+ * 
+ * Called in the LMIC background task. It must return quickly.
+ * 
+ * @param result    outcome of the message
+ * @param userData  value passed to 'sendConfirmed'
+ */
+typedef void (*TTNRetryCallback)(const TTNRetryResult* result, void* userData);
+
+/**
+ * @brief Reaction to further downlinks pending in the network (see 'setDownlinkDrain')
+ */
+enum TTNDrainMode
+{
+  kTTNDrainOff = 0,
+  kTTNDrainPoll = 1,
+  kTTNDrainPiggyback = 2
+};
+
+/**
+ * @brief Policy for fetching downlinks pending in the network (see 'setDownlinkDrain')
+ */
+struct TTNDrainPolicy
+{
+    /**
+     * @brief Mode
+     * 
+     * kTTNDrainOff: pending downlinks are received with the application's regular uplinks.
+     * kTTNDrainPoll: an empty uplink is sent as soon as the duty cycle allows.
+     * kTTNDrainPiggyback: an empty uplink is only sent if no application message
+     * has been queued within 'piggybackDelay'.
+     */
+    TTNDrainMode mode = kTTNDrainPoll;
+    /** @brief Time to wait for an application message to carry the request, in ms (kTTNDrainPiggyback only) */
+    uint32_t piggybackDelay = 10000;
+    /** @brief Maximum time on air of the empty uplinks until all pending downlinks have been received, in ms (0 for no limit) */
+    uint32_t airtimeBudget = 0;
+};
+
+/**
+ * @brief Maximum number of duty-cycle bands of a region
+ */
+#define TTN_MAX_BANDS 4
+
+/**
+ * @brief Availability and duty-cycle budget of a band
+ */
+struct TTNBandAvailability
+{
+    /** @brief Band index (EU868: 0 = 0.1%, 1 = 1%, 2 = 10%) */
+    uint8_t band;
+    /** @brief Time until the band can be used for the next transmission, in ms (0 if now) */
+    uint32_t waitTime;
+    /** @brief Airtime per hour allowed by the duty cycle, in ms (UINT32_MAX if unlimited) */
+    uint32_t budgetPerHour;
+    /** @brief Airtime not yet used within the last hour, in ms (UINT32_MAX if unlimited) */
+    uint32_t remainingBudget;
+};
+
+/**
+ * @brief Number of data rates with separate statistics
+ */
+#define TTN_STATS_DATA_RATES 16
+
+/**
+ * @brief Number of channels with separate statistics
+ */
+#define TTN_STATS_CHANNELS 72
+
+/**
+ * @brief Number of buckets of the RSSI and SNR histograms
+ */
+#define TTN_STATS_HISTOGRAM_BUCKETS 8
+
+/**
+ * @brief Number of recently received frames covered by the RSSI and SNR histograms
+ */
+#define TTN_STATS_WINDOW 32
+
+/**
+ * @brief Link quality and traffic statistics
+ * 
+ * Transmissions are counted per attempt: a confirmed message retransmitted
+ * three times counts as three attempts.
+ */
+struct TTNStatistics
+{
+    /** @brief Successful transmission attempts per data rate */
+    uint32_t txSuccess[TTN_STATS_DATA_RATES];
+    /** @brief Failed transmission attempts (missing ack or join accept) per data rate */
+    uint32_t txFailure[TTN_STATS_DATA_RATES];
+    /** @brief Successful transmission attempts per channel */
+    uint32_t channelSuccess[TTN_STATS_CHANNELS];
+    /** @brief Failed transmission attempts per channel */
+    uint32_t channelFailure[TTN_STATS_CHANNELS];
+    /** @brief Cumulative time on air of all transmissions (incl. join requests), in ms */
+    uint32_t airtime;
+    /** @brief Number of received frames (incl. join accepts and empty acks) */
+    uint32_t rxCount;
+    /** @brief Frame counter of the last uplink */
+    uint32_t lastUplinkCounter;
+    /** @brief Frame counter of the last downlink */
+    uint32_t lastDownlinkCounter;
+    /** @brief RSSI of the last received frame, in dBm */
+    int16_t lastRssi;
+    /** @brief SNR of the last received frame, in dB */
+    int8_t lastSnr;
+    /** @brief Data rate of the last transmission */
+    uint8_t lastDataRate;
+    /** @brief Channel of the last transmission */
+    uint8_t lastChannel;
+    /**
+     * @brief RSSI of the recently received frames
+     * 
+     * Bucket i counts frames from -130 + 10 * i dBm (incl.) to -120 + 10 * i dBm (excl.).
+     * The first and the last bucket are open-ended.
+     */
+    uint16_t rssiHistogram[TTN_STATS_HISTOGRAM_BUCKETS];
+    /**
+     * @brief SNR of the recently received frames
+     * 
+     * Bucket i counts frames from -20 + 4 * i dB (incl.) to -16 + 4 * i dB (excl.).
+     * The first and the last bucket are open-ended.
+     */
+    uint16_t snrHistogram[TTN_STATS_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * @brief Stages of an uplink (see 'getLatencyHistogram')
+ */
+enum TTNLatencyStage
+{
+  /** @brief From queuing to the submission to LMIC (lock and queue wait) */
+  kTTNStageQueue = 0,
+  /** @brief From the submission to LMIC to the start of the transmission (frame building, encryption, duty cycle wait) */
+  kTTNStageSchedule = 1,
+  /** @brief From the start to the end of the transmission (time on air) */
+  kTTNStageAirtime = 2,
+  /** @brief From the end of the transmission to the close of the last receive window */
+  kTTNStageReceive = 3,
+  /** @brief From the close of the last receive window to the completion callback */
+  kTTNStageDispatch = 4,
+  /** @brief From queuing to the completion callback */
+  kTTNStageTotal = 5
+};
+
+/**
+ * @brief Number of uplink stages
+ */
+#define TTN_LATENCY_STAGES 6
+
+/**
+ * @brief Number of buckets of the latency histograms
+ */
+#define TTN_LATENCY_HISTOGRAM_BUCKETS 16
+
+/**
+ * @brief Timestamps of an uplink from queuing to completion (see 'getLastUplinkTrace')
+ * 
+ * All timestamps are esp_timer times, in µs. Stages that did not occur (e.g. RX2 after a
+ * downlink received in RX1) are 0. For a retransmitted confirmed message, the timestamps
+ * from 'txStart' on refer to the last transmission.
+ */
+struct TTNUplinkTrace
+{
+    /** @brief Message was queued (e.g. 'transmitMessage' or 'enqueueMessage' was called) */
+    int64_t queued;
+    /** @brief Message was submitted to LMIC */
+    int64_t submitted;
+    /** @brief Frame was handed to the radio */
+    int64_t txStart;
+    /** @brief Transmission ended (TX done interrupt) */
+    int64_t txDone;
+    /** @brief RX1 window was opened */
+    int64_t rx1Open;
+    /** @brief RX1 window was closed (reception or timeout interrupt) */
+    int64_t rx1Close;
+    /** @brief RX2 window was opened */
+    int64_t rx2Open;
+    /** @brief RX2 window was closed (reception or timeout interrupt) */
+    int64_t rx2Close;
+    /** @brief Completion callback was called */
+    int64_t completed;
+    /** @brief Number of transmissions */
+    uint8_t transmissions;
+    /** @brief Flag indicating if the transmission was successful */
+    bool success;
+};
+
+/**
+ * @brief Distribution of the duration of an uplink stage (see 'getLatencyHistogram')
+ */
+struct TTNLatencyHistogram
+{
+    /** @brief Number of uplinks */
+    uint32_t count;
+    /** @brief Shortest duration, in µs */
+    uint32_t min;
+    /** @brief Longest duration, in µs */
+    uint32_t max;
+    /** @brief Sum of all durations, in µs */
+    uint64_t total;
+    /**
+     * @brief Number of uplinks per duration
+     * 
+     * Bucket 0 counts durations below 1 ms, bucket i (i > 0) durations from 2^(i-1) ms (incl.)
+     * to 2^i ms (excl.). The last bucket is open-ended.
+     */
+    uint32_t buckets[TTN_LATENCY_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * @brief Number of TX power levels with separate time and current (0 to 20 dBm)
+ */
+#define TTN_ENERGY_TX_POWER_LEVELS 21
+
+/**
+ * @brief Current consumption model for the energy estimation (see 'setCurrentModel')
+ * 
+ * The defaults are typical values of an SX1276 using PA_BOOST and of an ESP32
+ * running at 160 MHz. For meaningful estimates, measure them on the actual board.
+ */
+struct TTNCurrentModel
+{
+    /** @brief Radio current in sleep mode, in µA */
+    uint32_t radioSleep = 1;
+    /** @brief Radio current in standby mode, in µA */
+    uint32_t radioStandby = 1600;
+    /** @brief Radio current while the synthesizer is running (FSTX and FSRX mode), in µA */
+    uint32_t radioSynthesizer = 5800;
+    /** @brief Radio current while receiving (RX and CAD mode), in µA */
+    uint32_t radioRx = 11500;
+    /** @brief Radio current while transmitting at 0 to 20 dBm, in µA */
+    uint32_t radioTx[TTN_ENERGY_TX_POWER_LEVELS] = {
+        22000, 23000, 24000, 25000, 26000, 27000, 28000, 30000, 32000, 34000, 36000,
+        39000, 42000, 46000, 50000, 58000, 68000, 87000, 95000, 105000, 120000
+    };
+    /** @brief Additional current while the LMIC background task is busy, in µA */
+    uint32_t cpuActive = 30000;
+    /** @brief Current of the remaining device, drawn all the time, in µA */
+    uint32_t baseline = 0;
+};
+
+/**
+ * @brief Estimated energy consumption (see 'getEnergyStats')
+ * 
+ * Times and charges are counted since the LMIC background task was started (in
+ * 'configurePins') or since 'resetEnergyStats'. Charges are given in nAh (1000 nAh = 1 µAh).
+ */
+struct TTNEnergyStats
+{
+    /** @brief Time covered by the statistics, in ms */
+    uint32_t elapsed;
+    /** @brief Time the radio was in sleep mode, in ms */
+    uint32_t radioSleepTime;
+    /** @brief Time the radio was in standby mode, in ms */
+    uint32_t radioStandbyTime;
+    /** @brief Time the radio synthesizer was running (FSTX and FSRX mode), in ms */
+    uint32_t radioSynthesizerTime;
+    /** @brief Time the radio was receiving (RX and CAD mode), in ms */
+    uint32_t radioRxTime;
+    /** @brief Time the radio was transmitting at 0 to 20 dBm, in ms */
+    uint32_t radioTxTime[TTN_ENERGY_TX_POWER_LEVELS];
+    /** @brief Time the LMIC background task was busy (not waiting for events or the lock), in ms */
+    uint32_t cpuActiveTime;
+    /** @brief Estimated charge drawn by the radio, in nAh */
+    uint64_t radioCharge;
+    /** @brief Estimated charge in total (radio, CPU and baseline), in nAh */
+    uint64_t totalCharge;
+    /** @brief Estimated average charge per hour, in nAh */
+    uint32_t chargePerHour;
+    /** @brief Number of completed uplinks */
+    uint32_t messages;
+    /** @brief Estimated charge drawn by the radio and the CPU for the last uplink, in nAh */
+    uint32_t lastMessageCharge;
+    /** @brief Estimated average charge drawn by the radio and the CPU per uplink, in nAh */
+    uint32_t averageMessageCharge;
+};
+
+/**
+ * @brief Seconds from the Unix epoch (1970-01-01) to the GPS epoch (1980-01-06)
+ */
+#define TTN_GPS_EPOCH_OFFSET 315964800
+
+/**
+ * @brief Leap seconds between GPS time and UTC (since 2017-01-01)
+ */
+#define TTN_GPS_LEAP_SECONDS 18
+
+/**
+ * @brief Network time (see 'getNetworkTime')
+ */
+struct TTNNetworkTime
+{
+    /** @brief GPS time, in µs since the GPS epoch (1980-01-06 00:00:00 UTC) */
+    uint64_t gpsTime;
+    /** @brief UTC time, in µs since the Unix epoch (assuming TTN_GPS_LEAP_SECONDS) */
+    uint64_t utcTime;
+    /** @brief Maximum error of the time, in µs */
+    uint32_t errorBound;
+    /** @brief Time since the last synchronization, in s */
+    uint32_t age;
+    /** @brief Estimated drift of the local clock, in ppb (positive if it is slow; 0 if not yet estimated) */
+    int32_t drift;
+    /** @brief Number of synchronizations since startup */
+    uint16_t syncCount;
+};
+
+/**
+ * @brief Class B beacon events (see 'onBeacon')
+ */
+enum TTNBeaconEvent
+{
+  kTTNBeaconFound = 0,
+  kTTNBeaconNotFound = 1,
+  kTTNBeaconTracked = 2,
+  kTTNBeaconMissed = 3,
+  kTTNBeaconLost = 4
+};
+
+/**
+ * @brief Information about the last beacon
+ */
+struct TTNBeaconInfo
+{
+    /** @brief GPS time of the beacon, in s (extrapolated if the beacon was missed) */
+    uint32_t gpsTime;
+    /** @brief RSSI of the last received beacon, in dBm */
+    int16_t rssi;
+    /** @brief SNR of the last received beacon, in dB */
+    int8_t snr;
+    /** @brief Number of consecutively missed beacons */
+    uint8_t missedBeacons;
+};
+
+/**
+ * @brief Callback for Class B beacon events
+ * 
+ * Called in the LMIC background task when the beacon has been found
+ * ('kTTNBeaconFound') or not found within a beacon period ('kTTNBeaconNotFound'),
+ * and for each expected beacon that has been received ('kTTNBeaconTracked') or
+ * missed ('kTTNBeaconMissed'). After too many missed beacons, the device returns
+ * to Class A ('kTTNBeaconLost'). The same applies if the beacon is not found.
+ * 
+ * It must return quickly and must not call any 'TheThingsNetwork' functions.
+ * 
+ * @param event     beacon event
+ * @param info      information about the last beacon
+ * @param userData  value passed to 'onBeacon'
+ */
+typedef void (*TTNBeaconCallback)(TTNBeaconEvent event, const TTNBeaconInfo* info, void* userData);
+
 /**
  * @brief TTN device
  * 
@@ -152,7 +633,9 @@ public:
      * The app EUI, app key and dev EUI must already have been provisioned by a call to 'provision()'.
      * Before this function is called, 'nvs_flash_init' must have been called once.
      * 
-     * The function blocks until the activation has completed or failed.
+     * The function blocks until the activation has completed or failed. It fails once
+     * a join request has been sent on all channels and data rates without an answer;
+     * LMIC then stops joining, so the caller decides when to try again.
      * 
      * @return true   if the activation was succeful
      * @return false  if the activation failed
@@ -164,7 +647,7 @@ public:
      * 
      * The device EUI, app EUI and app key are NOT saved in non-volatile memory.
      * 
-     * The function blocks until the activation has completed or failed.
+     * The function blocks until the activation has completed or failed (see 'join()').
      * 
      * @param devEui  Device EUI (16 character string with hexadecimal data)
      * @param appEui  Application EUI of the device (16 character string with hexadecimal data)
@@ -174,12 +657,72 @@ public:
      */
     bool join(const char *devEui, const char *appEui, const char *appKey);
 
+    /**
+     * @brief Resume a previously saved session instead of joining
+     *
+     * The session (device address, session keys, frame counters, channels, data rate and
+     * the duty-cycle ledger) is restored from RTC memory if the device wakes up from deep
+     * sleep or has been restarted by software. Otherwise, the copy saved in NVS by
+     * 'saveSession(true)' is used. A session is only resumed if it belongs to the
+     * provisioned device EUI.
+     *
+     * If the function succeeds, messages can be transmitted right away. If it fails,
+     * call 'join()'.
+     *
+     * The device must have been provisioned (see 'provision()'). Before this function is
+     * called, 'nvs_flash_init' must have been called once.
+     *
+     * @return true   if a session has been resumed
+     * @return false  if no valid session has been saved
+     */
+    bool resumeSession();
+
+    /**
+     * @brief Save the active session
+     *
+     * The session is saved in RTC memory after each join and at the start and end of each
+     * transmission anyway. So it is not necessary to call this function before entering deep sleep.
+     *
+     * With 'persistent' set to true, the session is also written to NVS so it survives a
+     * power loss. It is sufficient to do this once after the join as the frame counters
+     * are kept up to date separately (see 'getFrameCounterStats').
+     *
+     * @param persistent  flag indicating if the session should be written to NVS
+     * @return true   if the session has been saved
+     * @return false  if there is no active session or NVS could not be written
+     */
+    bool saveSession(bool persistent = false);
+
+    /**
+     * @brief Discard the saved session so that the next start requires a join
+     */
+    void clearSession();
+
+    /**
+     * @brief Get statistics about writing the frame counters to NVS
+     *
+     * The uplink frame counter is written to NVS each time it has advanced by the
+     * interval configured with 'make menuconfig'. If a session is resumed from NVS
+     * (e.g. after a power loss), the uplink counter is advanced by the interval so that
+     * the network does not reject the uplinks as replays.
+     *
+     * The writes happen in the LMIC background task after the receive windows.
+     *
+     * @param writes        receives the number of writes since the start
+     * @param maxWriteTime  receives the longest time a write took, in microseconds
+     */
+    void getFrameCounterStats(uint32_t* writes, uint32_t* maxWriteTime);
+
     /**
      * @brief Transmit a message
      * 
      * The function blocks until the message could be transmitted and a message has been received
      * in the subsequent receive window (or the window expires). Additionally, the function will
-     * first wait until the duty cycle allows a transmission (enforcing the duty cycle limits).
+     * first wait until the duty cycle allows a transmission (enforcing the duty cycle limits)
+     * and until the messages queued before it have been transmitted.
+     * 
+     * Only one task at a time can wait in this function. Use 'enqueueMessage' to transmit
+     * messages from several tasks or without blocking.
      * 
      * @param payload  bytes to be transmitted
      * @param length   number of bytes to be transmitted
@@ -191,6 +734,446 @@ public:
      */
     TTNResponseCode transmitMessage(const uint8_t *payload, size_t length, port_t port = 1, bool confirm = false);
 
+    /**
+     * @brief Queue a message for transmission without waiting for it
+     * 
+     * The message is copied into the transmit queue and the function returns immediately.
+     * The LMIC background task transmits the queued messages one after the other, as soon
+     * as the duty cycle allows. When a transmission has completed, 'callback' is called
+     * in the LMIC background task.
+     * 
+     * Messages received in the receive windows of queued messages are passed to the
+     * 'onMessage' callback in the LMIC background task.
+     * 
+     * The queue size is configured with 'make menuconfig'.
+     * 
+     * Messages with priority 'kTTNPriorityAlarm' are queued ahead of all normal messages.
+     * If the queue is full, the most recently queued normal message is dropped (and its
+     * callback is called with 'kTTNErrorTransmissionFailed'). If a normal message has been
+     * handed to LMIC but is still waiting for the duty cycle, it is put back into the queue
+     * and the alarm takes the next transmission opportunity. A message that is on air or
+     * waiting for its receive windows is never interrupted. So the latency of an alarm is
+     * bounded by the remaining time of the current transmission (including the receive
+     * windows and retransmissions of confirmed messages) plus the duty cycle wait.
+     * See 'getAlarmLatency'.
+     * 
+     * @param payload   bytes to be transmitted
+     * @param length    number of bytes to be transmitted
+     * @param port      port (default to 1)
+     * @param confirm   flag indicating if a confirmation should be requested. Default to 'false'
+     * @param callback  function called when the transmission has completed (or nullptr)
+     * @param userData  value passed to the callback
+     * @param priority  message priority. Default to 'kTTNPriorityNormal'
+     * @return true     if the message has been queued
+     * @return false    if the queue is full or the message is too long
+     */
+    bool enqueueMessage(const uint8_t *payload, size_t length, port_t port = 1, bool confirm = false,
+        TTNTransmitCallback callback = nullptr, void* userData = nullptr, TTNPriority priority = kTTNPriorityNormal);
+
+    /**
+     * @brief Set the provider of the next message
+     * 
+     * Instead of queuing messages in advance, the provider is asked for the next message
+     * whenever the transmit queue is empty and the previous transmission has completed,
+     * including its receive windows. The message is built and submitted to LMIC right
+     * away, so a backlog (e.g. in a store-and-forward application) is transmitted as fast
+     * as the duty cycle allows, without a round trip through an application task.
+     * 
+     * Once the provider has returned 0, it is no longer asked until 'notifyFramesAvailable'
+     * is called. Messages added with 'enqueueMessage' take precedence.
+     * 
+     * @param provider  function providing the next message (nullptr to remove it)
+     * @param callback  function called when the transmission of a provided message has completed (or nullptr)
+     * @param userData  value passed to the provider and the callback
+     */
+    void setFrameProvider(TTNFrameProvider provider, TTNTransmitCallback callback = nullptr, void* userData = nullptr);
+
+    /**
+     * @brief Resume asking the frame provider for messages
+     * 
+     * Call it when new messages are available after the provider has returned 0.
+     */
+    void notifyFramesAvailable();
+
+    /**
+     * @brief Transmit a confirmed message with a retry policy
+     * 
+     * The attempts are retransmissions of the same frame with the same frame counter, so
+     * the network recognizes them as one message even if only the acknowledgement was lost.
+     * Unlike 'transmitMessage' with 'confirm' set to true, the delay before each
+     * retransmission is set by the policy: it starts after the receive windows of the
+     * previous attempt and grows with each attempt. It is extended if the duty cycle does
+     * not allow an earlier transmission. If enabled, the data rate is lowered by one step
+     * after every second attempt (as recommended by LoRaWAN 1.0.3). The lowered data rate
+     * applies to the whole device until the message has completed; then the previous data
+     * rate is restored. If ADR is enabled, the data rate is left to the network and not
+     * lowered. The retransmissions stop after the maximum number of attempts or when the
+     * next one would exceed the airtime budget.
+     * 
+     * While the message is being retransmitted, the other messages in the transmit queue
+     * wait.
+     * 
+     * The message is copied and the function returns immediately. The outcome is reported
+     * to 'callback'. The number of messages in progress is limited to the transmit queue
+     * size configured with 'make menuconfig'.
+     * 
+     * @param payload   bytes to be transmitted
+     * @param length    number of bytes to be transmitted
+     * @param port      port
+     * @param policy    retry policy
+     * @param callback  function called with the outcome (can be nullptr)
+     * @param userData  value passed to the callback
+     * @return true     if the message has been accepted
+     * @return false    if too many messages are in progress or the message is too long
+     */
+    bool sendConfirmed(const uint8_t *payload, size_t length, port_t port, const TTNRetryPolicy& policy,
+        TTNRetryCallback callback = nullptr, void* userData = nullptr);
+
+    /**
+     * @brief Transmit a buffer larger than a single message as a sequence of fragments
+     * 
+     * The buffer is split into fragments that fit the maximum payload of the current
+     * data rate. Each fragment carries a header with the transfer ID, the fragment index
+     * and the number of fragments. The fragments are queued one after the other (see
+     * 'enqueueMessage') as the previous one has been transmitted.
+     * 
+     * When all fragments have been transmitted, the transfer stays open for 'resendWindow'.
+     * In this time, the receiving side can request missing fragments with a downlink on
+     * the same port; only these fragments are transmitted again. See 'TTNFragmentReassembler'
+     * for the format and for reassembling the buffer. While a transfer is open, such
+     * downlinks are not passed to the message callbacks.
+     * 
+     * All fragments have the size determined at the start (the receiving side relies on
+     * it). If the data rate is lowered during the transfer (e.g. by ADR) and a fragment no
+     * longer fits, the transfer ends with 'kTTNErrorPayloadTooLarge'; it can be restarted
+     * with smaller fragments at the new data rate.
+     * 
+     * 'callback' is called in the LMIC background task when the transfer has been
+     * acknowledged, when the resend window has expired, or when a fragment could not be
+     * transmitted. The buffer must remain valid until then.
+     * 
+     * Only one transfer can be in progress at a time.
+     * 
+     * @param data          bytes to be transmitted
+     * @param length        number of bytes to be transmitted (up to 255 fragments)
+     * @param port          port used for the fragments and the resend requests
+     * @param resendWindow  time to wait for resend requests after the last fragment, in ms
+     * @param callback      function called when the transfer has ended (can be nullptr)
+     * @param userData      value passed to the callback
+     * @return true         if the transfer has been started
+     * @return false        if another transfer is in progress or the buffer is too large
+     */
+    bool sendFragmented(const uint8_t *data, size_t length, port_t port = 1, uint32_t resendWindow = 0,
+        TTNTransmitCallback callback = nullptr, void* userData = nullptr);
+
+    /**
+     * @brief Cancel the fragmented transfer in progress
+     * 
+     * The callback is called with 'kTTNErrorTransmissionFailed' in the calling task,
+     * before this function returns. A fragment already in the transmit queue is still
+     * transmitted.
+     */
+    void cancelFragmented();
+
+    /**
+     * @brief Get the measured latency of alarm messages
+     * 
+     * The latency is the time from 'enqueueMessage' to the start of the first transmission.
+     * 
+     * @param last  receives the latency of the most recent alarm, in ms
+     * @param max   receives the maximum latency since startup, in ms
+     */
+    void getAlarmLatency(uint32_t* last, uint32_t* max);
+
+    /**
+     * @brief Get the number of queued messages waiting for transmission
+     * 
+     * The message currently being transmitted is not included.
+     * 
+     * @return number of messages
+     */
+    size_t queuedMessageCount();
+
+    /**
+     * @brief Enable or disable coalescing of small messages for a port
+     * 
+     * Messages passed to 'coalesceMessage' for this port are collected and sent as a single
+     * uplink. The uplink is queued when the next message would exceed the maximum payload
+     * for the current data rate or when the oldest message has waited for 'maxDelay'
+     * milliseconds. Each message is encoded as a length byte followed by the message bytes.
+     * 
+     * The number of ports with coalescing is configured with 'make menuconfig'.
+     * 
+     * @param port      port (1 to 223)
+     * @param maxDelay  maximum time a message is held back, in ms (0 to disable coalescing)
+     * @return true     if coalescing has been configured
+     * @return false    if no coalescing buffer is left or the pending messages could not be queued
+     */
+    bool setCoalescing(port_t port, uint32_t maxDelay);
+
+    /**
+     * @brief Add a message to the coalesced uplink of a port
+     * 
+     * Coalescing must have been enabled for the port with 'setCoalescing'. The function does
+     * not block. Coalesced uplinks are sent unconfirmed and have no completion callback.
+     * 
+     * @param payload  bytes to be transmitted
+     * @param length   number of bytes to be transmitted
+     * @param port     port (default to 1)
+     * @return true    if the message has been added
+     * @return false   if coalescing is not enabled for the port or the transmit queue is full
+     */
+    bool coalesceMessage(const uint8_t *payload, size_t length, port_t port = 1);
+
+    /**
+     * @brief Queue all coalesced messages for transmission without waiting for the maximum delay
+     */
+    void flushCoalescedMessages();
+
+    /**
+     * @brief Get the time on air of an uplink message
+     * 
+     * Includes the frame header but no MAC commands.
+     * 
+     * @param length    payload length, in bytes
+     * @param dataRate  data rate (region-specific LoRaWAN data rate; -1 for the current data rate)
+     * @return time on air, in ms (0 if the data rate is not valid)
+     */
+    uint32_t getTimeOnAir(size_t length, int dataRate = -1);
+
+    /**
+     * @brief Get the time until the next uplink can be transmitted
+     * 
+     * This is the earliest time one of the enabled channels is not blocked by the duty cycle.
+     * Messages transmitted before that time are delayed.
+     * 
+     * @return time until the next possible transmission, in ms (0 if now)
+     */
+    uint32_t getTransmitDelay();
+
+    /**
+     * @brief Get the availability and the duty-cycle budget of each band
+     * 
+     * The remaining budget is calculated from the airtime of the transmissions within the
+     * last 60 minutes (in one-minute steps, and only since startup).
+     * 
+     * @param bands     array receiving the availability of the bands
+     * @param maxBands  size of the array (TTN_MAX_BANDS is sufficient for all regions)
+     * @return number of bands filled in
+     */
+    size_t getBandAvailability(TTNBandAvailability* bands, size_t maxBands);
+
+    /**
+     * @brief Request the network time
+     * 
+     * The request (DeviceTimeReq MAC command) is added to the next uplink; no uplink
+     * is transmitted for it. The answer synchronizes the clock read by 'getNetworkTime'.
+     * 
+     * If a resync interval is specified, the time is requested again after each
+     * synchronization. This allows to estimate and compensate the drift of the local
+     * clock. Unanswered requests are repeated with the next uplink.
+     * 
+     * @param resyncInterval  time between synchronizations, in s (0 for a single request; at most 8 hours)
+     * @return true if the request has been added, false if network time is disabled in the configuration
+     */
+    bool requestNetworkTime(uint32_t resyncInterval = 0);
+
+    /**
+     * @brief Get the current network time
+     * 
+     * The time is extrapolated from the last synchronization using the local clock
+     * (esp_timer). The error bound includes the accuracy guaranteed by the network
+     * and grows with the time since the last synchronization.
+     * This function does not wait for the LMIC background task and can be called from any task.
+     * 
+     * @param time  receives the network time
+     * @return true if the clock has been synchronized, false otherwise
+     */
+    bool getNetworkTime(TTNNetworkTime* time);
+
+    /**
+     * @brief Enable or disable Class C operation
+     * 
+     * In Class C, the radio continuously listens on the RX2 frequency and data rate
+     * whenever no uplink is on air, including while an uplink waits for the duty cycle.
+     * Downlinks are received without waiting for the next uplink and are passed to the
+     * 'onMessage' or 'onDownlink' callback in the LMIC background task. The radio is never put to sleep, so Class C is only
+     * suitable for devices with permanent power supply.
+     * 
+     * The device must also be registered as a Class C device in the network.
+     * Class C can be enabled before or after joining. It is disabled by 'reset'.
+     * Enabling Class C disables Class B.
+     * 
+     * @param enabled  true to enable Class C, false to return to Class A
+     */
+    void setClassC(bool enabled);
+
+    /**
+     * @brief Check if Class C operation is enabled
+     * 
+     * @return true if Class C is enabled, false otherwise
+     */
+    bool isClassC();
+
+    /**
+     * @brief Enable Class B operation
+     * 
+     * Searches for the network's beacon and, once it has been found, opens a receive
+     * window in every ping slot. Downlinks received in ping slots are passed to the
+     * 'onMessage' or 'onDownlink' callback in the LMIC background task. The ping slot
+     * periodicity is sent to the network with the next uplink; uplinks are marked as
+     * Class B while the beacon is tracked.
+     * 
+     * The beacon search takes up to about two minutes, during which no uplinks are
+     * transmitted. If the beacon is not found or lost, the device returns to Class A
+     * and 'enableClassB' must be called again (see 'onBeacon').
+     * 
+     * The device must have joined and must be registered as a Class B device in
+     * the network. Enabling Class B disables Class C.
+     * Class B requires the option "Class B" in the configuration.
+     * 
+     * @param pingPeriodicity  ping slot every 2^n beacon slots, about 1 s (0) to 128 s (7)
+     * @return true if the beacon search has been started, false if the device has not
+     *      joined or Class B is disabled in the configuration
+     */
+    bool enableClassB(uint8_t pingPeriodicity);
+
+    /**
+     * @brief Disable Class B operation and return to Class A
+     */
+    void disableClassB();
+
+    /**
+     * @brief Check if Class B operation is active
+     * 
+     * @return true if ping slots are enabled and the beacon is being searched or tracked
+     */
+    bool isClassB();
+
+    /**
+     * @brief Set the function to be called for Class B beacon events
+     * 
+     * @param callback  the callback function (or nullptr to remove it)
+     * @param userData  value passed to the callback
+     */
+    void onBeacon(TTNBeaconCallback callback, void* userData = nullptr);
+
+    /**
+     * @brief Set the policy for fetching downlinks pending in the network
+     * 
+     * If the network has further downlinks queued for the device, it sets the
+     * FPending bit in the downlink. Depending on the policy, uplinks are then sent
+     * until all pending downlinks have been received. Queued application messages
+     * are used for this if available. Messages received this way are passed to the
+     * 'onMessage' or 'onDownlink' callback in the LMIC background task.
+     * 
+     * By default, empty uplinks are sent without an airtime limit ('kTTNDrainPoll').
+     * 
+     * @param policy  the policy
+     */
+    void setDownlinkDrain(const TTNDrainPolicy& policy);
+
+    /**
+     * @brief Get statistics of the queue passing LMIC events to the task waiting in
+     * 'join' or 'transmitMessage'
+     * 
+     * The LMIC background task never blocks on this queue. If the waiting task does not
+     * keep up, the oldest event is dropped.
+     * 
+     * @param dropped    receives the number of dropped events since startup
+     * @param highWater  receives the maximum number of events that were queued at the same time
+     */
+    void getEventQueueStats(uint32_t* dropped, uint32_t* highWater);
+
+    /**
+     * @brief Get the latency of the SPI transactions with the radio chip
+     * 
+     * Nearly all transactions access a single register. So the average is the typical
+     * latency of a register access. It includes waiting for the SPI bus if it is shared
+     * with other devices and the LMIC background task has not yet acquired it.
+     * 
+     * @param transactions  receives the number of transactions since startup
+     * @param averageTime   receives the average duration of a transaction, in µs
+     * @param maxTime       receives the longest duration of a transaction, in µs
+     */
+    void getSpiStats(uint32_t* transactions, uint32_t* averageTime, uint32_t* maxTime);
+
+    /**
+     * @brief Get the number of radio interrupts (DIO0 and DIO1) since startup
+     * 
+     * @return number of interrupts
+     */
+    uint32_t radioInterruptCount();
+
+    /**
+     * @brief Get link quality and traffic statistics
+     * 
+     * The statistics are updated by the LMIC background task with every transmission and
+     * reception. This function does not wait for the LMIC background task and can be
+     * called from any task.
+     * 
+     * @param stats  receives a copy of the statistics
+     */
+    void getStatistics(TTNStatistics* stats);
+
+    /**
+     * @brief Get the timestamps of the most recently completed uplink
+     * 
+     * Messages submitted by this library (e.g. with 'transmitMessage', 'enqueueMessage',
+     * 'sendConfirmed' or a frame provider) are traced from queuing to the completion
+     * callback. This function can be called from any task.
+     * 
+     * @param trace  receives the timestamps
+     * @return true  if an uplink has completed since startup
+     * @return false otherwise
+     */
+    bool getLastUplinkTrace(TTNUplinkTrace* trace);
+
+    /**
+     * @brief Get the distribution of the duration of an uplink stage
+     * 
+     * Each completed uplink adds the duration of each stage it went through.
+     * This function can be called from any task.
+     * 
+     * @param stage      uplink stage
+     * @param histogram  receives the distribution
+     * @return true      if the stage is valid
+     * @return false     otherwise
+     */
+    bool getLatencyHistogram(TTNLatencyStage stage, TTNLatencyHistogram* histogram);
+
+    /**
+     * @brief Reset the latency histograms of all uplink stages
+     */
+    void resetLatencyHistograms();
+
+    /**
+     * @brief Set the current consumption model for the energy estimation
+     * 
+     * The time the radio spends in each operating mode (and, when transmitting, at each
+     * TX power level) and the time the LMIC background task is busy are measured
+     * continuously. The model turns them into an estimated charge.
+     * 
+     * @param model  current consumption model
+     */
+    void setCurrentModel(const TTNCurrentModel& model);
+
+    /**
+     * @brief Get the estimated energy consumption
+     * 
+     * The charge of an uplink covers the radio and the CPU from its submission to LMIC
+     * to its completion, including the receive windows and retransmissions, but not the
+     * baseline current. This function can be called from any task.
+     * 
+     * @param stats  receives the measured times and estimated charges
+     */
+    void getEnergyStats(TTNEnergyStats* stats);
+
+    /**
+     * @brief Restart the energy estimation
+     */
+    void resetEnergyStats();
+
     /**
      * @brief Set the function to be called when a message is received
      * 
@@ -201,12 +1184,57 @@ public:
      * 
      * Messages are received as a result of 'transmitMessage' or 'poll'. The callback is called
      * in the task that called any of these functions and it occurs before these functions
-     * return control to the caller.
+     * return control to the caller. Messages received as a result of 'enqueueMessage'
+     * are passed to the callback in the LMIC background task.
      * 
      * @param callback  the callback function
      */
     void onMessage(TTNMessageCallback callback);
 
+    /**
+     * @brief Set the function to be called with received messages in pooled buffers
+     * 
+     * When a message is received, the LMIC background task copies it into a buffer of the
+     * downlink pool. The callback takes ownership of the buffer and must release it with
+     * 'TTNDownlink::release()' when done, possibly in another task. No further copy is
+     * needed and the buffer remains valid when LMIC reuses its frame buffer.
+     * 
+     * Like for 'onMessage', the callback is called in the task waiting in 'transmitMessage'
+     * or, for messages received after 'enqueueMessage', in the LMIC background task.
+     * If this callback is set, the 'onMessage' callback is not called. If the pool is
+     * exhausted, the message is dropped (see 'getDownlinkPoolStats').
+     * 
+     * @param callback  the callback function (or nullptr to use 'onMessage')
+     * @param userData  value passed to the callback
+     */
+    void onDownlink(TTNDownlinkCallback callback, void* userData = nullptr);
+
+    /**
+     * @brief Get statistics of the downlink pool
+     * 
+     * @param dropped    receives the number of messages dropped because all buffers were in use
+     * @param highWater  receives the maximum number of buffers in use at the same time
+     */
+    void getDownlinkPoolStats(uint32_t* dropped, uint32_t* highWater);
+
+    /**
+     * @brief Set the function to be called for every LMIC event
+     * 
+     * Intended for diagnostics such as event recorders. The callback is called in the
+     * LMIC background task (see 'TTNEventCallback').
+     * 
+     * @param callback  the callback function (or nullptr to remove it)
+     * @param userData  value passed to the callback
+     */
+    void onEvent(TTNEventCallback callback, void* userData = nullptr);
+
+    /**
+     * @brief Set the function to be called when the LMIC stack fails fatally
+     * 
+     * @param callback  the callback function (or nullptr to remove it)
+     */
+    void onFatalError(TTNFatalErrorCallback callback);
+
     /**
      * @brief Checks if device EUI, app EUI and app key have been stored in non-volatile storage
      * or have been provided as by a call to 'join(const char*, const char*, const char*)'.
@@ -228,8 +1256,6 @@ public:
     void setRSSICal(int8_t rssiCal);
 
 private:
-    TTNMessageCallback messageCallback;
-
     bool joinCore();
 };
 
@@ -0,0 +1,157 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Time on air and duty-cycle budget.
+ *******************************************************************************/
+
+#include <string.h>
+#include "esp_timer.h"
+#include "hal/hal_esp32.h"
+#include "TTNAirtime.h"
+
+
+// MHDR (1), FHDR without options (7), FPort (1) and MIC (4)
+#define FRAME_OVERHEAD 13
+
+TTNAirtime ttn_airtime;
+
+
+TTNAirtime::TTNAirtime()
+{
+#if CFG_LMIC_EU_like
+    memset(usage, 0, sizeof(usage));
+    memset(bucketMinute, 0xff, sizeof(bucketMinute));
+#endif
+}
+
+// Called in the LMIC task when a frame is handed to the radio (EV_TXSTART)
+void TTNAirtime::transmissionStarted()
+{
+#if CFG_LMIC_EU_like
+    ttn_hal.enterCriticalSection();
+    uint32_t airtime = osticks2ms(calcAirTime(LMIC.rps, LMIC.dataLen));
+    int band = LMIC.channelFreq[LMIC.txChnl] & 0x3;
+    uint32_t minute = currentMinute();
+    int slot = minute % 60;
+    if (bucketMinute[slot] != minute)
+    {
+        for (int i = 0; i < MAX_BANDS; i++)
+            usage[i][slot] = 0;
+        bucketMinute[slot] = minute;
+    }
+    uint32_t total = usage[band][slot] + airtime;
+    usage[band][slot] = total > 0xffff ? 0xffff : total;
+    ttn_hal.leaveCriticalSection();
+#endif
+}
+
+// Returns the time on air of an uplink with the specified payload length, in ms
+uint32_t TTNAirtime::timeOnAir(size_t length, uint8_t dataRate)
+{
+    if (dataRate > 15 || !validDR(dataRate))
+        return 0;
+    if (length > MAX_LEN_FRAME - FRAME_OVERHEAD)
+        length = MAX_LEN_FRAME - FRAME_OVERHEAD;
+    return osticks2ms(calcAirTime(updr2rps(dataRate), (u1_t)(length + FRAME_OVERHEAD)));
+}
+
+// Returns the time until the earliest band with an enabled channel is available, in ms
+uint32_t TTNAirtime::transmitDelay()
+{
+    ttn_hal.enterCriticalSection();
+    ostime_t now = os_getTime();
+    uint32_t delay = UINT32_MAX;
+
+#if CFG_LMIC_EU_like
+    for (int channel = 0; channel < MAX_CHANNELS; channel++)
+    {
+        if ((LMIC.channelMap & (1 << channel)) == 0)
+            continue;
+        ostime_t avail = LMIC.bands[LMIC.channelFreq[channel] & 0x3].avail;
+        if ((s4_t)(LMIC.globalDutyAvail - avail) > 0)
+            avail = LMIC.globalDutyAvail;
+        uint32_t wait = waitTime(avail, now);
+        if (wait < delay)
+            delay = wait;
+    }
+#else
+    delay = waitTime(LMIC.globalDutyAvail, now);
+#endif
+
+    ttn_hal.leaveCriticalSection();
+    return delay;
+}
+
+// Fills in the availability of the bands used by the region. Returns the number of bands.
+size_t TTNAirtime::getBands(TTNBandAvailability* bands, size_t maxBands)
+{
+    size_t n = 0;
+    ttn_hal.enterCriticalSection();
+    ostime_t now = os_getTime();
+
+#if CFG_LMIC_EU_like
+    uint32_t minute = currentMinute();
+    for (int i = 0; i < MAX_BANDS && n < maxBands; i++)
+    {
+        const band_t* band = &LMIC.bands[i];
+        if (band->txcap == 0)
+            continue; // band not set up by region
+
+        ostime_t avail = band->avail;
+        if ((s4_t)(LMIC.globalDutyAvail - avail) > 0)
+            avail = LMIC.globalDutyAvail;
+
+        uint32_t budget = 3600000 / band->txcap;
+        uint32_t used = usedWithinHour(i, minute);
+        bands[n].band = i;
+        bands[n].waitTime = waitTime(avail, now);
+        bands[n].budgetPerHour = budget;
+        bands[n].remainingBudget = used < budget ? budget - used : 0;
+        n++;
+    }
+#else
+    if (maxBands > 0)
+    {
+        // no duty-cycle limits apart from the global duty cycle set by the network
+        bands[0].band = 0;
+        bands[0].waitTime = waitTime(LMIC.globalDutyAvail, now);
+        bands[0].budgetPerHour = UINT32_MAX;
+        bands[0].remainingBudget = UINT32_MAX;
+        n = 1;
+    }
+#endif
+
+    ttn_hal.leaveCriticalSection();
+    return n;
+}
+
+#if CFG_LMIC_EU_like
+// Adds up the airtime of the current minute and the 59 preceding ones
+uint32_t TTNAirtime::usedWithinHour(int band, uint32_t minute)
+{
+    uint32_t used = 0;
+    for (int slot = 0; slot < 60; slot++)
+    {
+        if (minute - bucketMinute[slot] < 60)
+            used += usage[band][slot];
+    }
+    return used;
+}
+#endif
+
+uint32_t TTNAirtime::currentMinute()
+{
+    return (uint32_t)(esp_timer_get_time() / 60000000);
+}
+
+uint32_t TTNAirtime::waitTime(ostime_t avail, ostime_t now)
+{
+    ostime_t wait = avail - now;
+    return wait > 0 ? osticks2ms(wait) : 0;
+}
@@ -0,0 +1,53 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Time on air and duty-cycle budget.
+ *******************************************************************************/
+
+#ifndef _ttnairtime_h_
+#define _ttnairtime_h_
+
+#include "lmic/lmic.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Calculates the time on air and tracks the duty-cycle budget.
+ *
+ * LMIC only keeps the time each band becomes available again. To
+ * report the budget used within the last hour, the airtime of each
+ * transmission is additionally added up per band in one-minute buckets.
+ *
+ * This class is not to be used directly.
+ */
+class TTNAirtime
+{
+public:
+    TTNAirtime();
+
+    void transmissionStarted();
+    uint32_t timeOnAir(size_t length, uint8_t dataRate);
+    uint32_t transmitDelay();
+    size_t getBands(TTNBandAvailability* bands, size_t maxBands);
+
+private:
+    static uint32_t currentMinute();
+    static uint32_t waitTime(ostime_t avail, ostime_t now);
+
+#if CFG_LMIC_EU_like
+    uint32_t usedWithinHour(int band, uint32_t minute);
+
+    uint16_t usage[MAX_BANDS][60];  // airtime in ms per band and minute
+    uint32_t bucketMinute[60];      // minute the bucket has been used for
+#endif
+};
+
+extern TTNAirtime ttn_airtime;
+
+#endif
@@ -0,0 +1,173 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Packs small messages into a single uplink.
+ *******************************************************************************/
+
+#include <string.h>
+#include "esp_log.h"
+#include "hal/hal_esp32.h"
+#include "TTNCoalescer.h"
+#include "TTNTxQueue.h"
+
+
+// Delay before retrying to queue a frame if the transmit queue is full
+#define RETRY_DELAY_MS 1000
+
+static const char *TAG = "ttn_coal";
+
+TTNCoalescer ttn_coalescer;
+
+
+TTNCoalescer::TTNCoalescer()
+{
+    memset(buffers, 0, sizeof(buffers));
+}
+
+// Enables coalescing for the specified port (or disables it if 'maxDelay' is 0).
+// Called by application tasks.
+bool TTNCoalescer::configure(port_t port, uint32_t maxDelay)
+{
+    if (port == 0)
+        return false;
+
+    ttn_hal.enterCriticalSection();
+
+    TTNCoalesceBuffer* buffer = find(port);
+    if (buffer == nullptr)
+    {
+        if (maxDelay == 0)
+        {
+            ttn_hal.leaveCriticalSection();
+            return true;
+        }
+
+        buffer = find(0);
+        if (buffer == nullptr)
+        {
+            ttn_hal.leaveCriticalSection();
+            ESP_LOGW(TAG, "No coalescing buffer left for port %d", port);
+            return false;
+        }
+        buffer->port = port;
+        buffer->length = 0;
+    }
+    else if (maxDelay == 0)
+    {
+        // pending records must be queued before the buffer is released
+        if (!flush(buffer))
+        {
+            ttn_hal.leaveCriticalSection();
+            return false;
+        }
+        buffer->port = 0;
+    }
+
+    buffer->maxDelay = maxDelay;
+    ttn_hal.leaveCriticalSection();
+    return true;
+}
+
+// Appends a message to the buffer of the specified port.
+// Called by application tasks.
+bool TTNCoalescer::add(const uint8_t* payload, size_t length, port_t port)
+{
+    if (port == 0 || length + 1 > MAX_LEN_PAYLOAD)
+        return false;
+
+    ttn_hal.enterCriticalSection();
+
+    TTNCoalesceBuffer* buffer = find(port);
+    if (buffer == nullptr)
+    {
+        ttn_hal.leaveCriticalSection();
+        return false;
+    }
+
+    // the limit is re-evaluated for every record as ADR can change the data rate
+    size_t maxPayload = LMIC_maxPayloadForDataRate(LMIC.datarate);
+    if (buffer->length > 0 && buffer->length + 1 + length > maxPayload)
+    {
+        if (!flush(buffer))
+        {
+            ttn_hal.leaveCriticalSection();
+            return false;
+        }
+    }
+
+    bool isFirst = buffer->length == 0;
+    buffer->data[buffer->length] = length;
+    memcpy(buffer->data + buffer->length + 1, payload, length);
+    buffer->length += 1 + length;
+
+    if (buffer->length >= maxPayload)
+    {
+        // a single record that does not fit is sent as is;
+        // LMIC switches to a data rate that fits the frame if possible
+        flush(buffer);
+    }
+    else if (isFirst)
+    {
+        os_setTimedCallback(&buffer->job, os_getTime() + ms2osticks(buffer->maxDelay), flushJob);
+        ttn_hal.wakeUp();
+    }
+
+    ttn_hal.leaveCriticalSection();
+    return true;
+}
+
+// Queues all pending frames.
+void TTNCoalescer::flushAll()
+{
+    ttn_hal.enterCriticalSection();
+    for (int i = 0; i < CONFIG_TTN_COALESCE_PORTS; i++)
+        flush(&buffers[i]);
+    ttn_hal.leaveCriticalSection();
+}
+
+TTNCoalesceBuffer* TTNCoalescer::find(port_t port)
+{
+    for (int i = 0; i < CONFIG_TTN_COALESCE_PORTS; i++)
+    {
+        if (buffers[i].port == port)
+            return &buffers[i];
+    }
+    return nullptr;
+}
+
+// Hands the buffer to the transmit queue.
+// Must be called with the critical section entered.
+bool TTNCoalescer::flush(TTNCoalesceBuffer* buffer)
+{
+    if (buffer->length == 0)
+        return true;
+
+    if (!ttn_tx_queue.enqueue(buffer->data, buffer->length, buffer->port, false, nullptr, nullptr, kTTNPriorityNormal))
+    {
+        os_setTimedCallback(&buffer->job, os_getTime() + ms2osticks(RETRY_DELAY_MS), flushJob);
+        ttn_hal.wakeUp();
+        return false;
+    }
+
+    os_clearCallback(&buffer->job);
+    buffer->length = 0;
+    return true;
+}
+
+// Called in the LMIC task when the maximum delay has expired
+void TTNCoalescer::flushJob(osjob_t* job)
+{
+    ttn_hal.enterCriticalSection();
+    for (int i = 0; i < CONFIG_TTN_COALESCE_PORTS; i++)
+    {
+        if (&ttn_coalescer.buffers[i].job == job)
+            ttn_coalescer.flush(&ttn_coalescer.buffers[i]);
+    }
+    ttn_hal.leaveCriticalSection();
+}
@@ -0,0 +1,67 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Packs small messages into a single uplink.
+ *******************************************************************************/
+
+#ifndef _ttncoalescer_h_
+#define _ttncoalescer_h_
+
+#include "lmic/lmic.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Pending frame of coalesced messages for a single port
+ */
+struct TTNCoalesceBuffer
+{
+    port_t port;
+    uint32_t maxDelay; // in ms, 0 if unused
+    uint8_t length;
+    uint8_t data[MAX_LEN_PAYLOAD];
+    osjob_t job;
+};
+
+
+/**
+ * @brief Uplink coalescing.
+ *
+ * Messages for a port with coalescing enabled are appended to the port's
+ * buffer as records consisting of a length byte followed by the message bytes.
+ * The buffer is handed to the transmit queue as a single frame when the next
+ * record would exceed the maximum payload for the current data rate, or when
+ * the oldest record has waited for the configured maximum delay.
+ *
+ * The flush timer is an LMIC job, i.e. the frame is queued by the LMIC task.
+ * There are CONFIG_TTN_COALESCE_PORTS buffers.
+ *
+ * This class is not to be used directly.
+ */
+class TTNCoalescer
+{
+public:
+    TTNCoalescer();
+
+    bool configure(port_t port, uint32_t maxDelay);
+    bool add(const uint8_t* payload, size_t length, port_t port);
+    void flushAll();
+
+private:
+    static void flushJob(osjob_t* job);
+
+    TTNCoalesceBuffer* find(port_t port);
+    bool flush(TTNCoalesceBuffer* buffer);
+
+    TTNCoalesceBuffer buffers[CONFIG_TTN_COALESCE_PORTS];
+};
+
+extern TTNCoalescer ttn_coalescer;
+
+#endif
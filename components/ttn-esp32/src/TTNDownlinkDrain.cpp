@@ -0,0 +1,94 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Fetching of further pending downlinks (FPending).
+ *******************************************************************************/
+
+#include "esp_log.h"
+#include "hal/hal_esp32.h"
+#include "TTNAirtime.h"
+#include "TTNDownlinkDrain.h"
+#include "TTNTxQueue.h"
+
+
+static const char *TAG = "ttn_drain";
+
+TTNDownlinkDrain ttn_downlink_drain;
+
+
+TTNDownlinkDrain::TTNDownlinkDrain()
+    : airtimeUsed(0), draining(false)
+{
+}
+
+// Sets the policy. Called by application tasks.
+void TTNDownlinkDrain::configure(const TTNDrainPolicy& drainPolicy)
+{
+    ttn_hal.enterCriticalSection();
+    policy = drainPolicy;
+    if (policy.mode == kTTNDrainOff)
+        os_clearCallback(&job);
+    ttn_hal.leaveCriticalSection();
+}
+
+// Called in the LMIC task after an uplink has completed or a
+// Class B/C downlink has been received
+void TTNDownlinkDrain::check()
+{
+    ttn_hal.enterCriticalSection();
+
+    if (!LMIC.moreData)
+    {
+        draining = false;
+        airtimeUsed = 0;
+        os_clearCallback(&job);
+    }
+    else if (policy.mode != kTTNDrainOff)
+    {
+        draining = true;
+        uint32_t delay = policy.mode == kTTNDrainPiggyback ? policy.piggybackDelay : 0;
+        os_setTimedCallback(&job, os_getTime() + ms2osticks(delay), pollJob);
+        ttn_hal.wakeUp();
+    }
+
+    ttn_hal.leaveCriticalSection();
+}
+
+// Called in the LMIC task to send an empty uplink unless another
+// uplink is already on its way
+void TTNDownlinkDrain::pollJob(osjob_t* job)
+{
+    TTNDownlinkDrain* drain = &ttn_downlink_drain;
+
+    ttn_hal.enterCriticalSection();
+
+    // the next uplink fetches the downlink anyway; 'check' is called again when it completes
+    if (!drain->draining || ttn_tx_queue.count() != 0
+        || (LMIC.opmode & (OP_TXDATA | OP_POLL | OP_TXRXPEND | OP_JOINING)) != 0)
+    {
+        ttn_hal.leaveCriticalSection();
+        return;
+    }
+
+    uint32_t airtime = ttn_airtime.timeOnAir(0, LMIC.datarate);
+    uint32_t budget = drain->policy.airtimeBudget;
+    if (budget != 0 && drain->airtimeUsed + airtime > budget)
+    {
+        ESP_LOGW(TAG, "Airtime budget exhausted, pending downlinks not fetched");
+        drain->draining = false;
+        ttn_hal.leaveCriticalSection();
+        return;
+    }
+
+    drain->airtimeUsed += airtime;
+    LMIC_sendAlive();
+    ttn_hal.wakeUp();
+
+    ttn_hal.leaveCriticalSection();
+}
@@ -0,0 +1,54 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Fetching of further pending downlinks (FPending).
+ *******************************************************************************/
+
+#ifndef _ttndownlinkdrain_h_
+#define _ttndownlinkdrain_h_
+
+#include "lmic/lmic.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Sends uplinks to fetch downlinks the network has still queued.
+ *
+ * After each uplink and Class B/C downlink, LMIC's 'moreData' flag
+ * (FPending bit of the last downlink) is checked. While it is set and
+ * no application message is queued, an empty uplink is requested with
+ * 'LMIC_sendAlive()', immediately or after waiting for an application
+ * message to piggyback on. LMIC transmits it as soon as the duty cycle
+ * allows.
+ *
+ * The time on air of the empty uplinks is added up until the network
+ * has no more pending downlinks and is limited by the airtime budget.
+ *
+ * This class is not to be used directly.
+ */
+class TTNDownlinkDrain
+{
+public:
+    TTNDownlinkDrain();
+
+    void configure(const TTNDrainPolicy& policy);
+    void check();
+
+private:
+    static void pollJob(osjob_t* job);
+
+    TTNDrainPolicy policy;
+    uint32_t airtimeUsed; // in ms, for the current drain
+    bool draining;
+    osjob_t job;
+};
+
+extern TTNDownlinkDrain ttn_downlink_drain;
+
+#endif
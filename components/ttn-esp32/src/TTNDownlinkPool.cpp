@@ -0,0 +1,89 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Fixed pool of buffers for received messages.
+ *******************************************************************************/
+
+#include <string.h>
+#include "lmic/lmic.h"
+#include "TTNDownlinkPool.h"
+
+
+static_assert(TTN_MAX_PAYLOAD_SIZE == MAX_LEN_PAYLOAD, "TTN_MAX_PAYLOAD_SIZE does not match LMIC");
+static_assert(CONFIG_TTN_DOWNLINK_POOL_SIZE <= 32, "Downlink pool is limited to 32 buffers");
+
+TTNDownlinkPool ttn_downlink_pool;
+
+
+TTNDownlinkPool::TTNDownlinkPool()
+    : freeMask(CONFIG_TTN_DOWNLINK_POOL_SIZE == 32 ? 0xffffffff : (1u << CONFIG_TTN_DOWNLINK_POOL_SIZE) - 1),
+      numDropped(0), numInUse(0), maxInUse(0)
+{
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    lock = unlocked;
+}
+
+// Copies a received message into a free buffer.
+// Called in the LMIC task. Returns nullptr if all buffers are in use.
+TTNDownlink* TTNDownlinkPool::allocate(port_t port, const uint8_t* payload, size_t length)
+{
+    if (length > TTN_MAX_PAYLOAD_SIZE)
+        length = TTN_MAX_PAYLOAD_SIZE;
+
+    portENTER_CRITICAL(&lock);
+    if (freeMask == 0)
+    {
+        numDropped++;
+        portEXIT_CRITICAL(&lock);
+        return nullptr;
+    }
+
+    int index = __builtin_ctz(freeMask);
+    freeMask &= ~(1u << index);
+    numInUse++;
+    if (numInUse > maxInUse)
+        maxInUse = numInUse;
+    portEXIT_CRITICAL(&lock);
+
+    TTNDownlink* downlink = &downlinks[index];
+    downlink->port = port;
+    downlink->length = length;
+    memcpy(downlink->payload, payload, length);
+    return downlink;
+}
+
+// Returns a buffer to the pool. Can be called from any task.
+void TTNDownlinkPool::release(TTNDownlink* downlink)
+{
+    int index = downlink - downlinks;
+    if (index < 0 || index >= CONFIG_TTN_DOWNLINK_POOL_SIZE)
+        return;
+
+    portENTER_CRITICAL(&lock);
+    if ((freeMask & (1u << index)) == 0)
+    {
+        freeMask |= 1u << index;
+        numInUse--;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+void TTNDownlinkPool::getStats(uint32_t* dropped, uint32_t* highWater)
+{
+    portENTER_CRITICAL(&lock);
+    *dropped = numDropped;
+    *highWater = maxInUse;
+    portEXIT_CRITICAL(&lock);
+}
+
+
+void TTNDownlink::release()
+{
+    ttn_downlink_pool.release(this);
+}
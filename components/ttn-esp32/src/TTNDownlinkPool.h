@@ -0,0 +1,54 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Fixed pool of buffers for received messages.
+ *******************************************************************************/
+
+#ifndef _ttndownlinkpool_h_
+#define _ttndownlinkpool_h_
+
+#include "freertos/FreeRTOS.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Pool of downlink buffers.
+ *
+ * When LMIC receives a message, the LMIC task copies it from LMIC's frame
+ * buffer into a free pool buffer. The buffer is then owned by the consumer
+ * until it calls TTNDownlink::release(). As LMIC reuses its frame buffer for
+ * the next transmission, this is the only safe way to process a downlink
+ * in another task.
+ *
+ * The pool consists of CONFIG_TTN_DOWNLINK_POOL_SIZE statically allocated
+ * buffers. Allocation and release are protected by a spinlock and never block.
+ *
+ * This class is not to be used directly.
+ */
+class TTNDownlinkPool
+{
+public:
+    TTNDownlinkPool();
+
+    TTNDownlink* allocate(port_t port, const uint8_t* payload, size_t length);
+    void release(TTNDownlink* downlink);
+    void getStats(uint32_t* dropped, uint32_t* highWater);
+
+private:
+    TTNDownlink downlinks[CONFIG_TTN_DOWNLINK_POOL_SIZE];
+    uint32_t freeMask;
+    uint32_t numDropped;
+    uint32_t numInUse;
+    uint32_t maxInUse;
+    portMUX_TYPE lock;
+};
+
+extern TTNDownlinkPool ttn_downlink_pool;
+
+#endif
@@ -0,0 +1,128 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Dispatching of received messages by port.
+ *******************************************************************************/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "TTNDownlinkRouter.h"
+
+
+static const char *TAG = "ttn_router";
+
+
+TTNDownlinkRouter::TTNDownlinkRouter(uint8_t queueSize)
+    : numHandlers(0), numDropped(0)
+{
+    memset(portTable, 0, sizeof(portTable));
+    queue = xQueueCreate(queueSize, sizeof(TTNDownlink*));
+    configASSERT(queue != nullptr);
+}
+
+TTNDownlinkRouter::~TTNDownlinkRouter()
+{
+    vQueueDelete(queue);
+}
+
+bool TTNDownlinkRouter::addHandler(port_t port, TTNPortHandler handler, void* context)
+{
+    return addHandler(port, port, handler, context);
+}
+
+bool TTNDownlinkRouter::addHandler(port_t firstPort, port_t lastPort, TTNPortHandler handler, void* context)
+{
+    if (firstPort < 1 || lastPort > 223 || firstPort > lastPort || handler == nullptr)
+    {
+        ESP_LOGE(TAG, "Invalid port range %d to %d", firstPort, lastPort);
+        return false;
+    }
+
+    for (int port = firstPort; port <= lastPort; port++)
+    {
+        if (portTable[port] != 0)
+        {
+            ESP_LOGE(TAG, "Port %d already has a handler", port);
+            return false;
+        }
+    }
+
+    if (numHandlers == TTN_MAX_PORT_HANDLERS)
+    {
+        ESP_LOGE(TAG, "Too many port handlers");
+        return false;
+    }
+
+    handlers[numHandlers].handler = handler;
+    handlers[numHandlers].context = context;
+    numHandlers++;
+
+    for (int port = firstPort; port <= lastPort; port++)
+        portTable[port] = numHandlers;
+
+    return true;
+}
+
+void TTNDownlinkRouter::start(TheThingsNetwork& ttn, UBaseType_t priority, uint32_t stackSize, BaseType_t core)
+{
+    connect(ttn);
+    xTaskCreatePinnedToCore(dispatchTask, "ttn_router", stackSize, this, priority, nullptr, core);
+}
+
+void TTNDownlinkRouter::connect(TheThingsNetwork& ttn)
+{
+    ttn.onDownlink(downlinkReceived, this);
+}
+
+bool TTNDownlinkRouter::dispatch(TickType_t ticksToWait)
+{
+    TTNDownlink* downlink;
+    if (xQueueReceive(queue, &downlink, ticksToWait) != pdTRUE)
+        return false;
+
+    uint8_t index = portTable[downlink->port];
+    if (index != 0)
+    {
+        const Handler& entry = handlers[index - 1];
+        entry.handler(downlink, entry.context);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No handler for port %d", downlink->port);
+        numDropped++;
+    }
+
+    downlink->release();
+    return true;
+}
+
+uint32_t TTNDownlinkRouter::droppedCount()
+{
+    return numDropped;
+}
+
+// Called in the LMIC task or the task waiting in 'transmitMessage'
+void TTNDownlinkRouter::downlinkReceived(TTNDownlink* downlink, void* userData)
+{
+    TTNDownlinkRouter* router = static_cast<TTNDownlinkRouter*>(userData);
+    if (xQueueSend(router->queue, &downlink, 0) != pdTRUE)
+    {
+        router->numDropped++;
+        downlink->release();
+    }
+}
+
+void TTNDownlinkRouter::dispatchTask(void* param)
+{
+    TTNDownlinkRouter* router = static_cast<TTNDownlinkRouter*>(param);
+    while (true)
+        router->dispatch();
+}
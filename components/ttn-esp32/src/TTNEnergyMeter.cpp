@@ -0,0 +1,149 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Energy estimation from radio and CPU activity times.
+ *******************************************************************************/
+
+#include <string.h>
+#include "esp_timer.h"
+#include "TTNEnergyMeter.h"
+
+
+static_assert(TTN_ENERGY_TX_POWER_LEVELS == HAL_TX_POWER_LEVELS, "TX power levels of HAL and API differ");
+
+// Conversion of µA * µs to nAh
+#define UA_US_PER_NAH 3600000LL
+
+TTNEnergyMeter ttn_energy_meter;
+
+
+TTNEnergyMeter::TTNEnergyMeter()
+    : messageActive(false), messages(0), lastMessageCharge(0), messageChargeSum(0)
+{
+    // the base snapshot is taken by 'reset' when the LMIC task is started
+    memset(&base, 0, sizeof(base));
+    memset(&messageStart, 0, sizeof(messageStart));
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    lock = unlocked;
+}
+
+void TTNEnergyMeter::setModel(const TTNCurrentModel& currentModel)
+{
+    portENTER_CRITICAL(&lock);
+    model = currentModel;
+    portEXIT_CRITICAL(&lock);
+}
+
+// Called in the LMIC task when an uplink is submitted to LMIC
+void TTNEnergyMeter::messageStarted()
+{
+    TTNActivitySnapshot snapshot;
+    takeSnapshot(&snapshot);
+
+    portENTER_CRITICAL(&lock);
+    messageStart = snapshot;
+    messageActive = true;
+    portEXIT_CRITICAL(&lock);
+}
+
+// Called in the LMIC task when an uplink has completed
+void TTNEnergyMeter::messageCompleted()
+{
+    TTNActivitySnapshot snapshot;
+    takeSnapshot(&snapshot);
+
+    portENTER_CRITICAL(&lock);
+    if (messageActive)
+    {
+        uint64_t charge = radioCharge(&messageStart, &snapshot, &model) + cpuCharge(&messageStart, &snapshot, &model);
+        lastMessageCharge = charge > UINT32_MAX ? UINT32_MAX : (uint32_t)charge;
+        messageChargeSum += lastMessageCharge;
+        messages++;
+        messageActive = false;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+void TTNEnergyMeter::getStats(TTNEnergyStats* stats)
+{
+    TTNActivitySnapshot now;
+    takeSnapshot(&now);
+
+    TTNActivitySnapshot from;
+    TTNCurrentModel currentModel;
+    portENTER_CRITICAL(&lock);
+    from = base;
+    currentModel = model;
+    stats->messages = messages;
+    stats->lastMessageCharge = lastMessageCharge;
+    stats->averageMessageCharge = messages != 0 ? (uint32_t)(messageChargeSum / messages) : 0;
+    portEXIT_CRITICAL(&lock);
+
+    // radio modes: see 'radioCharge'
+    int64_t elapsed = now.time - from.time;
+    stats->elapsed = (uint32_t)(elapsed / 1000);
+    stats->radioSleepTime = (uint32_t)((now.radioModeTimes[0] - from.radioModeTimes[0]) / 1000);
+    stats->radioStandbyTime = (uint32_t)((now.radioModeTimes[1] - from.radioModeTimes[1]) / 1000);
+    stats->radioSynthesizerTime = (uint32_t)((now.radioModeTimes[2] - from.radioModeTimes[2]
+        + now.radioModeTimes[4] - from.radioModeTimes[4]) / 1000);
+    stats->radioRxTime = (uint32_t)((now.radioModeTimes[5] - from.radioModeTimes[5] + now.radioModeTimes[6]
+        - from.radioModeTimes[6] + now.radioModeTimes[7] - from.radioModeTimes[7]) / 1000);
+    for (int i = 0; i < TTN_ENERGY_TX_POWER_LEVELS; i++)
+        stats->radioTxTime[i] = (uint32_t)((now.txPowerTimes[i] - from.txPowerTimes[i]) / 1000);
+    stats->cpuActiveTime = (uint32_t)((now.busyTime - from.busyTime) / 1000);
+
+    stats->radioCharge = radioCharge(&from, &now, &currentModel);
+    stats->totalCharge = stats->radioCharge + cpuCharge(&from, &now, &currentModel)
+        + elapsed * currentModel.baseline / UA_US_PER_NAH;
+    uint64_t perHour = elapsed > 0 ? stats->totalCharge * 3600000000LL / elapsed : 0;
+    stats->chargePerHour = perHour > UINT32_MAX ? UINT32_MAX : (uint32_t)perHour;
+}
+
+void TTNEnergyMeter::reset()
+{
+    TTNActivitySnapshot snapshot;
+    takeSnapshot(&snapshot);
+
+    portENTER_CRITICAL(&lock);
+    base = snapshot;
+    messageActive = false;
+    messages = 0;
+    lastMessageCharge = 0;
+    messageChargeSum = 0;
+    portEXIT_CRITICAL(&lock);
+}
+
+void TTNEnergyMeter::takeSnapshot(TTNActivitySnapshot* snapshot)
+{
+    snapshot->time = esp_timer_get_time();
+    ttn_hal.getActivityTimes(snapshot->radioModeTimes, snapshot->txPowerTimes, &snapshot->busyTime);
+}
+
+// Applies the radio currents to the time spent in each mode between the snapshots
+uint64_t TTNEnergyMeter::radioCharge(const TTNActivitySnapshot* from, const TTNActivitySnapshot* to, const TTNCurrentModel* model)
+{
+    // indexed by radio mode: sleep, standby, FSTX, TX (by power level below), FSRX, RX, RX single, CAD
+    const uint32_t currents[HAL_RADIO_MODES] = {
+        model->radioSleep, model->radioStandby, model->radioSynthesizer, 0,
+        model->radioSynthesizer, model->radioRx, model->radioRx, model->radioRx
+    };
+
+    int64_t sum = 0;
+    for (int i = 0; i < HAL_RADIO_MODES; i++)
+        sum += (to->radioModeTimes[i] - from->radioModeTimes[i]) * currents[i];
+    for (int i = 0; i < HAL_TX_POWER_LEVELS; i++)
+        sum += (to->txPowerTimes[i] - from->txPowerTimes[i]) * model->radioTx[i];
+    return sum / UA_US_PER_NAH;
+}
+
+// Applies the CPU current to the time the LMIC task was busy between the snapshots
+uint64_t TTNEnergyMeter::cpuCharge(const TTNActivitySnapshot* from, const TTNActivitySnapshot* to, const TTNCurrentModel* model)
+{
+    return (to->busyTime - from->busyTime) * model->cpuActive / UA_US_PER_NAH;
+}
@@ -0,0 +1,77 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Energy estimation from radio and CPU activity times.
+ *******************************************************************************/
+
+#ifndef _ttnenergymeter_h_
+#define _ttnenergymeter_h_
+
+#include "freertos/FreeRTOS.h"
+#include "hal/hal_esp32.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Activity times measured by the HAL at a point in time (in µs)
+ */
+struct TTNActivitySnapshot
+{
+    int64_t time;
+    int64_t radioModeTimes[HAL_RADIO_MODES];
+    int64_t txPowerTimes[HAL_TX_POWER_LEVELS];
+    int64_t busyTime;
+};
+
+
+/**
+ * @brief Estimates the energy consumption.
+ *
+ * The HAL measures the time the radio spends in each operating mode
+ * and at each TX power level, and the time the LMIC task is busy,
+ * i.e. running and neither waiting for an event nor for the mutex.
+ * This class applies the current model to the difference between two
+ * snapshots of these times: the one taken when the LMIC task is
+ * started (or at reset) for the totals and the one taken at the
+ * submission of an uplink for the charge per message.
+ *
+ * The results are protected by a spinlock so they can be read from
+ * any task.
+ *
+ * This class is not to be used directly.
+ */
+class TTNEnergyMeter
+{
+public:
+    TTNEnergyMeter();
+
+    void setModel(const TTNCurrentModel& model);
+    void messageStarted();
+    void messageCompleted();
+    void getStats(TTNEnergyStats* stats);
+    void reset();
+
+private:
+    static void takeSnapshot(TTNActivitySnapshot* snapshot);
+    static uint64_t radioCharge(const TTNActivitySnapshot* from, const TTNActivitySnapshot* to, const TTNCurrentModel* model);
+    static uint64_t cpuCharge(const TTNActivitySnapshot* from, const TTNActivitySnapshot* to, const TTNCurrentModel* model);
+
+    TTNCurrentModel model;
+    TTNActivitySnapshot base;
+    TTNActivitySnapshot messageStart;
+    bool messageActive;
+    uint32_t messages;
+    uint32_t lastMessageCharge;
+    uint64_t messageChargeSum;
+    portMUX_TYPE lock;
+};
+
+extern TTNEnergyMeter ttn_energy_meter;
+
+#endif
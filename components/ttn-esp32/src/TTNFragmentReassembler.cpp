@@ -0,0 +1,103 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Reassembly of fragmented uplinks (see 'sendFragmented').
+ *******************************************************************************/
+
+#include <string.h>
+#include "TTNFragmentReassembler.h"
+
+
+TTNFragmentReassembler::TTNFragmentReassembler()
+    : active(false), id(0), numFragments(0), numReceived(0)
+{
+}
+
+bool TTNFragmentReassembler::addFragment(const uint8_t* frame, size_t length)
+{
+    if (length < TTN_FRAGMENT_HEADER_SIZE)
+        return false;
+
+    uint8_t frameId = frame[0];
+    uint8_t index = frame[1];
+    uint8_t count = frame[2];
+    if (count == 0 || index >= count)
+        return false;
+
+    if (!active || frameId != id || count != numFragments)
+    {
+        reset();
+        active = true;
+        id = frameId;
+        numFragments = count;
+        fragments.resize(count);
+        received.resize(count, false);
+    }
+
+    if (!received[index])
+    {
+        fragments[index].assign(frame + TTN_FRAGMENT_HEADER_SIZE, frame + length);
+        received[index] = true;
+        numReceived++;
+    }
+
+    return isComplete();
+}
+
+bool TTNFragmentReassembler::isComplete() const
+{
+    return active && numReceived == numFragments;
+}
+
+uint8_t TTNFragmentReassembler::transferId() const
+{
+    return id;
+}
+
+size_t TTNFragmentReassembler::buildResendRequest(uint8_t* request, size_t maxLength) const
+{
+    if (!active || maxLength < 1)
+        return 0;
+
+    request[0] = id;
+    if (isComplete())
+        return 1; // acknowledgement
+
+    size_t length = 1 + (numFragments + 7) / 8;
+    if (maxLength < length)
+        return 0;
+
+    memset(request + 1, 0, length - 1);
+    for (int i = 0; i < numFragments; i++)
+    {
+        if (!received[i])
+            request[1 + i / 8] |= 1 << (i % 8);
+    }
+    return length;
+}
+
+std::vector<uint8_t> TTNFragmentReassembler::data() const
+{
+    std::vector<uint8_t> result;
+    if (!isComplete())
+        return result;
+
+    for (const std::vector<uint8_t>& fragment : fragments)
+        result.insert(result.end(), fragment.begin(), fragment.end());
+    return result;
+}
+
+void TTNFragmentReassembler::reset()
+{
+    active = false;
+    numFragments = 0;
+    numReceived = 0;
+    fragments.clear();
+    received.clear();
+}
@@ -0,0 +1,259 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Fragmentation of buffers larger than a single frame.
+ *******************************************************************************/
+
+#include <string.h>
+#include <stdint.h>
+#include "esp_log.h"
+#include "hal/hal_esp32.h"
+#include "TTNFragmenter.h"
+#include "TTNTxQueue.h"
+
+
+// Delay before retrying to queue a fragment if the transmit queue is full
+#define RETRY_DELAY_MS 1000
+
+static const char *TAG = "ttn_frag";
+
+TTNFragmenter ttn_fragmenter;
+
+
+TTNFragmenter::TTNFragmenter()
+    : data(nullptr), length(0), port(0), transferId(0), fragmentSize(0), numFragments(0),
+      nextFragment(0), active(false), fragmentQueued(false), queuedLength(0),
+      waitingForRequest(false), resendWindow(0), callback(nullptr), userData(nullptr)
+{
+    memset(pending, 0, sizeof(pending));
+}
+
+// Starts a new transfer. Called by application tasks.
+bool TTNFragmenter::start(const uint8_t* buffer, size_t bufferLength, port_t txPort, uint32_t window,
+    TTNTransmitCallback cb, void* cbUserData)
+{
+    if (txPort == 0 || bufferLength == 0)
+        return false;
+
+    ttn_hal.enterCriticalSection();
+
+    if (active)
+    {
+        ttn_hal.leaveCriticalSection();
+        ESP_LOGW(TAG, "Fragmented transfer already in progress");
+        return false;
+    }
+
+    size_t maxPayload = LMIC_maxPayloadForDataRate(LMIC.datarate);
+    if (maxPayload <= TTN_FRAGMENT_HEADER_SIZE)
+    {
+        ttn_hal.leaveCriticalSection();
+        return false;
+    }
+    size_t size = maxPayload - TTN_FRAGMENT_HEADER_SIZE;
+    size_t count = (bufferLength + size - 1) / size;
+    if (count > TTN_MAX_FRAGMENTS)
+    {
+        ttn_hal.leaveCriticalSection();
+        ESP_LOGW(TAG, "Buffer too large for current data rate (%d fragments)", count);
+        return false;
+    }
+
+    data = buffer;
+    length = bufferLength;
+    port = txPort;
+    transferId++;
+    fragmentSize = size;
+    numFragments = count;
+    nextFragment = 0;
+    fragmentQueued = false; // a fragment of a cancelled transfer may still be queued
+    memset(pending, 0, sizeof(pending));
+    for (int i = 0; i < numFragments; i++)
+        pending[i / 8] |= 1 << (i % 8);
+    active = true;
+    waitingForRequest = false;
+    resendWindow = window;
+    callback = cb;
+    userData = cbUserData;
+
+    queueNext();
+
+    ttn_hal.leaveCriticalSection();
+    return true;
+}
+
+// Ends the transfer, reporting it as failed
+void TTNFragmenter::cancel()
+{
+    ttn_hal.enterCriticalSection();
+    if (active)
+        finish(kTTNErrorTransmissionFailed);
+    ttn_hal.leaveCriticalSection();
+}
+
+// Processes a resend request or acknowledgement. Called in the LMIC task.
+// Returns true if the downlink belongs to the active transfer.
+bool TTNFragmenter::handleDownlink(port_t rxPort, const uint8_t* payload, size_t payloadLength)
+{
+    ttn_hal.enterCriticalSection();
+
+    if (!active || rxPort != port || payloadLength < 1 || payload[0] != transferId)
+    {
+        ttn_hal.leaveCriticalSection();
+        return false;
+    }
+
+    bool anyMissing = false;
+    for (int i = 0; i < numFragments && 1 + i / 8 < (int)payloadLength; i++)
+    {
+        if ((payload[1 + i / 8] & (1 << (i % 8))) != 0)
+        {
+            pending[i / 8] |= 1 << (i % 8);
+            anyMissing = true;
+        }
+    }
+
+    if (!anyMissing)
+    {
+        finish(kTTNSuccessfulTransmission);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Resend of fragments requested");
+        nextFragment = 0;
+        waitingForRequest = false;
+        os_clearCallback(&timer);
+        if (!fragmentQueued)
+            queueNext();
+    }
+
+    ttn_hal.leaveCriticalSection();
+    return true;
+}
+
+// Queues the next pending fragment, or starts the resend window if there is none.
+// Must be called with the critical section entered.
+void TTNFragmenter::queueNext()
+{
+    int index = nextFragment;
+    while (index < numFragments && (pending[index / 8] & (1 << (index % 8))) == 0)
+        index++;
+
+    if (index == numFragments)
+    {
+        // pass completed
+        if (resendWindow == 0)
+        {
+            finish(kTTNSuccessfulTransmission);
+            return;
+        }
+        waitingForRequest = true;
+        os_setTimedCallback(&timer, os_getTime() + ms2osticks(resendWindow), job);
+        ttn_hal.wakeUp();
+        return;
+    }
+
+    size_t offset = (size_t)index * fragmentSize;
+    size_t size = length - offset < fragmentSize ? length - offset : fragmentSize;
+
+    if (!fragmentFits(TTN_FRAGMENT_HEADER_SIZE + size))
+    {
+        finish(kTTNErrorPayloadTooLarge);
+        return;
+    }
+
+    uint8_t frame[MAX_LEN_PAYLOAD];
+    frame[0] = transferId;
+    frame[1] = index;
+    frame[2] = numFragments;
+    memcpy(frame + TTN_FRAGMENT_HEADER_SIZE, data + offset, size);
+
+    // the transfer ID is passed as user data so completions of cancelled transfers can be told apart
+    void* tag = reinterpret_cast<void*>(static_cast<uintptr_t>(transferId));
+    if (!ttn_tx_queue.enqueue(frame, TTN_FRAGMENT_HEADER_SIZE + size, port, false, fragmentTransmitted, tag, kTTNPriorityNormal))
+    {
+        os_setTimedCallback(&timer, os_getTime() + ms2osticks(RETRY_DELAY_MS), job);
+        ttn_hal.wakeUp();
+        return;
+    }
+
+    pending[index / 8] &= ~(1 << (index % 8));
+    nextFragment = index + 1;
+    fragmentQueued = true;
+    queuedLength = TTN_FRAGMENT_HEADER_SIZE + size;
+}
+
+// Checks if a fragment fits the maximum payload of the current data rate.
+// Must be called with the critical section entered.
+bool TTNFragmenter::fragmentFits(size_t fragmentLength)
+{
+    size_t maxPayload = LMIC_maxPayloadForDataRate(LMIC.datarate);
+    if (fragmentLength <= maxPayload)
+        return true;
+
+    ESP_LOGW(TAG, "Fragment (%d bytes) exceeds maximum payload of current data rate (%d bytes)",
+        fragmentLength, maxPayload);
+    return false;
+}
+
+// Reports the outcome and forgets the buffer.
+// Must be called with the critical section entered.
+void TTNFragmenter::finish(TTNResponseCode result)
+{
+    os_clearCallback(&timer);
+    active = false;
+    waitingForRequest = false;
+    data = nullptr;
+
+    TTNTransmitCallback cb = callback;
+    callback = nullptr;
+    if (cb != nullptr)
+        cb(result, userData);
+}
+
+// Called by the transmit queue in the LMIC task when a fragment has been transmitted
+void TTNFragmenter::fragmentTransmitted(TTNResponseCode result, void* userData)
+{
+    uint8_t id = static_cast<uint8_t>(reinterpret_cast<uintptr_t>(userData));
+
+    ttn_hal.enterCriticalSection();
+    if (id != ttn_fragmenter.transferId)
+    {
+        // fragment of a cancelled transfer
+        ttn_hal.leaveCriticalSection();
+        return;
+    }
+
+    ttn_fragmenter.fragmentQueued = false;
+    if (ttn_fragmenter.active)
+    {
+        if (result == kTTNSuccessfulTransmission)
+            ttn_fragmenter.queueNext();
+        else if (!ttn_fragmenter.fragmentFits(ttn_fragmenter.queuedLength))
+            ttn_fragmenter.finish(kTTNErrorPayloadTooLarge); // data rate lowered after the fragment was queued
+        else
+            ttn_fragmenter.finish(kTTNErrorTransmissionFailed);
+    }
+    ttn_hal.leaveCriticalSection();
+}
+
+// Called in the LMIC task when the resend window has expired
+// or to retry queuing a fragment
+void TTNFragmenter::job(osjob_t* job)
+{
+    ttn_hal.enterCriticalSection();
+    if (ttn_fragmenter.active)
+    {
+        if (ttn_fragmenter.waitingForRequest)
+            ttn_fragmenter.finish(kTTNSuccessfulTransmission);
+        else if (!ttn_fragmenter.fragmentQueued)
+            ttn_fragmenter.queueNext();
+    }
+    ttn_hal.leaveCriticalSection();
+}
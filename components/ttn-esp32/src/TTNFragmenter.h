@@ -0,0 +1,75 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Fragmentation of buffers larger than a single frame.
+ *******************************************************************************/
+
+#ifndef _ttnfragmenter_h_
+#define _ttnfragmenter_h_
+
+#include "lmic/lmic.h"
+#include "TheThingsNetwork.h"
+#include "TTNFragmentReassembler.h"
+
+
+/**
+ * @brief Sends a buffer as a sequence of fragments.
+ *
+ * The fragment size is the maximum payload of the data rate at the start
+ * of the transfer, so resent fragments are identical to the original ones.
+ * If the data rate drops below it, the transfer fails fast with
+ * kTTNErrorPayloadTooLarge instead of queuing a fragment LMIC would reject.
+ * Only one fragment at a time is in the transmit queue; the next one is
+ * queued by the LMIC task when the previous one has been transmitted.
+ *
+ * A bitmap tracks the fragments still to be sent. It is initially full and
+ * is refilled from resend requests received on the transfer's port. After
+ * a pass, the transfer stays open for the resend window.
+ *
+ * This class is not to be used directly.
+ */
+class TTNFragmenter
+{
+public:
+    TTNFragmenter();
+
+    bool start(const uint8_t* data, size_t length, port_t port, uint32_t resendWindow,
+        TTNTransmitCallback callback, void* userData);
+    void cancel();
+    bool handleDownlink(port_t port, const uint8_t* payload, size_t length);
+
+private:
+    static void fragmentTransmitted(TTNResponseCode result, void* userData);
+    static void job(osjob_t* job);
+
+    void queueNext();
+    void finish(TTNResponseCode result);
+    bool fragmentFits(size_t fragmentLength);
+
+    const uint8_t* data;
+    size_t length;
+    port_t port;
+    uint8_t transferId;
+    uint8_t fragmentSize;
+    uint8_t numFragments;
+    uint8_t nextFragment;
+    uint8_t pending[(TTN_MAX_FRAGMENTS + 7) / 8]; // fragments still to be sent
+    bool active;
+    bool fragmentQueued;
+    uint8_t queuedLength; // frame length of the fragment in the transmit queue
+    bool waitingForRequest;
+    uint32_t resendWindow;
+    TTNTransmitCallback callback;
+    void* userData;
+    osjob_t timer;
+};
+
+extern TTNFragmenter ttn_fragmenter;
+
+#endif
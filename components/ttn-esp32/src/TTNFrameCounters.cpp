@@ -0,0 +1,162 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Wear-limited persistence of the frame counters in NVS.
+ *******************************************************************************/
+
+#include <string.h>
+#include <stddef.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "TTNFrameCounters.h"
+
+
+static const char *TAG = "ttn_fcnt";
+static const char* const NVS_FLASH_PARTITION = "ttn";
+static const char* const NVS_FLASH_KEY_SLOTS[2] = { "fcnt0", "fcnt1" };
+
+TTNFrameCounters ttn_frame_counters;
+
+
+TTNFrameCounters::TTNFrameCounters()
+    : generation(0), committedDevaddr(0), committedSeqnoUp(0), numWrites(0), maxWriteTime(0)
+{
+}
+
+// Called in the LMIC task when a new session has been joined
+void TTNFrameCounters::joined()
+{
+    commit();
+}
+
+// Called in the LMIC task when a transmission has completed
+void TTNFrameCounters::transmitted()
+{
+    if (LMIC.devaddr == 0)
+        return;
+
+    if (LMIC.devaddr != committedDevaddr || LMIC.seqnoUp - committedSeqnoUp >= CONFIG_TTN_FCNT_COMMIT_INTERVAL)
+        commit();
+}
+
+// Loads the last committed record after a session has been restored.
+// If the session has been restored from NVS, its counters are outdated:
+// they are advanced beyond any value that might have been used since.
+void TTNFrameCounters::restore(bool jumpAhead)
+{
+    Record records[2];
+    bool valid[2] = { readSlot(0, &records[0]), readSlot(1, &records[1]) };
+
+    const Record* latest = nullptr;
+    if (valid[0] && valid[1])
+        latest = (int32_t)(records[1].generation - records[0].generation) > 0 ? &records[1] : &records[0];
+    else if (valid[0])
+        latest = &records[0];
+    else if (valid[1])
+        latest = &records[1];
+
+    if (latest == nullptr || latest->devaddr != LMIC.devaddr)
+    {
+        commit();
+        return;
+    }
+
+    generation = latest->generation;
+    committedDevaddr = latest->devaddr;
+    committedSeqnoUp = latest->seqnoUp;
+
+    if (!jumpAhead)
+        return;
+
+    uint32_t seqnoUp = latest->seqnoUp + CONFIG_TTN_FCNT_COMMIT_INTERVAL;
+    if ((int32_t)(seqnoUp - LMIC.seqnoUp) > 0)
+        LMIC.seqnoUp = seqnoUp;
+    if ((int32_t)(latest->seqnoDn - LMIC.seqnoDn) > 0)
+        LMIC.seqnoDn = latest->seqnoDn;
+    ESP_LOGI(TAG, "Frame counters restored (up: %u, down: %u)", LMIC.seqnoUp, LMIC.seqnoDn);
+
+    // commit right away so a second power loss does not reuse the same values
+    commit();
+}
+
+void TTNFrameCounters::getStats(uint32_t* writes, uint32_t* maxTime)
+{
+    *writes = numWrites;
+    *maxTime = maxWriteTime;
+}
+
+// Writes the current counters to the slot not holding the latest record
+bool TTNFrameCounters::commit()
+{
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.generation = generation + 1;
+    record.devaddr = LMIC.devaddr;
+    record.seqnoUp = LMIC.seqnoUp;
+    record.seqnoDn = LMIC.seqnoDn;
+    record.checksum = calculateChecksum(&record);
+
+    int64_t start = esp_timer_get_time();
+
+    nvs_handle handle = 0;
+    esp_err_t res = nvs_open(NVS_FLASH_PARTITION, NVS_READWRITE, &handle);
+    if (res != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to open NVS storage (error %d)", res);
+        return false;
+    }
+
+    res = nvs_set_blob(handle, NVS_FLASH_KEY_SLOTS[record.generation % 2], &record, sizeof(record));
+    if (res == ESP_OK)
+        res = nvs_commit(handle);
+    nvs_close(handle);
+
+    if (res != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to save frame counters (error %d)", res);
+        return false;
+    }
+
+    uint32_t duration = (uint32_t)(esp_timer_get_time() - start);
+    numWrites++;
+    if (duration > maxWriteTime)
+        maxWriteTime = duration;
+
+    generation = record.generation;
+    committedDevaddr = record.devaddr;
+    committedSeqnoUp = record.seqnoUp;
+    return true;
+}
+
+bool TTNFrameCounters::readSlot(int slot, Record* record)
+{
+    nvs_handle handle = 0;
+    if (nvs_open(NVS_FLASH_PARTITION, NVS_READONLY, &handle) != ESP_OK)
+        return false;
+
+    size_t size = sizeof(Record);
+    esp_err_t res = nvs_get_blob(handle, NVS_FLASH_KEY_SLOTS[slot], record, &size);
+    nvs_close(handle);
+
+    return res == ESP_OK && size == sizeof(Record) && record->checksum == calculateChecksum(record);
+}
+
+// FNV-1a hash over all fields except the checksum
+uint32_t TTNFrameCounters::calculateChecksum(const Record* record)
+{
+    const uint8_t* p = (const uint8_t*)record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(Record, checksum); i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,69 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Wear-limited persistence of the frame counters in NVS.
+ *******************************************************************************/
+
+#ifndef _ttnframecounters_h_
+#define _ttnframecounters_h_
+
+#include "lmic/lmic.h"
+
+
+/**
+ * @brief Persists the frame counters of the active session.
+ *
+ * The uplink counter is committed to NVS each time it has advanced by
+ * CONFIG_TTN_FCNT_COMMIT_INTERVAL frames. After a power loss, it is
+ * restored with the interval added so no counter value is reused.
+ * The downlink counter is restored as committed, so downlinks sent
+ * after the last commit are accepted once more.
+ *
+ * Records alternate between two NVS slots. Each record carries a
+ * generation number and a checksum, so if a write is interrupted, the
+ * other slot still holds a valid record.
+ *
+ * All functions must be called with the critical section entered.
+ *
+ * This class is not to be used directly.
+ */
+class TTNFrameCounters
+{
+public:
+    TTNFrameCounters();
+
+    void joined();
+    void transmitted();
+    void restore(bool jumpAhead);
+    void getStats(uint32_t* writes, uint32_t* maxWriteTime);
+
+private:
+    struct Record
+    {
+        uint32_t generation;
+        devaddr_t devaddr;
+        uint32_t seqnoUp;
+        uint32_t seqnoDn;
+        uint32_t checksum;
+    };
+
+    bool commit();
+    bool readSlot(int slot, Record* record);
+    static uint32_t calculateChecksum(const Record* record);
+
+    uint32_t generation;
+    devaddr_t committedDevaddr;
+    uint32_t committedSeqnoUp;
+    uint32_t numWrites;
+    uint32_t maxWriteTime;
+};
+
+extern TTNFrameCounters ttn_frame_counters;
+
+#endif
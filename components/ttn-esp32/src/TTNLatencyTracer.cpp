@@ -0,0 +1,180 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Latency tracing of uplinks.
+ *******************************************************************************/
+
+#include <string.h>
+#include "esp_timer.h"
+#include "hal/hal_esp32.h"
+#include "TTNLatencyTracer.h"
+
+
+TTNLatencyTracer ttn_latency_tracer;
+
+
+TTNLatencyTracer::TTNLatencyTracer()
+    : active(false), hasLast(false)
+{
+    memset(&current, 0, sizeof(current));
+    memset(&last, 0, sizeof(last));
+    memset(histograms, 0, sizeof(histograms));
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    lock = unlocked;
+}
+
+// Starts the trace of a message submitted to LMIC. Called in the LMIC task.
+// A trace still in progress (e.g. of a preempted message) is discarded.
+void TTNLatencyTracer::submitted(int64_t queuedAt)
+{
+    memset(&current, 0, sizeof(current));
+    current.queued = queuedAt;
+    current.submitted = esp_timer_get_time();
+    active = true;
+}
+
+// Called in the LMIC task when a frame is handed to the radio (EV_TXSTART)
+void TTNLatencyTracer::transmissionStarted()
+{
+    if (!active)
+        return;
+
+    // a retransmission restarts the radio stages
+    current.txStart = esp_timer_get_time();
+    current.txDone = 0;
+    current.rx1Open = 0;
+    current.rx1Close = 0;
+    current.rx2Open = 0;
+    current.rx2Close = 0;
+    current.transmissions++;
+}
+
+// Called in the LMIC task when a receive window is opened (EV_RXSTART).
+// Must return quickly as the window is about to start.
+void TTNLatencyTracer::windowOpened()
+{
+    if (!active || current.txStart == 0 || (LMIC.opmode & OP_TXRXPEND) == 0)
+        return;
+
+    int64_t now = esp_timer_get_time();
+    if (current.txDone == 0)
+        current.txDone = toEspTime(LMIC.txend);
+
+    if ((LMIC.txrxFlags & TXRX_DNW2) != 0)
+    {
+        // RX1 was closed by the interrupt that ended it
+        if (current.rx1Open != 0)
+            current.rx1Close = toEspTime(ttn_hal.lastDioInterruptTime());
+        current.rx2Open = now;
+    }
+    else
+    {
+        current.rx1Open = now;
+    }
+}
+
+// Completes and publishes the trace. Called in the LMIC task
+// just before the completion callback of the message.
+void TTNLatencyTracer::completed(bool success)
+{
+    if (!active)
+        return;
+
+    current.completed = esp_timer_get_time();
+    current.success = success;
+    active = false;
+
+    // the last window was closed by the interrupt that ended it
+    int64_t irqTime = toEspTime(ttn_hal.lastDioInterruptTime());
+    if (current.rx2Open != 0 && irqTime >= current.rx2Open)
+        current.rx2Close = irqTime;
+    else if (current.rx1Open != 0 && current.rx2Open == 0 && irqTime >= current.rx1Open)
+        current.rx1Close = irqTime;
+
+    int64_t lastClose = current.rx2Close != 0 ? current.rx2Close : current.rx1Close;
+
+    portENTER_CRITICAL(&lock);
+    last = current;
+    hasLast = true;
+    addSample(kTTNStageQueue, current.queued, current.submitted);
+    addSample(kTTNStageSchedule, current.submitted, current.txStart);
+    addSample(kTTNStageAirtime, current.txStart, current.txDone);
+    addSample(kTTNStageReceive, current.txDone, lastClose);
+    addSample(kTTNStageDispatch, lastClose, current.completed);
+    addSample(kTTNStageTotal, current.queued, current.completed);
+    portEXIT_CRITICAL(&lock);
+}
+
+// Discards the trace in progress, e.g. if LMIC rejected the message
+void TTNLatencyTracer::cancel()
+{
+    active = false;
+}
+
+bool TTNLatencyTracer::getLastTrace(TTNUplinkTrace* trace)
+{
+    portENTER_CRITICAL(&lock);
+    bool valid = hasLast;
+    *trace = last;
+    portEXIT_CRITICAL(&lock);
+    return valid;
+}
+
+bool TTNLatencyTracer::getHistogram(TTNLatencyStage stage, TTNLatencyHistogram* histogram)
+{
+    if (stage < 0 || stage >= TTN_LATENCY_STAGES)
+        return false;
+
+    portENTER_CRITICAL(&lock);
+    *histogram = histograms[stage];
+    portEXIT_CRITICAL(&lock);
+    return true;
+}
+
+void TTNLatencyTracer::resetHistograms()
+{
+    portENTER_CRITICAL(&lock);
+    memset(histograms, 0, sizeof(histograms));
+    portEXIT_CRITICAL(&lock);
+}
+
+// Adds the duration of a stage to its histogram unless the stage did not occur.
+// Must be called with the spinlock held.
+void TTNLatencyTracer::addSample(TTNLatencyStage stage, int64_t start, int64_t end)
+{
+    if (start == 0 || end == 0 || end < start)
+        return;
+
+    int64_t duration = end - start;
+    uint32_t value = duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration;
+
+    TTNLatencyHistogram* histogram = &histograms[stage];
+    if (histogram->count == 0 || value < histogram->min)
+        histogram->min = value;
+    if (value > histogram->max)
+        histogram->max = value;
+    histogram->count++;
+    histogram->total += value;
+
+    // bucket 0: below 1 ms; bucket i: 2^(i-1) ms to 2^i ms
+    uint32_t ms = value / 1000;
+    int bucket = 0;
+    while (ms > 0 && bucket < TTN_LATENCY_HISTOGRAM_BUCKETS - 1)
+    {
+        ms >>= 1;
+        bucket++;
+    }
+    histogram->buckets[bucket]++;
+}
+
+// Converts a recent LMIC time to esp_timer time
+int64_t TTNLatencyTracer::toEspTime(ostime_t time)
+{
+    return esp_timer_get_time() - osticks2us(os_getTime() - time);
+}
@@ -0,0 +1,61 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Latency tracing of uplinks.
+ *******************************************************************************/
+
+#ifndef _ttnlatencytracer_h_
+#define _ttnlatencytracer_h_
+
+#include "freertos/FreeRTOS.h"
+#include "lmic/lmic.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Traces the stages of the uplink submitted by the transmit queue.
+ *
+ * Only one uplink is in flight at a time. Its trace is built by the
+ * LMIC task from the queue, the LMIC events and the radio interrupt
+ * times. When it has completed, the trace is published and the stage
+ * durations are added to the histograms. Both are protected by a
+ * spinlock so they can be read from any task.
+ *
+ * This class is not to be used directly.
+ */
+class TTNLatencyTracer
+{
+public:
+    TTNLatencyTracer();
+
+    void submitted(int64_t queuedAt);
+    void transmissionStarted();
+    void windowOpened();
+    void completed(bool success);
+    void cancel();
+
+    bool getLastTrace(TTNUplinkTrace* trace);
+    bool getHistogram(TTNLatencyStage stage, TTNLatencyHistogram* histogram);
+    void resetHistograms();
+
+private:
+    void addSample(TTNLatencyStage stage, int64_t start, int64_t end);
+    static int64_t toEspTime(ostime_t time);
+
+    TTNUplinkTrace current;
+    bool active;
+    TTNUplinkTrace last;
+    bool hasLast;
+    TTNLatencyHistogram histograms[TTN_LATENCY_STAGES];
+    portMUX_TYPE lock;
+};
+
+extern TTNLatencyTracer ttn_latency_tracer;
+
+#endif
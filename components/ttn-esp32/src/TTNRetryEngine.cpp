@@ -0,0 +1,186 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Retry policy for confirmed messages.
+ *******************************************************************************/
+
+#include <string.h>
+#include "esp_log.h"
+#include "hal/hal_esp32.h"
+#include "TTNAirtime.h"
+#include "TTNRetryEngine.h"
+#include "TTNTxQueue.h"
+
+
+// Delay before retrying to queue a message if the transmit queue is full
+#define QUEUE_RETRY_DELAY_MS 1000
+// Longest delay between retransmissions (keeps the delay in LMIC ticks in range)
+#define MAX_RETRY_DELAY_MS 3600000
+
+static const char *TAG = "ttn_retry";
+
+TTNRetryEngine ttn_retry_engine;
+
+
+TTNRetryEngine::TTNRetryEngine()
+{
+    for (int i = 0; i < CONFIG_TTN_TX_QUEUE_SIZE; i++)
+        messages[i].inUse = false;
+}
+
+// Accepts a confirmed message. Called by application tasks.
+bool TTNRetryEngine::send(const uint8_t* payload, size_t length, port_t port, const TTNRetryPolicy& policy,
+    TTNRetryCallback callback, void* userData)
+{
+    if (length > MAX_LEN_PAYLOAD || policy.maxAttempts == 0)
+        return false;
+
+    ttn_hal.enterCriticalSection();
+
+    TTNRetryMessage* message = nullptr;
+    for (int i = 0; i < CONFIG_TTN_TX_QUEUE_SIZE; i++)
+    {
+        if (!messages[i].inUse)
+        {
+            message = &messages[i];
+            break;
+        }
+    }
+
+    if (message == nullptr)
+    {
+        ttn_hal.leaveCriticalSection();
+        ESP_LOGW(TAG, "Too many confirmed messages in progress");
+        return false;
+    }
+
+    message->inUse = true;
+    memcpy(message->payload, payload, length);
+    message->length = length;
+    message->port = port;
+    message->policy = policy;
+    memset(&message->result, 0, sizeof(message->result));
+    message->backoff = policy.initialBackoff;
+    message->budgetLimited = false;
+    message->dataRateFallback = false;
+    message->callback = callback;
+    message->userData = userData;
+
+    queue(message);
+
+    ttn_hal.leaveCriticalSection();
+    return true;
+}
+
+// Queues the message unless its first transmission would exceed the airtime budget.
+// Must be called with the critical section entered.
+void TTNRetryEngine::queue(TTNRetryMessage* message)
+{
+    uint32_t budget = message->policy.airtimeBudget;
+    if (budget != 0 && ttn_airtime.timeOnAir(message->length, LMIC.datarate) > budget)
+    {
+        message->result.budgetExhausted = true;
+        complete(message, false);
+        return;
+    }
+
+    // LMIC retransmits the frame (with the same frame counter) up to maxAttempts times
+    if (!ttn_tx_queue.enqueue(message->payload, message->length, message->port, true,
+        transmitted, message, kTTNPriorityNormal, message->policy.maxAttempts))
+    {
+        os_setTimedCallback(&message->job, os_getTime() + ms2osticks(QUEUE_RETRY_DELAY_MS), queueJob);
+        ttn_hal.wakeUp();
+        return;
+    }
+}
+
+// Called in the LMIC task when a transmission starts (EV_TXSTART).
+// Records the airtime and data rate actually used, and prepares LMIC's
+// next retransmission according to the policy.
+void TTNRetryEngine::transmissionStarted()
+{
+    ttn_hal.enterCriticalSection();
+    TTNRetryMessage* message = static_cast<TTNRetryMessage*>(ttn_tx_queue.inFlightMessage(transmitted));
+    if (message == nullptr || !message->inUse)
+    {
+        ttn_hal.leaveCriticalSection();
+        return;
+    }
+
+    if (message->result.attempts == 0)
+    {
+        // with ADR, the data rate is up to the network
+        message->dataRateFallback = message->policy.dataRateFallback && !LMIC.adrEnabled;
+        message->savedDataRate = LMIC.datarate;
+    }
+
+    uint32_t airtime = ttn_airtime.timeOnAir(message->length, LMIC.datarate);
+    message->result.attempts++;
+    message->result.airtime += airtime;
+    message->result.dataRate = LMIC.datarate;
+
+    // the next retransmission takes at least as long (the data rate never increases)
+    uint32_t budget = message->policy.airtimeBudget;
+    if (budget != 0 && message->result.airtime + airtime > budget
+        && message->result.attempts < message->policy.maxAttempts)
+    {
+        LMIC.txConfAttempts = LMIC.txCnt;
+        message->budgetLimited = true;
+    }
+
+    LMIC.txConfNoDrFallback = message->dataRateFallback ? 0 : 1;
+    uint32_t delay = message->backoff > MAX_RETRY_DELAY_MS ? MAX_RETRY_DELAY_MS : message->backoff;
+    LMIC.txConfRetryDelay = ms2osticks(delay);
+
+    uint64_t backoff = (uint64_t)message->backoff * message->policy.backoffMultiplier;
+    message->backoff = backoff > message->policy.maxBackoff ? message->policy.maxBackoff : (uint32_t)backoff;
+
+    ttn_hal.leaveCriticalSection();
+}
+
+// Reports the outcome and frees the slot.
+// Must be called with the critical section entered.
+void TTNRetryEngine::complete(TTNRetryMessage* message, bool success)
+{
+    message->result.result = success ? kTTNSuccessfulTransmission : kTTNErrorTransmissionFailed;
+    if (!success && message->budgetLimited)
+        message->result.budgetExhausted = true;
+    message->inUse = false;
+
+    if (message->dataRateFallback && !LMIC.adrEnabled && LMIC.datarate != message->savedDataRate)
+        LMIC_setDrTxpow(message->savedDataRate, KEEP_TXPOW);
+
+    if (message->callback != nullptr)
+        message->callback(&message->result, message->userData);
+}
+
+// Called by the transmit queue in the LMIC task when the message
+// has been acknowledged or all retransmissions have failed
+void TTNRetryEngine::transmitted(TTNResponseCode result, void* userData)
+{
+    TTNRetryMessage* message = static_cast<TTNRetryMessage*>(userData);
+
+    ttn_hal.enterCriticalSection();
+    if (message->inUse)
+        ttn_retry_engine.complete(message, result == kTTNSuccessfulTransmission);
+    ttn_hal.leaveCriticalSection();
+}
+
+// Called in the LMIC task to retry queuing a message when the transmit queue was full
+void TTNRetryEngine::queueJob(osjob_t* job)
+{
+    ttn_hal.enterCriticalSection();
+    for (int i = 0; i < CONFIG_TTN_TX_QUEUE_SIZE; i++)
+    {
+        TTNRetryMessage* message = &ttn_retry_engine.messages[i];
+        if (message->inUse && &message->job == job)
+            ttn_retry_engine.queue(message);
+    }
+    ttn_hal.leaveCriticalSection();
+}
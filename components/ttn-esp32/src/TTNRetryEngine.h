@@ -0,0 +1,80 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Retry policy for confirmed messages.
+ *******************************************************************************/
+
+#ifndef _ttnretryengine_h_
+#define _ttnretryengine_h_
+
+#include "lmic/lmic.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Confirmed message in progress
+ */
+struct TTNRetryMessage
+{
+    bool inUse;
+    uint8_t payload[MAX_LEN_PAYLOAD];
+    uint8_t length;
+    port_t port;
+    TTNRetryPolicy policy;
+    TTNRetryResult result;
+    uint32_t backoff; // in ms
+    bool budgetLimited; // LMIC's retransmissions were cut short for the airtime budget
+    bool dataRateFallback; // LMIC may lower the data rate for the retransmissions
+    uint8_t savedDataRate; // data rate of the first transmission
+    TTNRetryCallback callback;
+    void* userData;
+    osjob_t job;
+};
+
+
+/**
+ * @brief Retries confirmed messages according to a policy.
+ *
+ * The message is queued once as a confirmed message, and the attempts
+ * are LMIC's retransmissions, so they all carry the same frame counter
+ * and the network does not see duplicates. The policy is applied at
+ * the start of each transmission (EV_TXSTART): the airtime and data rate
+ * are recorded, and the delay of the next retransmission is set, or the
+ * retransmissions are cut short if the next one would exceed the budget.
+ *
+ * LMIC lowers the data rate for every second retransmission, for the
+ * whole device. This is disabled unless the policy asks for it and ADR
+ * is off, and the data rate is restored when the message has completed.
+ *
+ * There are CONFIG_TTN_TX_QUEUE_SIZE slots for messages in progress.
+ *
+ * This class is not to be used directly.
+ */
+class TTNRetryEngine
+{
+public:
+    TTNRetryEngine();
+
+    bool send(const uint8_t* payload, size_t length, port_t port, const TTNRetryPolicy& policy,
+        TTNRetryCallback callback, void* userData);
+    void transmissionStarted();
+
+private:
+    static void transmitted(TTNResponseCode result, void* userData);
+    static void queueJob(osjob_t* job);
+
+    void queue(TTNRetryMessage* message);
+    void complete(TTNRetryMessage* message, bool success);
+
+    TTNRetryMessage messages[CONFIG_TTN_TX_QUEUE_SIZE];
+};
+
+extern TTNRetryEngine ttn_retry_engine;
+
+#endif
@@ -0,0 +1,258 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Persistence of the active session across deep sleep and restarts.
+ *******************************************************************************/
+
+#include <string.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "hal/hal_esp32.h"
+#include "lmic/lmic_bandplan.h"
+#include "TTNFrameCounters.h"
+#include "TTNSession.h"
+
+
+#define SESSION_MAGIC 0x54544e53 // "TTNS"
+
+static const char *TAG = "ttn_session";
+static const char* const NVS_FLASH_PARTITION = "ttn";
+static const char* const NVS_FLASH_KEY_SESSION = "session";
+
+static RTC_NOINIT_ATTR TTNSessionData rtcSession;
+
+TTNSession ttn_session;
+
+
+// Updates the snapshot in RTC memory.
+// Called in the LMIC task after a join and at the start and end of each transmission.
+bool TTNSession::save()
+{
+    ttn_hal.enterCriticalSection();
+    bool haveSession = LMIC.devaddr != 0;
+    if (haveSession)
+        capture(&rtcSession);
+    ttn_hal.leaveCriticalSection();
+    return haveSession;
+}
+
+// Writes the current session to NVS (and updates the RTC snapshot)
+bool TTNSession::saveToNvs()
+{
+    ttn_hal.enterCriticalSection();
+    if (LMIC.devaddr == 0)
+    {
+        ttn_hal.leaveCriticalSection();
+        ESP_LOGW(TAG, "No active session to save");
+        return false;
+    }
+    capture(&rtcSession);
+    TTNSessionData data = rtcSession;
+    ttn_hal.leaveCriticalSection();
+
+    nvs_handle handle = 0;
+    esp_err_t res = nvs_open(NVS_FLASH_PARTITION, NVS_READWRITE, &handle);
+    if (res == ESP_ERR_NVS_NOT_INITIALIZED)
+    {
+        ESP_LOGW(TAG, "NVS storage is not initialized. Call 'nvs_flash_init()' first.");
+        return false;
+    }
+    ESP_ERROR_CHECK(res);
+
+    bool result = false;
+    res = nvs_set_blob(handle, NVS_FLASH_KEY_SESSION, &data, sizeof(data));
+    if (res == ESP_OK)
+        res = nvs_commit(handle);
+    if (res == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Session saved in NVS storage");
+        result = true;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Failed to save session in NVS storage (error %d)", res);
+    }
+
+    nvs_close(handle);
+    return result;
+}
+
+// Restores the session from RTC memory or, if it is not valid, from NVS.
+// The device keys must have been restored or decoded before.
+bool TTNSession::restore()
+{
+    TTNSessionData data;
+    bool fromRtc = isValid(&rtcSession);
+    if (fromRtc)
+    {
+        data = rtcSession;
+        ESP_LOGI(TAG, "Session restored from RTC memory");
+    }
+    else if (readNvs(&data) && isValid(&data))
+    {
+        ESP_LOGI(TAG, "Session restored from NVS storage");
+    }
+    else
+    {
+        return false;
+    }
+
+    ttn_hal.enterCriticalSection();
+    apply(&data);
+    // the frame counters of the NVS copy are outdated
+    ttn_frame_counters.restore(!fromRtc);
+    capture(&rtcSession);
+    ttn_hal.leaveCriticalSection();
+    return true;
+}
+
+// Invalidates the RTC snapshot and removes the NVS copy
+void TTNSession::clear()
+{
+    ttn_hal.enterCriticalSection();
+    rtcSession.magic = 0;
+    ttn_hal.leaveCriticalSection();
+
+    nvs_handle handle = 0;
+    if (nvs_open(NVS_FLASH_PARTITION, NVS_READWRITE, &handle) != ESP_OK)
+        return;
+    if (nvs_erase_key(handle, NVS_FLASH_KEY_SESSION) == ESP_OK)
+        nvs_commit(handle);
+    nvs_close(handle);
+}
+
+// Copies the session from LMIC. Must be called with the critical section entered.
+void TTNSession::capture(TTNSessionData* data)
+{
+    memset(data, 0, sizeof(TTNSessionData));
+    ostime_t now = os_getTime();
+
+    data->magic = SESSION_MAGIC;
+    os_getDevEui(data->devEui);
+    LMIC_getSessionKeys(&data->netid, &data->devaddr, data->nwkKey, data->artKey);
+    data->seqnoUp = LMIC.seqnoUp;
+    data->seqnoDn = LMIC.seqnoDn;
+    LMICbandplan_saveAdrState(&data->adrState);
+
+#if CFG_LMIC_EU_like
+    memcpy(data->channelDrMap, LMIC.channelDrMap, sizeof(data->channelDrMap));
+#if !defined(DISABLE_MCMD_DlChannelReq)
+    memcpy(data->channelDlFreq, LMIC.channelDlFreq, sizeof(data->channelDlFreq));
+#endif
+    for (int i = 0; i < MAX_BANDS; i++)
+    {
+        data->bands[i] = LMIC.bands[i];
+        ostime_t wait = LMIC.bands[i].avail - now;
+        data->bands[i].avail = wait > 0 ? wait : 0;
+    }
+#endif
+
+    ostime_t globalWait = LMIC.globalDutyAvail - now;
+    data->globalDutyWait = globalWait > 0 ? globalWait : 0;
+    data->globalDutyRate = LMIC.globalDutyRate;
+
+    data->datarate = LMIC.datarate;
+    data->adrTxPow = LMIC.adrTxPow;
+    data->rx1DrOffset = LMIC.rx1DrOffset;
+    data->dn2Dr = LMIC.dn2Dr;
+    data->dn2Freq = LMIC.dn2Freq;
+    data->rxDelay = LMIC.rxDelay;
+
+    data->savedAt = currentTime();
+    data->checksum = calculateChecksum(data);
+}
+
+// Sets up LMIC with the saved session. Must be called with the critical section entered.
+void TTNSession::apply(const TTNSessionData* data)
+{
+    // LMIC_setSession() resets the channels and the counters
+    LMIC_setSession(data->netid, data->devaddr, (xref2u1_t)data->nwkKey, (xref2u1_t)data->artKey);
+    LMIC.seqnoUp = data->seqnoUp;
+    LMIC.seqnoDn = data->seqnoDn;
+    LMICbandplan_restoreAdrState(&data->adrState);
+
+    // the duty-cycle ledger continues to run down while the device is off
+    int64_t elapsed = currentTime() - data->savedAt;
+    if (elapsed < 0)
+        elapsed = 0; // clock has been reset by a power loss; assume no time has passed
+    int64_t elapsedTicks = elapsed / US_PER_OSTICK;
+    ostime_t now = os_getTime();
+
+#if CFG_LMIC_EU_like
+    memcpy(LMIC.channelDrMap, data->channelDrMap, sizeof(LMIC.channelDrMap));
+#if !defined(DISABLE_MCMD_DlChannelReq)
+    memcpy(LMIC.channelDlFreq, data->channelDlFreq, sizeof(LMIC.channelDlFreq));
+#endif
+    for (int i = 0; i < MAX_BANDS; i++)
+    {
+        LMIC.bands[i] = data->bands[i];
+        LMIC.bands[i].avail = now + (data->bands[i].avail > elapsedTicks ? (ostime_t)(data->bands[i].avail - elapsedTicks) : 0);
+    }
+#endif
+
+    LMIC.globalDutyAvail = now + (data->globalDutyWait > elapsedTicks ? (ostime_t)(data->globalDutyWait - elapsedTicks) : 0);
+    LMIC.globalDutyRate = data->globalDutyRate;
+
+    LMIC_setDrTxpow(data->datarate, data->adrTxPow);
+    LMIC.rx1DrOffset = data->rx1DrOffset;
+    LMIC.dn2Dr = data->dn2Dr;
+    LMIC.dn2Freq = data->dn2Freq;
+    LMIC.rxDelay = data->rxDelay;
+
+    // a later join must start with the default channels
+    LMIC.initBandplanAfterReset = 1;
+}
+
+// Checks that the snapshot is intact and belongs to this device
+bool TTNSession::isValid(const TTNSessionData* data)
+{
+    if (data->magic != SESSION_MAGIC || data->checksum != calculateChecksum(data))
+        return false;
+
+    uint8_t devEui[8];
+    os_getDevEui(devEui);
+    return memcmp(devEui, data->devEui, sizeof(devEui)) == 0;
+}
+
+// FNV-1a hash over all fields except the checksum
+uint32_t TTNSession::calculateChecksum(const TTNSessionData* data)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(TTNSessionData, checksum); i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Returns the system time in microseconds. It is based on the RTC
+// and keeps running in deep sleep and across software restarts.
+int64_t TTNSession::currentTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+bool TTNSession::readNvs(TTNSessionData* data)
+{
+    nvs_handle handle = 0;
+    if (nvs_open(NVS_FLASH_PARTITION, NVS_READONLY, &handle) != ESP_OK)
+        return false;
+
+    size_t size = sizeof(TTNSessionData);
+    esp_err_t res = nvs_get_blob(handle, NVS_FLASH_KEY_SESSION, data, &size);
+    nvs_close(handle);
+    return res == ESP_OK && size == sizeof(TTNSessionData);
+}
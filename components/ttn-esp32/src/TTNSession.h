@@ -0,0 +1,85 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Persistence of the active session across deep sleep and restarts.
+ *******************************************************************************/
+
+#ifndef _ttnsession_h_
+#define _ttnsession_h_
+
+#include "lmic/lmic.h"
+
+
+/**
+ * @brief Snapshot of an LMIC session.
+ *
+ * Waiting times of the duty-cycle ledger are stored relative to 'savedAt'
+ * (system time, which keeps running in deep sleep).
+ */
+struct TTNSessionData
+{
+    uint32_t magic;
+    uint8_t devEui[8];
+    uint32_t netid;
+    devaddr_t devaddr;
+    uint8_t nwkKey[16];
+    uint8_t artKey[16];
+    uint32_t seqnoUp;
+    uint32_t seqnoDn;
+    lmic_saved_adr_state_t adrState;
+#if CFG_LMIC_EU_like
+    uint16_t channelDrMap[MAX_CHANNELS];
+#if !defined(DISABLE_MCMD_DlChannelReq)
+    uint32_t channelDlFreq[MAX_CHANNELS];
+#endif
+    band_t bands[MAX_BANDS];
+#endif
+    ostime_t globalDutyWait;
+    uint32_t dn2Freq;
+    int64_t savedAt;
+    uint8_t datarate;
+    int8_t adrTxPow;
+    uint8_t rx1DrOffset;
+    uint8_t dn2Dr;
+    uint8_t rxDelay;
+    uint8_t globalDutyRate;
+    uint32_t checksum;
+};
+
+
+/**
+ * @brief Saves and restores the active session.
+ *
+ * A snapshot is kept in RTC memory, which survives deep sleep and software
+ * restarts. It is refreshed by the LMIC task after each join and at the
+ * start and end of each transmission. On request, a copy is written to NVS
+ * so the session also survives a power loss.
+ *
+ * This class is not to be used directly.
+ */
+class TTNSession
+{
+public:
+    bool save();
+    bool saveToNvs();
+    bool restore();
+    void clear();
+
+private:
+    static void capture(TTNSessionData* data);
+    static void apply(const TTNSessionData* data);
+    static bool isValid(const TTNSessionData* data);
+    static uint32_t calculateChecksum(const TTNSessionData* data);
+    static int64_t currentTime();
+    static bool readNvs(TTNSessionData* data);
+};
+
+extern TTNSession ttn_session;
+
+#endif
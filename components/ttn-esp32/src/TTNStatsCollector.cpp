@@ -0,0 +1,141 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Collection of link quality and traffic statistics.
+ *******************************************************************************/
+
+#include <string.h>
+#include "lmic/lmic.h"
+#include "TTNStatsCollector.h"
+
+
+TTNStatsCollector ttn_stats_collector;
+
+
+static int bucket(int value, int lowest, int width)
+{
+    if (value < lowest)
+        return 0;
+    int index = (value - lowest) / width;
+    if (index >= TTN_STATS_HISTOGRAM_BUCKETS)
+        return TTN_STATS_HISTOGRAM_BUCKETS - 1;
+    return index;
+}
+
+
+TTNStatsCollector::TTNStatsCollector()
+    : nextSample(0), numSamples(0), attemptPending(false)
+{
+    memset(&stats, 0, sizeof(stats));
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    lock = unlocked;
+}
+
+// Called in the LMIC task when a frame (data or join request) is handed to the radio (EV_TXSTART)
+void TTNStatsCollector::transmissionStarted()
+{
+    uint32_t airtime = osticks2ms(calcAirTime(LMIC.rps, LMIC.dataLen));
+    bool isJoin = (LMIC.opmode & OP_JOINING) != 0;
+
+    portENTER_CRITICAL(&lock);
+
+    // a retransmission implies that the previous attempt was not acknowledged
+    if (attemptPending)
+        countAttempt(false);
+
+    attemptPending = true;
+    stats.lastDataRate = LMIC.dndr;
+    stats.lastChannel = LMIC.txChnl;
+    stats.airtime += airtime;
+    if (!isJoin)
+        stats.lastUplinkCounter = LMIC.seqnoUp - 1;
+
+    portEXIT_CRITICAL(&lock);
+}
+
+// Called in the LMIC task when a transmission attempt has completed
+// (EV_TXCOMPLETE, EV_JOINED or EV_JOIN_TXCOMPLETE)
+void TTNStatsCollector::transmissionCompleted(bool success)
+{
+    portENTER_CRITICAL(&lock);
+    if (attemptPending)
+    {
+        countAttempt(success);
+        attemptPending = false;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+// Called in the LMIC task when a frame (data frame or join accept) has been received
+void TTNStatsCollector::frameReceived(bool isDataFrame)
+{
+    int16_t rssi = LMIC.rssi - RSSI_OFF;
+    int8_t snr = (LMIC.snr + (LMIC.snr < 0 ? -2 : 2)) / SNR_SCALEUP;
+
+    portENTER_CRITICAL(&lock);
+
+    stats.rxCount++;
+    stats.lastRssi = rssi;
+    stats.lastSnr = snr;
+    if (isDataFrame)
+        stats.lastDownlinkCounter = LMIC.seqnoDn - 1;
+
+    rssiSamples[nextSample] = rssi;
+    snrSamples[nextSample] = snr;
+    nextSample = (nextSample + 1) % TTN_STATS_WINDOW;
+    if (numSamples < TTN_STATS_WINDOW)
+        numSamples++;
+
+    portEXIT_CRITICAL(&lock);
+}
+
+// Copies the statistics. Can be called from any task.
+void TTNStatsCollector::getStatistics(TTNStatistics* result)
+{
+    portENTER_CRITICAL(&lock);
+    memcpy(result, &stats, sizeof(TTNStatistics));
+    int16_t rssi[TTN_STATS_WINDOW];
+    int8_t snr[TTN_STATS_WINDOW];
+    int n = numSamples;
+    memcpy(rssi, rssiSamples, sizeof(rssi));
+    memcpy(snr, snrSamples, sizeof(snr));
+    portEXIT_CRITICAL(&lock);
+
+    // the order of the samples does not matter for the histograms
+    memset(result->rssiHistogram, 0, sizeof(result->rssiHistogram));
+    memset(result->snrHistogram, 0, sizeof(result->snrHistogram));
+    for (int i = 0; i < n; i++)
+    {
+        result->rssiHistogram[bucket(rssi[i], -130, 10)]++;
+        result->snrHistogram[bucket(snr[i], -20, 4)]++;
+    }
+}
+
+// Must be called with the spinlock held
+void TTNStatsCollector::countAttempt(bool success)
+{
+    uint8_t dr = stats.lastDataRate;
+    uint8_t channel = stats.lastChannel;
+
+    if (dr < TTN_STATS_DATA_RATES)
+    {
+        if (success)
+            stats.txSuccess[dr]++;
+        else
+            stats.txFailure[dr]++;
+    }
+
+    if (channel < TTN_STATS_CHANNELS)
+    {
+        if (success)
+            stats.channelSuccess[channel]++;
+        else
+            stats.channelFailure[channel]++;
+    }
+}
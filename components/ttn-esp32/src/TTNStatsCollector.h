@@ -0,0 +1,55 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Collection of link quality and traffic statistics.
+ *******************************************************************************/
+
+#ifndef _ttnstatscollector_h_
+#define _ttnstatscollector_h_
+
+#include "freertos/FreeRTOS.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Collects link quality and traffic statistics.
+ *
+ * The LMIC task reports the events of each transmission attempt. The
+ * statistics are protected by a spinlock held for a few instructions
+ * only, so they can be read from any task without waiting for the
+ * LMIC task. The histograms are calculated when they are read from
+ * the most recent RSSI and SNR samples.
+ *
+ * This class is not to be used directly.
+ */
+class TTNStatsCollector
+{
+public:
+    TTNStatsCollector();
+
+    void transmissionStarted();
+    void transmissionCompleted(bool success);
+    void frameReceived(bool isDataFrame);
+    void getStatistics(TTNStatistics* result);
+
+private:
+    void countAttempt(bool success);
+
+    TTNStatistics stats;
+    int16_t rssiSamples[TTN_STATS_WINDOW];
+    int8_t snrSamples[TTN_STATS_WINDOW];
+    uint8_t nextSample;
+    uint8_t numSamples;
+    bool attemptPending;
+    portMUX_TYPE lock;
+};
+
+extern TTNStatsCollector ttn_stats_collector;
+
+#endif
@@ -0,0 +1,182 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Synchronization with the network time (DeviceTimeReq).
+ *******************************************************************************/
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "hal/hal_esp32.h"
+#include "TTNTimeSync.h"
+
+
+// Worst-case accuracy of the network time (LoRaWAN 1.0.3, DeviceTimeAns)
+#define REFERENCE_ERROR_US 100000
+// Assumed drift of the local clock before it has been estimated, in ppm
+#define UNCOMPENSATED_DRIFT_PPM 20
+// Assumed error of the estimated drift, in ppm
+#define RESIDUAL_DRIFT_PPM 2
+// Minimum time between the reference pairs used to estimate the drift
+#define MIN_DRIFT_SPAN_US (3600 * 1000000LL)
+// Estimates beyond this drift are treated as outliers, in ppb
+#define MAX_DRIFT_PPB 200000
+// Longest resync interval that fits into LMIC's time range, in s
+#define MAX_RESYNC_INTERVAL 28800
+
+static const char *TAG = "ttn_time";
+
+TTNTimeSync ttn_time_sync;
+
+
+TTNTimeSync::TTNTimeSync()
+    : synchronized(false), refLocalTime(0), refGpsTime(0), drift(0), driftValid(false),
+      syncCount(0), driftBaseLocalTime(0), driftBaseGpsTime(0), resyncInterval(0)
+{
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    lock = unlocked;
+}
+
+// Requests the network time with the next uplink. Called by application tasks.
+bool TTNTimeSync::request(uint32_t interval)
+{
+#if LMIC_ENABLE_DeviceTimeReq
+    ttn_hal.enterCriticalSection();
+    resyncInterval = interval > MAX_RESYNC_INTERVAL ? MAX_RESYNC_INTERVAL : interval;
+    os_clearCallback(&job);
+    requestNow();
+    ttn_hal.leaveCriticalSection();
+    return true;
+#else
+    ESP_LOGW(TAG, "Network time is disabled in the configuration");
+    return false;
+#endif
+}
+
+// Extrapolates the network time from the latest reference pair
+bool TTNTimeSync::getTime(TTNNetworkTime* time)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&lock);
+    bool valid = synchronized;
+    int64_t localTime = refLocalTime;
+    uint64_t gpsTime = refGpsTime;
+    int32_t clockDrift = drift;
+    bool hasDrift = driftValid;
+    uint16_t count = syncCount;
+    portEXIT_CRITICAL(&lock);
+
+    if (!valid)
+        return false;
+
+    int64_t elapsed = now - localTime;
+    time->gpsTime = gpsTime + elapsed + elapsed * clockDrift / 1000000000LL;
+    time->utcTime = time->gpsTime + (TTN_GPS_EPOCH_OFFSET - TTN_GPS_LEAP_SECONDS) * 1000000ULL;
+    uint64_t error = REFERENCE_ERROR_US + elapsed * (hasDrift ? RESIDUAL_DRIFT_PPM : UNCOMPENSATED_DRIFT_PPM) / 1000000;
+    time->errorBound = error > UINT32_MAX ? UINT32_MAX : (uint32_t)error;
+    time->age = (uint32_t)(elapsed / 1000000);
+    time->drift = clockDrift;
+    time->syncCount = count;
+    return true;
+}
+
+// Adds the DeviceTimeReq MAC command to the next uplink unless it is already pending.
+// Must be called with the critical section entered.
+void TTNTimeSync::requestNow()
+{
+#if LMIC_ENABLE_DeviceTimeReq
+    if (LMIC.txDeviceTimeReqState == lmic_RequestTimeState_idle)
+        LMIC_requestNetworkTime(timeReceived, this);
+#endif
+}
+
+// Replaces the reference pair and updates the drift estimate.
+// Must be called with the critical section entered.
+void TTNTimeSync::addReference(int64_t localTime, uint64_t gpsTime)
+{
+    bool hasDrift = driftValid;
+    int32_t clockDrift = drift;
+
+    if (syncCount == 0)
+    {
+        driftBaseLocalTime = localTime;
+        driftBaseGpsTime = gpsTime;
+    }
+    else if (localTime - driftBaseLocalTime >= MIN_DRIFT_SPAN_US)
+    {
+        int64_t span = localTime - driftBaseLocalTime;
+        int64_t deviation = (int64_t)(gpsTime - driftBaseGpsTime) - span;
+        int64_t estimate = deviation * 1000000000LL / span;
+        if (estimate > MAX_DRIFT_PPB || estimate < -MAX_DRIFT_PPB)
+        {
+            ESP_LOGW(TAG, "Drift estimate out of range, ignored");
+        }
+        else
+        {
+            clockDrift = hasDrift ? (int32_t)((3 * (int64_t)clockDrift + estimate) / 4) : (int32_t)estimate;
+            hasDrift = true;
+        }
+        driftBaseLocalTime = localTime;
+        driftBaseGpsTime = gpsTime;
+    }
+
+    portENTER_CRITICAL(&lock);
+    refLocalTime = localTime;
+    refGpsTime = gpsTime;
+    drift = clockDrift;
+    driftValid = hasDrift;
+    synchronized = true;
+    syncCount++;
+    portEXIT_CRITICAL(&lock);
+}
+
+// Called by LMIC in the LMIC task when the uplink with the DeviceTimeReq has completed
+void TTNTimeSync::timeReceived(void* userData, int success)
+{
+#if LMIC_ENABLE_DeviceTimeReq
+    TTNTimeSync* timeSync = static_cast<TTNTimeSync*>(userData);
+
+    ttn_hal.enterCriticalSection();
+
+    lmic_time_reference_t reference;
+    if (success && LMIC_getNetworkTimeReference(&reference))
+    {
+        // 'tLocal' is the end of the uplink; convert it to esp_timer time
+        int64_t localTime = esp_timer_get_time() - osticks2us(os_getTime() - reference.tLocal);
+        uint64_t gpsTime = (uint64_t)reference.tNetwork * 1000000ULL;
+        timeSync->addReference(localTime, gpsTime);
+        ESP_LOGI(TAG, "Network time received (GPS %u s)", reference.tNetwork);
+
+        if (timeSync->resyncInterval != 0)
+        {
+            os_setTimedCallback(&timeSync->job, os_getTime() + sec2osticks(timeSync->resyncInterval), resyncJob);
+            ttn_hal.wakeUp();
+        }
+    }
+    else if (timeSync->resyncInterval != 0)
+    {
+        // try again with the next uplink
+        timeSync->requestNow();
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Network time not received");
+    }
+
+    ttn_hal.leaveCriticalSection();
+#endif
+}
+
+// Called in the LMIC task when the resync interval has expired
+void TTNTimeSync::resyncJob(osjob_t* job)
+{
+    ttn_hal.enterCriticalSection();
+    ttn_time_sync.requestNow();
+    ttn_hal.leaveCriticalSection();
+}
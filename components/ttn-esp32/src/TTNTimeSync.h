@@ -0,0 +1,64 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Synchronization with the network time (DeviceTimeReq).
+ *******************************************************************************/
+
+#ifndef _ttntimesync_h_
+#define _ttntimesync_h_
+
+#include "freertos/FreeRTOS.h"
+#include "lmic/lmic.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Disciplines the esp_timer clock with the network time.
+ *
+ * The DeviceTimeReq MAC command is added to the next regular uplink.
+ * Each answer provides a reference pair of esp_timer and GPS time. The
+ * drift of the local clock is estimated from consecutive reference
+ * pairs and applied when extrapolating from the latest one.
+ *
+ * The reference is protected by a spinlock so the time can be read
+ * from any task without waiting for the LMIC task.
+ *
+ * This class is not to be used directly.
+ */
+class TTNTimeSync
+{
+public:
+    TTNTimeSync();
+
+    bool request(uint32_t resyncInterval);
+    bool getTime(TTNNetworkTime* time);
+
+private:
+    static void timeReceived(void* userData, int success);
+    static void resyncJob(osjob_t* job);
+
+    void requestNow();
+    void addReference(int64_t localTime, uint64_t gpsTime);
+
+    portMUX_TYPE lock;
+    bool synchronized;
+    int64_t refLocalTime;   // esp_timer time of the reference, in µs
+    uint64_t refGpsTime;    // GPS time of the reference, in µs
+    int32_t drift;          // in ppb (positive if the local clock is slow)
+    bool driftValid;
+    uint16_t syncCount;
+    int64_t driftBaseLocalTime; // reference pair the next drift estimate is based on
+    uint64_t driftBaseGpsTime;
+    uint32_t resyncInterval; // in s (0 for single requests)
+    osjob_t job;
+};
+
+extern TTNTimeSync ttn_time_sync;
+
+#endif
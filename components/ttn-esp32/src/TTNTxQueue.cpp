@@ -0,0 +1,374 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Bounded queue of uplink messages drained by the LMIC task.
+ *******************************************************************************/
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "hal/hal_esp32.h"
+#include "TTNEnergyMeter.h"
+#include "TTNLatencyTracer.h"
+#include "TTNTxQueue.h"
+
+
+static const char *TAG = "ttn_txq";
+
+TTNTxQueue ttn_tx_queue;
+
+
+TTNTxQueue::TTNTxQueue()
+    : head(0), numMessages(0), inFlight(false), inFlightPriority(kTTNPriorityNormal),
+      inFlightCallback(nullptr), inFlightUserData(nullptr), inFlightQueuedAt(0),
+      lastAlarmLatency(0), maxAlarmLatency(0), frameProvider(nullptr), frameCallback(nullptr),
+      frameUserData(nullptr), framesAvailable(false)
+{
+}
+
+// Adds a message to the queue, behind all messages of the same or higher priority.
+// Called by application tasks.
+bool TTNTxQueue::enqueue(const uint8_t* payload, size_t length, port_t port, bool confirm,
+    TTNTransmitCallback callback, void* userData, TTNPriority priority, uint8_t confirmAttempts)
+{
+    if (length > MAX_LEN_PAYLOAD)
+    {
+        ESP_LOGW(TAG, "Message too long (%d bytes)", length);
+        return false;
+    }
+
+    // taken before the lock so the queue stage includes the lock wait
+    int64_t now = esp_timer_get_time();
+
+    ttn_hal.enterCriticalSection();
+    if (numMessages == CONFIG_TTN_TX_QUEUE_SIZE)
+    {
+        TTNTxMessage* last = at(numMessages - 1);
+        if (priority == kTTNPriorityNormal || last->priority != kTTNPriorityNormal)
+        {
+            ttn_hal.leaveCriticalSection();
+            return false;
+        }
+
+        // make room for the alarm
+        ESP_LOGW(TAG, "Queue full, dropping message for alarm");
+        numMessages--;
+        complete(last->callback, last->userData, false);
+    }
+
+    TTNTxMessage* message = insert(priority);
+    memcpy(message->payload, payload, length);
+    message->length = length;
+    message->port = port;
+    message->confirm = confirm;
+    message->confirmAttempts = confirmAttempts;
+    message->priority = priority;
+    message->callback = callback;
+    message->userData = userData;
+    message->queuedAt = now;
+
+    scheduleDrain();
+    ttn_hal.leaveCriticalSection();
+    return true;
+}
+
+// Returns the number of messages waiting for transmission
+// (excluding the message being transmitted).
+size_t TTNTxQueue::count()
+{
+    ttn_hal.enterCriticalSection();
+    size_t n = numMessages;
+    ttn_hal.leaveCriticalSection();
+    return n;
+}
+
+// Discards all messages including the one being transmitted.
+// Must be called when LMIC is reset as LMIC will not report
+// the outcome of the transmission in progress.
+void TTNTxQueue::clear()
+{
+    ttn_hal.enterCriticalSection();
+
+    os_clearCallback(&job);
+
+    if (inFlight)
+    {
+        LMIC.client.txMessageCb = nullptr;
+        inFlight = false;
+        ttn_latency_tracer.cancel();
+        complete(inFlightCallback, inFlightUserData, false);
+    }
+
+    while (numMessages > 0)
+    {
+        TTNTxMessage* message = &messages[head];
+        head = (head + 1) % CONFIG_TTN_TX_QUEUE_SIZE;
+        numMessages--;
+        complete(message->callback, message->userData, false);
+    }
+
+    ttn_hal.leaveCriticalSection();
+}
+
+// Schedules the drain job to run in the LMIC task.
+// Must be called with the critical section entered.
+void TTNTxQueue::scheduleDrain()
+{
+    if (numMessages == 0 && !framesAvailable)
+        return;
+
+    os_setCallback(&job, drainJob);
+    ttn_hal.wakeUp();
+}
+
+// Checks if the message being transmitted has the specified callback
+bool TTNTxQueue::isInFlight(TTNTransmitCallback callback)
+{
+    return inFlight && inFlightCallback == callback;
+}
+
+// Returns the user data of the message submitted to LMIC if it has the
+// given callback, or nullptr otherwise.
+// Must be called with the critical section entered.
+void* TTNTxQueue::inFlightMessage(TTNTransmitCallback callback)
+{
+    return inFlight && inFlightCallback == callback ? inFlightUserData : nullptr;
+}
+
+// Called in the LMIC task when a transmission starts (EV_TXSTART).
+// Records the queuing latency of alarms (first attempt only).
+void TTNTxQueue::transmissionStarted()
+{
+    ttn_hal.enterCriticalSection();
+    if (inFlight && inFlightPriority == kTTNPriorityAlarm && inFlightQueuedAt != 0)
+    {
+        uint32_t latency = (uint32_t)((esp_timer_get_time() - inFlightQueuedAt) / 1000);
+        lastAlarmLatency = latency;
+        if (latency > maxAlarmLatency)
+            maxAlarmLatency = latency;
+        inFlightQueuedAt = 0;
+    }
+    ttn_hal.leaveCriticalSection();
+}
+
+void TTNTxQueue::getAlarmLatency(uint32_t* last, uint32_t* max)
+{
+    ttn_hal.enterCriticalSection();
+    *last = lastAlarmLatency;
+    *max = maxAlarmLatency;
+    ttn_hal.leaveCriticalSection();
+}
+
+// Sets the function asked for the next message if the queue is empty.
+// Called by application tasks.
+void TTNTxQueue::setFrameProvider(TTNFrameProvider provider, TTNTransmitCallback callback, void* userData)
+{
+    ttn_hal.enterCriticalSection();
+    frameProvider = provider;
+    frameCallback = callback;
+    frameUserData = userData;
+    framesAvailable = provider != nullptr;
+    scheduleDrain();
+    ttn_hal.leaveCriticalSection();
+}
+
+// Resumes asking the frame provider. Called by application tasks.
+void TTNTxQueue::notifyFramesAvailable()
+{
+    ttn_hal.enterCriticalSection();
+    framesAvailable = frameProvider != nullptr;
+    scheduleDrain();
+    ttn_hal.leaveCriticalSection();
+}
+
+void TTNTxQueue::drainJob(osjob_t* job)
+{
+    ttn_tx_queue.drain();
+}
+
+// Submits the next message if LMIC is ready to accept it.
+// Runs in the LMIC task.
+void TTNTxQueue::drain()
+{
+    ttn_hal.enterCriticalSection();
+
+    // wait for join and for the current transmission to complete;
+    // the drain job is rescheduled by both events
+    if ((numMessages == 0 && !framesAvailable) || LMIC.devaddr == 0)
+    {
+        ttn_hal.leaveCriticalSection();
+        return;
+    }
+
+    if (numMessages == 0)
+    {
+        if (!inFlight && (LMIC.opmode & (OP_TXDATA | OP_TXRXPEND)) == 0 && pullFrame())
+            submit();
+        ttn_hal.leaveCriticalSection();
+        return;
+    }
+
+    if (inFlight)
+    {
+        if (messages[head].priority == kTTNPriorityAlarm && inFlightPriority == kTTNPriorityNormal && isPreemptable())
+            preempt();
+    }
+    else if ((LMIC.opmode & (OP_TXDATA | OP_TXRXPEND)) == 0)
+    {
+        submit();
+    }
+
+    ttn_hal.leaveCriticalSection();
+}
+
+// Asks the frame provider for the next message and places it at the head
+// of the empty queue. Returns false if the provider has no further message.
+bool TTNTxQueue::pullFrame()
+{
+    TTNTxMessage* message = &messages[head];
+    size_t maxLength = LMIC_maxPayloadForDataRate(LMIC.datarate);
+    if (maxLength > MAX_LEN_PAYLOAD)
+        maxLength = MAX_LEN_PAYLOAD;
+
+    port_t port = 1;
+    bool confirm = false;
+    size_t length = frameProvider(message->payload, maxLength, &port, &confirm, frameUserData);
+    if (length == 0 || length > maxLength)
+    {
+        framesAvailable = false;
+        return false;
+    }
+
+    message->length = length;
+    message->port = port;
+    message->confirm = confirm;
+    message->confirmAttempts = 0;
+    message->priority = kTTNPriorityNormal;
+    message->callback = frameCallback;
+    message->userData = frameUserData;
+    message->queuedAt = esp_timer_get_time();
+    numMessages = 1;
+    return true;
+}
+
+// Submits the message at the head of the queue to LMIC.
+void TTNTxQueue::submit()
+{
+    TTNTxMessage* message = &messages[head];
+    head = (head + 1) % CONFIG_TTN_TX_QUEUE_SIZE;
+    numMessages--;
+
+    // LMIC copies the payload, so the slot can be reused right away
+    inFlight = true;
+    inFlightPriority = message->priority;
+    inFlightCallback = message->callback;
+    inFlightUserData = message->userData;
+    inFlightQueuedAt = message->queuedAt;
+    LMIC.txConfAttempts = message->confirmAttempts;
+    // LMIC's retransmission defaults; the retry engine adjusts them per transmission
+    LMIC.txConfNoDrFallback = 0;
+    LMIC.txConfRetryDelay = 0;
+    ttn_latency_tracer.submitted(message->queuedAt);
+    ttn_energy_meter.messageStarted();
+    lmic_tx_error_t err = LMIC_sendWithCallback(message->port, message->payload, message->length, message->confirm, transmitted, nullptr);
+    if (err != 0)
+    {
+        ESP_LOGW(TAG, "Transmission rejected by LMIC (error %d)", err);
+        inFlight = false;
+        ttn_latency_tracer.cancel();
+        complete(inFlightCallback, inFlightUserData, false);
+        scheduleDrain();
+    }
+}
+
+// Checks if the submitted message is still waiting for its first transmission
+bool TTNTxQueue::isPreemptable()
+{
+    return (LMIC.opmode & (OP_TXDATA | OP_TXRXPEND | OP_JOINING)) == OP_TXDATA
+        && LMIC.txCnt == 0 && LMIC.upRepeatCount == 0;
+}
+
+// Takes the submitted normal message back from LMIC, submits the alarm
+// at the head of the queue instead and requeues the normal message
+// ahead of all other normal messages.
+void TTNTxQueue::preempt()
+{
+    TTNTxMessage preempted;
+    memcpy(preempted.payload, LMIC.pendTxData, LMIC.pendTxLen);
+    preempted.length = LMIC.pendTxLen;
+    preempted.port = LMIC.pendTxPort;
+    preempted.confirm = LMIC.pendTxConf != 0;
+    preempted.confirmAttempts = LMIC.txConfAttempts;
+    preempted.priority = inFlightPriority;
+    preempted.callback = inFlightCallback;
+    preempted.userData = inFlightUserData;
+    preempted.queuedAt = inFlightQueuedAt;
+
+    // cancel without reporting the outcome
+    LMIC.client.txMessageCb = nullptr;
+    LMIC_clrTxData();
+    inFlight = false;
+
+    submit();
+
+    TTNTxMessage* message = insertAt(countAlarms());
+    memcpy(message, &preempted, sizeof(TTNTxMessage));
+}
+
+TTNTxMessage* TTNTxQueue::at(size_t index)
+{
+    return &messages[(head + index) % CONFIG_TTN_TX_QUEUE_SIZE];
+}
+
+// Inserts an empty slot behind all messages of the same or higher priority.
+// The queue must not be full.
+TTNTxMessage* TTNTxQueue::insert(TTNPriority priority)
+{
+    return insertAt(priority == kTTNPriorityAlarm ? countAlarms() : numMessages);
+}
+
+TTNTxMessage* TTNTxQueue::insertAt(size_t position)
+{
+    for (size_t i = numMessages; i > position; i--)
+        memcpy(at(i), at(i - 1), sizeof(TTNTxMessage));
+    numMessages++;
+    return at(position);
+}
+
+size_t TTNTxQueue::countAlarms()
+{
+    size_t n = 0;
+    while (n < numMessages && at(n)->priority == kTTNPriorityAlarm)
+        n++;
+    return n;
+}
+
+// Called by LMIC when a message has been transmitted (or the transmission failed)
+void TTNTxQueue::transmitted(void* userData, int success)
+{
+    // the transmit callbacks are application code
+    ttn_hal.releaseSpiBus();
+
+    ttn_hal.enterCriticalSection();
+    if (ttn_tx_queue.inFlight)
+    {
+        ttn_tx_queue.inFlight = false;
+        ttn_latency_tracer.completed(success != 0);
+        ttn_energy_meter.messageCompleted();
+        ttn_tx_queue.complete(ttn_tx_queue.inFlightCallback, ttn_tx_queue.inFlightUserData, success != 0);
+    }
+    ttn_tx_queue.scheduleDrain();
+    ttn_hal.leaveCriticalSection();
+}
+
+void TTNTxQueue::complete(TTNTransmitCallback callback, void* userData, bool success)
+{
+    if (callback != nullptr)
+        callback(success ? kTTNSuccessfulTransmission : kTTNErrorTransmissionFailed, userData);
+}
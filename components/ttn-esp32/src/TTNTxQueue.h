@@ -0,0 +1,114 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2018-2019 Manuel Bleichenbacher
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Bounded queue of uplink messages drained by the LMIC task.
+ *******************************************************************************/
+
+#ifndef _ttntxqueue_h_
+#define _ttntxqueue_h_
+
+#include "lmic/lmic.h"
+#include "TheThingsNetwork.h"
+
+
+/**
+ * @brief Uplink message waiting for transmission
+ */
+struct TTNTxMessage
+{
+    uint8_t payload[MAX_LEN_PAYLOAD];
+    uint8_t length;
+    port_t port;
+    bool confirm;
+    uint8_t confirmAttempts; // 0 for LMIC's default
+    TTNPriority priority;
+    TTNTransmitCallback callback;
+    void* userData;
+    int64_t queuedAt; // in µs
+};
+
+
+/**
+ * @brief Transmit queue.
+ *
+ * Application tasks add messages to the queue and return immediately. The queue
+ * is drained by a job running in the LMIC task: whenever LMIC has no pending
+ * transmission, the oldest message is copied into LMIC's transmit buffer and
+ * submitted. LMIC then waits until the duty cycle allows the transmission.
+ * The slot is freed on submission; the message's callback is called in the
+ * LMIC task when the transmission (including the RX windows) has completed.
+ *
+ * Alarm messages are queued ahead of all normal messages. If the queue is full,
+ * an alarm evicts the most recent normal message. If a normal message has been
+ * submitted to LMIC but is still waiting for the duty cycle, it is taken back
+ * and requeued so the alarm can use the next transmission opportunity. Messages
+ * that are already on air (or being retransmitted) are never preempted.
+ *
+ * If a frame provider is set, it is asked for the next message whenever the
+ * queue is empty and LMIC can accept a message, i.e. right after the previous
+ * transmission has completed. It is no longer asked once it has returned no
+ * message, until it is notified of new messages.
+ *
+ * The messages are stored in a fixed array of CONFIG_TTN_TX_QUEUE_SIZE slots.
+ * No heap memory is used.
+ *
+ * This class is not to be used directly.
+ */
+class TTNTxQueue
+{
+public:
+    TTNTxQueue();
+
+    bool enqueue(const uint8_t* payload, size_t length, port_t port, bool confirm,
+        TTNTransmitCallback callback, void* userData, TTNPriority priority, uint8_t confirmAttempts = 0);
+    size_t count();
+    void clear();
+    void scheduleDrain();
+    bool isInFlight(TTNTransmitCallback callback);
+    void* inFlightMessage(TTNTransmitCallback callback);
+    void transmissionStarted();
+    void getAlarmLatency(uint32_t* last, uint32_t* max);
+    void setFrameProvider(TTNFrameProvider provider, TTNTransmitCallback callback, void* userData);
+    void notifyFramesAvailable();
+
+private:
+    static void drainJob(osjob_t* job);
+    static void transmitted(void* userData, int success);
+
+    void drain();
+    bool pullFrame();
+    void submit();
+    bool isPreemptable();
+    void preempt();
+    TTNTxMessage* at(size_t index);
+    TTNTxMessage* insert(TTNPriority priority);
+    TTNTxMessage* insertAt(size_t position);
+    size_t countAlarms();
+    void complete(TTNTransmitCallback callback, void* userData, bool success);
+
+    TTNTxMessage messages[CONFIG_TTN_TX_QUEUE_SIZE];
+    size_t head;
+    size_t numMessages;
+    bool inFlight;
+    TTNPriority inFlightPriority;
+    TTNTransmitCallback inFlightCallback;
+    void* inFlightUserData;
+    int64_t inFlightQueuedAt;
+    uint32_t lastAlarmLatency;
+    uint32_t maxAlarmLatency;
+    TTNFrameProvider frameProvider;
+    TTNTransmitCallback frameCallback;
+    void* frameUserData;
+    bool framesAvailable;
+    osjob_t job;
+};
+
+extern TTNTxQueue ttn_tx_queue;
+
+#endif
@@ -18,6 +18,19 @@
 #include "TheThingsNetwork.h"
 #include "TTNProvisioning.h"
 #include "TTNLogging.h"
+#include "TTNAirtime.h"
+#include "TTNCoalescer.h"
+#include "TTNDownlinkDrain.h"
+#include "TTNDownlinkPool.h"
+#include "TTNEnergyMeter.h"
+#include "TTNFragmenter.h"
+#include "TTNFrameCounters.h"
+#include "TTNLatencyTracer.h"
+#include "TTNRetryEngine.h"
+#include "TTNSession.h"
+#include "TTNStatsCollector.h"
+#include "TTNTimeSync.h"
+#include "TTNTxQueue.h"
 
 
 /**
@@ -49,28 +62,48 @@ struct TTNLmicEvent {
     TTNLmicEvent(TTNEvent ev = eEvtNone): event(ev) { }
 
     TTNEvent event;
-    uint8_t port;
-    const uint8_t* message;
-    size_t messageSize;
+    TTNDownlink* downlink;
 };
 
+/**
+ * @brief Size of the event queue
+ * 
+ * A waiting 'join' receives a single event; a waiting 'transmitMessage' receives
+ * at most one downlink per transmission attempt (up to 8 for confirmed messages)
+ * followed by the completion event.
+ */
+#define LMIC_EVENT_QUEUE_SIZE 10
+
 static const char *TAG = "ttn";
 
 static TheThingsNetwork* ttnInstance;
 static QueueHandle_t lmicEventQueue = nullptr;
 static TTNWaitingReason waitingReason = eWaitingNone;
 static TTNProvisioning provisioning;
+static TTNMessageCallback messageCallback = nullptr;
+static TTNDownlinkCallback downlinkCallback = nullptr;
+static void* downlinkCallbackUserData = nullptr;
+static TTNEventCallback eventObserver = nullptr;
+static void* eventObserverUserData = nullptr;
+static TTNBeaconCallback beaconCallback = nullptr;
+static void* beaconCallbackUserData = nullptr;
+static uint32_t lmicEventsDropped = 0;
+static uint32_t lmicEventQueueHighWater = 0;
 #if LMIC_ENABLE_event_logging
 static TTNLogging* logging;
 #endif
 
 static void eventCallback(void* userData, ev_t event);
 static void messageReceivedCallback(void *userData, uint8_t port, const uint8_t *message, size_t messageSize);
-static void messageTransmittedCallback(void *userData, int success);
+static void messageTransmittedCallback(TTNResponseCode result, void *userData);
+static void postLmicEvent(const TTNLmicEvent* event);
+static void deliverDownlink(TTNDownlink* downlink);
+static void discardLmicEvents();
+static void recordCompletion(ev_t event);
+static void reportBeaconEvent(ev_t event);
 
 
 TheThingsNetwork::TheThingsNetwork()
-    : messageCallback(nullptr)
 {
 #if defined(TTN_IS_DISABLED)
     ESP_LOGE(TAG, "TTN is disabled. Configure a frequency plan using 'make menuconfig'");
@@ -101,9 +134,10 @@ void TheThingsNetwork::configurePins(spi_host_device_t spi_host, uint8_t nss, ui
     os_init_ex(nullptr);
     reset();
 
-    lmicEventQueue = xQueueCreate(4, sizeof(TTNLmicEvent));
+    lmicEventQueue = xQueueCreate(LMIC_EVENT_QUEUE_SIZE, sizeof(TTNLmicEvent));
     ASSERT(lmicEventQueue != nullptr);
     ttn_hal.startLMICTask();
+    ttn_energy_meter.reset();
 }
 
 void TheThingsNetwork::reset()
@@ -113,8 +147,9 @@ void TheThingsNetwork::reset()
     waitingReason = eWaitingNone;
     if (lmicEventQueue != nullptr)
     {
-        xQueueReset(lmicEventQueue);
+        discardLmicEvents();
     }
+    ttn_tx_queue.clear();
     ttn_hal.leaveCriticalSection();
 }
 
@@ -201,23 +236,68 @@ bool TheThingsNetwork::joinCore()
 
     TTNLmicEvent event;
     xQueueReceive(lmicEventQueue, &event, portMAX_DELAY);
-    return event.event == eEvtJoinCompleted;
+    if (event.event == eEvtJoinCompleted)
+        return true;
+
+    // stop LMIC's join loop so the retries follow the caller's schedule
+    ttn_hal.enterCriticalSection();
+    LMIC_reset();
+    ttn_hal.leaveCriticalSection();
+    return false;
+}
+
+bool TheThingsNetwork::resumeSession()
+{
+    if (!provisioning.haveKeys())
+    {
+        if (!provisioning.restoreKeys(false))
+            return false;
+    }
+
+    if (!ttn_session.restore())
+        return false;
+
+    // transmit queued messages right away
+    ttn_hal.enterCriticalSection();
+    ttn_tx_queue.scheduleDrain();
+    ttn_hal.leaveCriticalSection();
+    return true;
+}
+
+bool TheThingsNetwork::saveSession(bool persistent)
+{
+    if (persistent)
+        return ttn_session.saveToNvs();
+    return ttn_session.save();
+}
+
+void TheThingsNetwork::clearSession()
+{
+    ttn_session.clear();
+}
+
+void TheThingsNetwork::getFrameCounterStats(uint32_t* writes, uint32_t* maxWriteTime)
+{
+    ttn_hal.enterCriticalSection();
+    ttn_frame_counters.getStats(writes, maxWriteTime);
+    ttn_hal.leaveCriticalSection();
 }
 
 TTNResponseCode TheThingsNetwork::transmitMessage(const uint8_t *payload, size_t length, port_t port, bool confirm)
 {
     ttn_hal.enterCriticalSection();
-    if (waitingReason != eWaitingNone || (LMIC.opmode & OP_TXRXPEND) != 0)
+    if (waitingReason != eWaitingNone)
     {
         ttn_hal.leaveCriticalSection();
         return kTTNErrorTransmissionFailed;
     }
 
+    if (!ttn_tx_queue.enqueue(payload, length, port, confirm, messageTransmittedCallback, nullptr, kTTNPriorityNormal))
+    {
+        ttn_hal.leaveCriticalSection();
+        return kTTNErrorTransmissionFailed;
+    }
     waitingReason = eWaitingForTransmission;
-    LMIC.client.txMessageCb = messageTransmittedCallback;
-    LMIC.client.txMessageUserData = nullptr;
-    LMIC_setTxData2(port, (xref2u1_t)payload, length, confirm);
-    ttn_hal.wakeUp();
     ttn_hal.leaveCriticalSection();
 
     while (true)
@@ -228,8 +308,7 @@ TTNResponseCode TheThingsNetwork::transmitMessage(const uint8_t *payload, size_t
         switch (result.event)
         {
             case eEvtMessageReceived:
-                if (messageCallback != nullptr)
-                    messageCallback(result.message, result.messageSize, result.port);
+                deliverDownlink(result.downlink);
                 break;
 
             case eEvtTransmissionCompleted:
@@ -244,11 +323,247 @@ TTNResponseCode TheThingsNetwork::transmitMessage(const uint8_t *payload, size_t
     }
 }
 
+bool TheThingsNetwork::enqueueMessage(const uint8_t *payload, size_t length, port_t port, bool confirm,
+    TTNTransmitCallback callback, void* userData, TTNPriority priority)
+{
+    return ttn_tx_queue.enqueue(payload, length, port, confirm, callback, userData, priority);
+}
+
+void TheThingsNetwork::setFrameProvider(TTNFrameProvider provider, TTNTransmitCallback callback, void* userData)
+{
+    ttn_tx_queue.setFrameProvider(provider, callback, userData);
+}
+
+void TheThingsNetwork::notifyFramesAvailable()
+{
+    ttn_tx_queue.notifyFramesAvailable();
+}
+
+bool TheThingsNetwork::sendConfirmed(const uint8_t *payload, size_t length, port_t port, const TTNRetryPolicy& policy,
+    TTNRetryCallback callback, void* userData)
+{
+    return ttn_retry_engine.send(payload, length, port, policy, callback, userData);
+}
+
+bool TheThingsNetwork::sendFragmented(const uint8_t *data, size_t length, port_t port, uint32_t resendWindow,
+    TTNTransmitCallback callback, void* userData)
+{
+    return ttn_fragmenter.start(data, length, port, resendWindow, callback, userData);
+}
+
+void TheThingsNetwork::cancelFragmented()
+{
+    ttn_fragmenter.cancel();
+}
+
+void TheThingsNetwork::getAlarmLatency(uint32_t* last, uint32_t* max)
+{
+    ttn_tx_queue.getAlarmLatency(last, max);
+}
+
+size_t TheThingsNetwork::queuedMessageCount()
+{
+    return ttn_tx_queue.count();
+}
+
+bool TheThingsNetwork::setCoalescing(port_t port, uint32_t maxDelay)
+{
+    return ttn_coalescer.configure(port, maxDelay);
+}
+
+bool TheThingsNetwork::coalesceMessage(const uint8_t *payload, size_t length, port_t port)
+{
+    return ttn_coalescer.add(payload, length, port);
+}
+
+void TheThingsNetwork::flushCoalescedMessages()
+{
+    ttn_coalescer.flushAll();
+}
+
+uint32_t TheThingsNetwork::getTimeOnAir(size_t length, int dataRate)
+{
+    if (dataRate < 0)
+        dataRate = LMIC.datarate;
+    return ttn_airtime.timeOnAir(length, dataRate);
+}
+
+uint32_t TheThingsNetwork::getTransmitDelay()
+{
+    return ttn_airtime.transmitDelay();
+}
+
+size_t TheThingsNetwork::getBandAvailability(TTNBandAvailability* bands, size_t maxBands)
+{
+    return ttn_airtime.getBands(bands, maxBands);
+}
+
+bool TheThingsNetwork::requestNetworkTime(uint32_t resyncInterval)
+{
+    return ttn_time_sync.request(resyncInterval);
+}
+
+bool TheThingsNetwork::getNetworkTime(TTNNetworkTime* time)
+{
+    return ttn_time_sync.getTime(time);
+}
+
+void TheThingsNetwork::setClassC(bool enabled)
+{
+    ttn_hal.enterCriticalSection();
+#if !defined(DISABLE_PING)
+    if (enabled && (LMIC.opmode & OP_PINGABLE) != 0)
+    {
+        LMIC_stopPingable();
+        LMIC_disableTracking();
+    }
+#endif
+    LMIC_setClassC(enabled);
+    ttn_hal.wakeUp();
+    ttn_hal.leaveCriticalSection();
+}
+
+bool TheThingsNetwork::isClassC()
+{
+    return LMIC.classC != 0;
+}
+
+bool TheThingsNetwork::enableClassB(uint8_t pingPeriodicity)
+{
+#if !defined(DISABLE_PING)
+    if (pingPeriodicity > 7)
+        return false;
+
+    ttn_hal.enterCriticalSection();
+    if (LMIC.devaddr == 0)
+    {
+        ttn_hal.leaveCriticalSection();
+        ESP_LOGW(TAG, "Class B requires the device to have joined");
+        return false;
+    }
+
+    LMIC_setClassC(false);
+    LMIC_setPingable(pingPeriodicity);
+    ttn_hal.wakeUp();
+    ttn_hal.leaveCriticalSection();
+    return true;
+#else
+    ESP_LOGW(TAG, "Class B is disabled in the configuration");
+    return false;
+#endif
+}
+
+void TheThingsNetwork::disableClassB()
+{
+#if !defined(DISABLE_PING)
+    ttn_hal.enterCriticalSection();
+    LMIC_stopPingable();
+    LMIC_disableTracking();
+    ttn_hal.wakeUp();
+    ttn_hal.leaveCriticalSection();
+#endif
+}
+
+bool TheThingsNetwork::isClassB()
+{
+#if !defined(DISABLE_PING)
+    return (LMIC.opmode & OP_PINGABLE) != 0 && (LMIC.opmode & (OP_SCAN | OP_TRACK)) != 0;
+#else
+    return false;
+#endif
+}
+
+void TheThingsNetwork::onBeacon(TTNBeaconCallback callback, void* userData)
+{
+    beaconCallbackUserData = userData;
+    beaconCallback = callback;
+}
+
+void TheThingsNetwork::setDownlinkDrain(const TTNDrainPolicy& policy)
+{
+    ttn_downlink_drain.configure(policy);
+}
+
+void TheThingsNetwork::getEventQueueStats(uint32_t* dropped, uint32_t* highWater)
+{
+    *dropped = lmicEventsDropped;
+    *highWater = lmicEventQueueHighWater;
+}
+
+void TheThingsNetwork::getSpiStats(uint32_t* transactions, uint32_t* averageTime, uint32_t* maxTime)
+{
+    uint32_t totalTime;
+    ttn_hal.getSpiStats(transactions, &totalTime, maxTime);
+    *averageTime = *transactions != 0 ? totalTime / *transactions : 0;
+}
+
+uint32_t TheThingsNetwork::radioInterruptCount()
+{
+    return ttn_hal.dioInterruptCount();
+}
+
+void TheThingsNetwork::getStatistics(TTNStatistics* stats)
+{
+    ttn_stats_collector.getStatistics(stats);
+}
+
+bool TheThingsNetwork::getLastUplinkTrace(TTNUplinkTrace* trace)
+{
+    return ttn_latency_tracer.getLastTrace(trace);
+}
+
+bool TheThingsNetwork::getLatencyHistogram(TTNLatencyStage stage, TTNLatencyHistogram* histogram)
+{
+    return ttn_latency_tracer.getHistogram(stage, histogram);
+}
+
+void TheThingsNetwork::resetLatencyHistograms()
+{
+    ttn_latency_tracer.resetHistograms();
+}
+
+void TheThingsNetwork::setCurrentModel(const TTNCurrentModel& model)
+{
+    ttn_energy_meter.setModel(model);
+}
+
+void TheThingsNetwork::getEnergyStats(TTNEnergyStats* stats)
+{
+    ttn_energy_meter.getStats(stats);
+}
+
+void TheThingsNetwork::resetEnergyStats()
+{
+    ttn_energy_meter.reset();
+}
+
 void TheThingsNetwork::onMessage(TTNMessageCallback callback)
 {
     messageCallback = callback;
 }
 
+void TheThingsNetwork::onDownlink(TTNDownlinkCallback callback, void* userData)
+{
+    downlinkCallbackUserData = userData;
+    downlinkCallback = callback;
+}
+
+void TheThingsNetwork::getDownlinkPoolStats(uint32_t* dropped, uint32_t* highWater)
+{
+    ttn_downlink_pool.getStats(dropped, highWater);
+}
+
+void TheThingsNetwork::onEvent(TTNEventCallback callback, void* userData)
+{
+    eventObserverUserData = userData;
+    eventObserver = callback;
+}
+
+void TheThingsNetwork::onFatalError(TTNFatalErrorCallback callback)
+{
+    ttn_hal.fatalErrorCallback = callback;
+}
+
 
 bool TheThingsNetwork::isProvisioned()
 {
@@ -276,12 +591,63 @@ const char *eventNames[] = { LMIC_EVENT_NAME_TABLE__INIT };
 // Called by LMIC when an LMIC event (join, join failed, reset etc.) occurs
 void eventCallback(void* userData, ev_t event)
 {
+    // application callbacks and NVS writes follow
+    ttn_hal.releaseSpiBus();
+
 #if LMIC_ENABLE_event_logging
     logging->logEvent(event, eventNames[event], 0);
 #elif CONFIG_LOG_DEFAULT_LEVEL >= 3
     ESP_LOGI(TAG, "event %s", eventNames[event]);
 #endif
 
+    if (eventObserver != nullptr)
+        eventObserver(event, eventObserverUserData);
+
+    // queued messages wait for the join and for manually submitted messages
+    if (event == EV_JOINED || event == EV_TXCOMPLETE)
+    {
+        recordCompletion(event);
+        ttn_session.save();
+        ttn_hal.enterCriticalSection();
+        if (event == EV_JOINED)
+            ttn_frame_counters.joined();
+        else
+            ttn_frame_counters.transmitted();
+        ttn_tx_queue.scheduleDrain();
+        ttn_hal.leaveCriticalSection();
+        ttn_downlink_drain.check();
+    }
+    else if (event == EV_TXSTART)
+    {
+        // LMIC has already advanced the uplink counter; a reset during the
+        // RX windows must not restore the counter of the frame being sent
+        ttn_session.save();
+        ttn_stats_collector.transmissionStarted();
+        ttn_airtime.transmissionStarted();
+        ttn_tx_queue.transmissionStarted();
+        ttn_retry_engine.transmissionStarted();
+        ttn_latency_tracer.transmissionStarted();
+    }
+    else if (event == EV_RXSTART)
+    {
+        ttn_latency_tracer.windowOpened();
+    }
+    else if (event == EV_JOIN_TXCOMPLETE)
+    {
+        ttn_stats_collector.transmissionCompleted(false);
+    }
+    else if (event == EV_RXCOMPLETE)
+    {
+        // downlink outside of the RX windows of an uplink (Class B or C)
+        ttn_stats_collector.frameReceived(true);
+        ttn_session.save();
+        ttn_downlink_drain.check();
+    }
+    else
+    {
+        reportBeaconEvent(event);
+    }
+
     TTNEvent ttnEvent = eEvtNone;
 
     if (waitingReason == eWaitingForJoin)
@@ -290,6 +656,13 @@ void eventCallback(void* userData, ev_t event)
         {
             ttnEvent = eEvtJoinCompleted;
         }
+        else if (event == EV_JOIN_FAILED)
+        {
+            // LMIC would start the next join cycle with the engine update following
+            // this event; stop it here and leave the retries to the caller
+            LMIC.opmode &= ~OP_JOINING;
+            ttnEvent = eEvtJoinFailed;
+        }
         else if (event == EV_REJOIN_FAILED || event == EV_RESET)
         {
             ttnEvent = eEvtJoinFailed;
@@ -301,23 +674,146 @@ void eventCallback(void* userData, ev_t event)
 
     TTNLmicEvent result(ttnEvent);
     waitingReason = eWaitingNone;
-    xQueueSend(lmicEventQueue, &result, pdMS_TO_TICKS(100));
+    postLmicEvent(&result);
 }
 
 // Called by LMIC when a message has been received
 void messageReceivedCallback(void *userData, uint8_t port, const uint8_t *message, size_t nMessage)
 {
+    ttn_hal.releaseSpiBus();
+
+    // resend requests of a fragmented transfer are not passed on
+    if (ttn_fragmenter.handleDownlink(port, message, nMessage))
+        return;
+
+    bool isWaiting = ttn_tx_queue.isInFlight(messageTransmittedCallback);
+
+    // without pooled delivery, downlinks following a queued message are passed
+    // to the message callback directly; LMIC's frame buffer is valid until it returns
+    if (!isWaiting && downlinkCallback == nullptr)
+    {
+        if (messageCallback != nullptr)
+            messageCallback(message, nMessage, port);
+        return;
+    }
+
+    // copy the message once, out of LMIC's frame buffer
+    TTNDownlink* downlink = ttn_downlink_pool.allocate(port, message, nMessage);
+    if (downlink == nullptr)
+        return;
+
+    if (!isWaiting)
+    {
+        downlinkCallback(downlink, downlinkCallbackUserData);
+        return;
+    }
+
     TTNLmicEvent result(eEvtMessageReceived);
-    result.port = port;
-    result.message = message;
-    result.messageSize = nMessage;
-    xQueueSend(lmicEventQueue, &result, pdMS_TO_TICKS(100));
+    result.downlink = downlink;
+    postLmicEvent(&result);
+}
+
+// Passes a pooled downlink to the application and takes care of releasing it
+void deliverDownlink(TTNDownlink* downlink)
+{
+    if (downlinkCallback != nullptr)
+    {
+        downlinkCallback(downlink, downlinkCallbackUserData);
+        return;
+    }
+
+    if (messageCallback != nullptr)
+        messageCallback(downlink->payload, downlink->length, downlink->port);
+    downlink->release();
 }
 
-// Called by LMIC when a message has been transmitted (or the transmission failed)
-void messageTransmittedCallback(void *userData, int success)
+// Called by the transmit queue when the message of 'transmitMessage' has been
+// transmitted (or the transmission failed)
+void messageTransmittedCallback(TTNResponseCode code, void *userData)
 {
     waitingReason = eWaitingNone;
-    TTNLmicEvent result(success ? eEvtTransmissionCompleted : eEvtTransmissionFailed);
-    xQueueSend(lmicEventQueue, &result, pdMS_TO_TICKS(100));
+    TTNLmicEvent result(code == kTTNSuccessfulTransmission ? eEvtTransmissionCompleted : eEvtTransmissionFailed);
+    postLmicEvent(&result);
+}
+
+// Passes an event to the waiting client task without blocking the LMIC task.
+// If the client task does not keep up, the oldest event is dropped.
+void postLmicEvent(const TTNLmicEvent* event)
+{
+    if (xQueueSend(lmicEventQueue, event, 0) != pdTRUE)
+    {
+        TTNLmicEvent oldest;
+        if (xQueueReceive(lmicEventQueue, &oldest, 0) == pdTRUE && oldest.event == eEvtMessageReceived)
+            oldest.downlink->release();
+        lmicEventsDropped++;
+        xQueueSend(lmicEventQueue, event, 0);
+    }
+
+    uint32_t waiting = uxQueueMessagesWaiting(lmicEventQueue);
+    if (waiting > lmicEventQueueHighWater)
+        lmicEventQueueHighWater = waiting;
+}
+
+// Empties the event queue, returning the buffers of pending downlinks to the pool
+void discardLmicEvents()
+{
+    TTNLmicEvent event;
+    while (xQueueReceive(lmicEventQueue, &event, 0) == pdTRUE)
+    {
+        if (event.event == eEvtMessageReceived)
+            event.downlink->release();
+    }
+}
+
+// Updates the statistics with the outcome of a join or transmission
+void recordCompletion(ev_t event)
+{
+    if (event == EV_JOINED)
+    {
+        ttn_stats_collector.frameReceived(false);
+        ttn_stats_collector.transmissionCompleted(true);
+        return;
+    }
+
+    if ((LMIC.txrxFlags & (TXRX_DNW1 | TXRX_DNW2)) != 0)
+        ttn_stats_collector.frameReceived(true);
+    ttn_stats_collector.transmissionCompleted((LMIC.txrxFlags & (TXRX_NACK | TXRX_LENERR)) == 0);
+}
+
+// Passes Class B beacon events to the application
+void reportBeaconEvent(ev_t event)
+{
+#if !defined(DISABLE_BEACONS)
+    TTNBeaconEvent beaconEvent;
+    switch (event)
+    {
+        case EV_BEACON_FOUND:
+            beaconEvent = kTTNBeaconFound;
+            break;
+        case EV_SCAN_TIMEOUT:
+            beaconEvent = kTTNBeaconNotFound;
+            break;
+        case EV_BEACON_TRACKED:
+            beaconEvent = kTTNBeaconTracked;
+            break;
+        case EV_BEACON_MISSED:
+            beaconEvent = kTTNBeaconMissed;
+            break;
+        case EV_LOST_TSYNC:
+            beaconEvent = kTTNBeaconLost;
+            break;
+        default:
+            return;
+    }
+
+    if (beaconCallback == nullptr)
+        return;
+
+    TTNBeaconInfo info;
+    info.gpsTime = LMIC.bcninfo.time;
+    info.rssi = LMIC.bcninfo.rssi - RSSI_OFF;
+    info.snr = (LMIC.bcninfo.snr + (LMIC.bcninfo.snr < 0 ? -2 : 2)) / SNR_SCALEUP;
+    info.missedBeacons = LMIC.missedBcns;
+    beaconCallback(beaconEvent, &info, beaconCallbackUserData);
+#endif
 }
@@ -65,6 +65,11 @@
 
 #define LMIC_ENABLE_onEvent 0
 
-#define DISABLE_PING
+#if defined(CONFIG_TTN_NETWORK_TIME)
+#define LMIC_ENABLE_DeviceTimeReq 1
+#endif
 
+#if !defined(CONFIG_TTN_CLASS_B)
+#define DISABLE_PING
 #define DISABLE_BEACONS
+#endif
@@ -34,14 +34,19 @@ HAL_ESP32 ttn_hal;
 TaskHandle_t HAL_ESP32::lmicTask = nullptr;
 uint32_t HAL_ESP32::dioInterruptTime = 0;
 uint8_t HAL_ESP32::dioNum = 0;
+uint32_t HAL_ESP32::dioInterrupts = 0;
 
 
 // -----------------------------------------------------------------------------
 // Constructor
 
 HAL_ESP32::HAL_ESP32()
-    : rssiCal(10), nextAlarm(0)
+    : rssiCal(10), fatalErrorCallback(nullptr), spiBusAcquired(false), spiTransactions(0),
+      spiTotalTime(0), spiMaxTime(0), nextAlarm(0), radioModeTimes(), txPowerTimes(),
+      radioMode(0), radioTxPower(0), radioModeSince(0), busyTime(0), busySince(0)
 {    
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    activityLock = unlocked;
 }
 
 // -----------------------------------------------------------------------------
@@ -66,12 +71,25 @@ void IRAM_ATTR HAL_ESP32::dioIrqHandler(void *arg)
 {
     dioInterruptTime = hal_ticks();
     dioNum = (u1_t)(long)arg;
+    dioInterrupts++;
     BaseType_t higherPrioTaskWoken = pdFALSE;
     xTaskNotifyFromISR(lmicTask, NOTIFY_BIT_DIO, eSetBits, &higherPrioTaskWoken);
     if (higherPrioTaskWoken)
         portYIELD_FROM_ISR();
 }
 
+// Gets the number of DIO interrupts since startup
+uint32_t HAL_ESP32::dioInterruptCount()
+{
+    return dioInterrupts;
+}
+
+// Gets the time of the most recent DIO interrupt, in LMIC ticks
+uint32_t HAL_ESP32::lastDioInterruptTime()
+{
+    return dioInterruptTime;
+}
+
 void HAL_ESP32::ioInit()
 {
     // pinNSS and pinDIO0 and pinDIO1 are required
@@ -149,12 +167,85 @@ bit_t hal_queryUsingTcxo(void)
     return false;
 }
 
+void hal_radioModeChanged(u1_t mode, s1_t txpow)
+{
+    ttn_hal.radioModeChanged(mode, txpow);
+}
+
 uint8_t hal_getTxPowerPolicy(u1_t inputPolicy, s1_t requestedPower, u4_t frequency)
 {
     return LMICHAL_radio_tx_power_policy_paboost;
 }
 
 
+// -----------------------------------------------------------------------------
+// Activity time accounting
+
+// Accounts the time spent in the previous radio mode
+void HAL_ESP32::radioModeChanged(uint8_t mode, int8_t txPower)
+{
+    int64_t now = esp_timer_get_time();
+    if (txPower < 0)
+        txPower = 0;
+    else if (txPower >= HAL_TX_POWER_LEVELS)
+        txPower = HAL_TX_POWER_LEVELS - 1;
+
+    portENTER_CRITICAL(&activityLock);
+    if (radioModeSince != 0)
+    {
+        radioModeTimes[radioMode] += now - radioModeSince;
+        if (radioMode == HAL_RADIO_MODE_TX)
+            txPowerTimes[radioTxPower] += now - radioModeSince;
+    }
+    radioMode = mode;
+    radioTxPower = txPower;
+    radioModeSince = now;
+    portEXIT_CRITICAL(&activityLock);
+}
+
+// Starts counting busy time. Called by the LMIC task when it starts or resumes.
+void HAL_ESP32::lmicTaskResumed()
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&activityLock);
+    busySince = now;
+    portEXIT_CRITICAL(&activityLock);
+}
+
+// Stops counting busy time. Called by the LMIC task before it blocks,
+// i.e. waits for an event or for the mutex.
+void HAL_ESP32::lmicTaskBlocked()
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&activityLock);
+    if (busySince != 0)
+        busyTime += now - busySince;
+    busySince = 0;
+    portEXIT_CRITICAL(&activityLock);
+}
+
+// Gets the time spent in each radio mode, at each TX power level and
+// the time the LMIC task has been busy, including the current periods
+void HAL_ESP32::getActivityTimes(int64_t* modeTimes, int64_t* powerTimes, int64_t* busy)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&activityLock);
+    for (int i = 0; i < HAL_RADIO_MODES; i++)
+        modeTimes[i] = radioModeTimes[i];
+    for (int i = 0; i < HAL_TX_POWER_LEVELS; i++)
+        powerTimes[i] = txPowerTimes[i];
+    if (radioModeSince != 0)
+    {
+        modeTimes[radioMode] += now - radioModeSince;
+        if (radioMode == HAL_RADIO_MODE_TX)
+            powerTimes[radioTxPower] += now - radioModeSince;
+    }
+    *busy = busySince != 0 ? busyTime + now - busySince : busyTime;
+    portEXIT_CRITICAL(&activityLock);
+}
+
+
 // -----------------------------------------------------------------------------
 // SPI
 
@@ -174,6 +265,9 @@ void HAL_ESP32::spiInit()
     esp_err_t ret = spi_bus_add_device(spiHost, &spiConfig, &spiHandle);
     ESP_ERROR_CHECK(ret);
 
+    // the fields not set per transaction remain zero
+    memset(&spiTransaction, 0, sizeof(spiTransaction));
+
     ESP_LOGI(TAG, "SPI initialized");
 }
 
@@ -184,12 +278,12 @@ void hal_spi_write(u1_t cmd, const u1_t *buf, size_t len)
 
 void HAL_ESP32::spiWrite(uint8_t cmd, const uint8_t *buf, size_t len)
 {
-    memset(&spiTransaction, 0, sizeof(spiTransaction));
     spiTransaction.addr = cmd;
     spiTransaction.length = 8 * len;
+    spiTransaction.rxlength = 0;
     spiTransaction.tx_buffer = buf;
-    esp_err_t err = spi_device_transmit(spiHandle, &spiTransaction);
-    ESP_ERROR_CHECK(err);
+    spiTransaction.rx_buffer = nullptr;
+    spiTransmit();
 }
 
 void hal_spi_read(u1_t cmd, u1_t *buf, size_t len)
@@ -199,15 +293,60 @@ void hal_spi_read(u1_t cmd, u1_t *buf, size_t len)
 
 void HAL_ESP32::spiRead(uint8_t cmd, uint8_t *buf, size_t len)
 {
-    memset(buf, 0, len);
-    memset(&spiTransaction, 0, sizeof(spiTransaction));
+    // the radio ignores the bytes sent while reading
     spiTransaction.addr = cmd;
     spiTransaction.length = 8 * len;
     spiTransaction.rxlength = 8 * len;
     spiTransaction.tx_buffer = buf;
     spiTransaction.rx_buffer = buf;
-    esp_err_t err = spi_device_transmit(spiHandle, &spiTransaction);
+    spiTransmit();
+}
+
+// Executes the prepared transaction by polling. The transactions are a few bytes
+// long, so waiting for an interrupt and a context switch would take longer.
+void HAL_ESP32::spiTransmit()
+{
+    if (!spiBusAcquired && xTaskGetCurrentTaskHandle() == lmicTask)
+        acquireSpiBus();
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = spi_device_polling_transmit(spiHandle, &spiTransaction);
     ESP_ERROR_CHECK(err);
+    uint32_t duration = (uint32_t)(esp_timer_get_time() - start);
+
+    spiTransactions++;
+    spiTotalTime += duration;
+    if (duration > spiMaxTime)
+        spiMaxTime = duration;
+}
+
+// Keeps the SPI bus for the radio for the register accesses of one LMIC job or
+// radio interrupt, instead of acquiring it for each transaction.
+void HAL_ESP32::acquireSpiBus()
+{
+    esp_err_t err = spi_device_acquire_bus(spiHandle, portMAX_DELAY);
+    ESP_ERROR_CHECK(err);
+    spiBusAcquired = true;
+}
+
+// Releases the SPI bus at the end of a job or interrupt, before the LMIC task
+// blocks and before it calls into application code. The next register access
+// acquires it again. Calls from other tasks are ignored.
+void HAL_ESP32::releaseSpiBus()
+{
+    if (!spiBusAcquired || xTaskGetCurrentTaskHandle() != lmicTask)
+        return;
+    spi_device_release_bus(spiHandle);
+    spiBusAcquired = false;
+}
+
+// Gets the number of SPI transactions and their duration (in µs).
+// The values are updated without lock and may be slightly inconsistent.
+void HAL_ESP32::getSpiStats(uint32_t* transactions, uint32_t* totalTime, uint32_t* maxTime)
+{
+    *transactions = spiTransactions;
+    *totalTime = spiTotalTime;
+    *maxTime = spiMaxTime;
 }
 
 // -----------------------------------------------------------------------------
@@ -299,7 +438,13 @@ bool HAL_ESP32::wait(WaitKind waitKind)
     TickType_t ticksToWait = waitKind == CHECK_IO ? 0 : portMAX_DELAY;
     while (true)
     {
+        if (ticksToWait != 0)
+            releaseSpiBus();
+
+        lmicTaskBlocked();
         uint32_t bits = ulTaskNotifyTake(pdTRUE, ticksToWait);
+        lmicTaskResumed();
+
         if (bits == 0)
             return false;
 
@@ -325,6 +470,7 @@ bool HAL_ESP32::wait(WaitKind waitKind)
             enterCriticalSection();
             radio_irq_handler_v2(dioNum, dioInterruptTime);
             leaveCriticalSection();
+            releaseSpiBus();
             if (waitKind != WAIT_FOR_TIMER)
                 return true;
         }
@@ -431,7 +577,19 @@ void HAL_ESP32::initCriticalSection()
 
 void HAL_ESP32::enterCriticalSection()
 {
+    if (xSemaphoreTakeRecursive(mutex, 0) == pdTRUE)
+        return;
+
+    // waiting for the mutex neither counts as busy time nor keeps the SPI bus
+    bool isLmicTask = xTaskGetCurrentTaskHandle() == lmicTask;
+    if (isLmicTask)
+    {
+        releaseSpiBus();
+        lmicTaskBlocked();
+    }
     xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+    if (isLmicTask)
+        lmicTaskResumed();
 }
 
 void HAL_ESP32::leaveCriticalSection()
@@ -442,7 +600,13 @@ void HAL_ESP32::leaveCriticalSection()
 // -----------------------------------------------------------------------------
 
 void HAL_ESP32::lmicBackgroundTask(void* pvParameter) {
-    os_runloop();
+    ttn_hal.lmicTaskResumed();
+    while (true)
+    {
+        os_runloop_once();
+        // the SPI bus is kept for one job at most
+        ttn_hal.releaseSpiBus();
+    }
 }
 
 void hal_init_ex(const void *pContext)
@@ -484,6 +648,9 @@ void hal_failed(const char *file, u2_t line)
     if (custom_hal_failure_handler != nullptr)
         (*custom_hal_failure_handler)(file, line);
 
+    if (ttn_hal.fatalErrorCallback != nullptr)
+        ttn_hal.fatalErrorCallback(file, line);
+
     ESP_LOGE(TAG, "LMIC failed and stopped: %s:%d", file, line);
 
     // go to sleep forever
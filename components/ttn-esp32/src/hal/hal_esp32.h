@@ -23,6 +23,14 @@
 #include <esp_timer.h>
 
 
+// Number of radio operating modes (OPMODE_SLEEP to OPMODE_CAD)
+#define HAL_RADIO_MODES 8
+// Radio operating mode while transmitting (OPMODE_TX)
+#define HAL_RADIO_MODE_TX 3
+// Number of TX power levels with separate time accounting (0 to 20 dBm)
+#define HAL_TX_POWER_LEVELS 21
+
+
 enum WaitKind {
     CHECK_IO,
     WAIT_FOR_ANY_EVENT,
@@ -44,6 +52,7 @@ public:
     void initCriticalSection();
     void enterCriticalSection();
     void leaveCriticalSection();
+    void releaseSpiBus();
 
     void spiWrite(uint8_t cmd, const uint8_t *buf, size_t len);
     void spiRead(uint8_t cmd, uint8_t *buf, size_t len);
@@ -51,6 +60,11 @@ public:
     void sleep();
     
     uint32_t waitUntil(uint32_t osTime);
+    uint32_t lastDioInterruptTime();
+    uint32_t dioInterruptCount();
+    void radioModeChanged(uint8_t mode, int8_t txPower);
+    void getActivityTimes(int64_t* radioModeTimes, int64_t* txPowerTimes, int64_t* busyTime);
+    void getSpiStats(uint32_t* transactions, uint32_t* totalTime, uint32_t* maxTime);
 
     spi_host_device_t spiHost;
     gpio_num_t pinNSS;
@@ -59,6 +73,7 @@ public:
     gpio_num_t pinDIO0;
     gpio_num_t pinDIO1;
     int8_t rssiCal;
+    void (*fatalErrorCallback)(const char* file, uint16_t line);
 
 private:
     static void lmicBackgroundTask(void* pvParameter);
@@ -68,22 +83,41 @@ private:
 
     void ioInit();
     void spiInit();
+    void spiTransmit();
+    void acquireSpiBus();
     void timerInit();
 
     void setNextAlarm(int64_t time);
     void armTimer(int64_t espNow);
     void disarmTimer();
     bool wait(WaitKind waitKind);
+    void lmicTaskBlocked();
+    void lmicTaskResumed();
 
     static TaskHandle_t lmicTask;
     static uint32_t dioInterruptTime;
     static uint8_t dioNum;
+    static uint32_t dioInterrupts;
 
     spi_device_handle_t spiHandle;
     spi_transaction_t spiTransaction;
+    bool spiBusAcquired;
+    uint32_t spiTransactions;
+    uint32_t spiTotalTime; // in µs
+    uint32_t spiMaxTime;   // in µs
     SemaphoreHandle_t mutex;
     esp_timer_handle_t timer;
     int64_t nextAlarm;
+
+    // time accounting for energy estimation (in µs)
+    portMUX_TYPE activityLock;
+    int64_t radioModeTimes[HAL_RADIO_MODES];
+    int64_t txPowerTimes[HAL_TX_POWER_LEVELS];
+    uint8_t radioMode;
+    uint8_t radioTxPower;
+    int64_t radioModeSince;
+    int64_t busyTime;
+    int64_t busySince; // 0 while the LMIC task is blocked or not running
 };
 
 extern HAL_ESP32 ttn_hal;
@@ -151,6 +151,13 @@ ostime_t hal_setModuleActive (bit_t val);
 /* find out if we're using Tcxo */
 bit_t hal_queryUsingTcxo(void);
 
+/*
+ * notify the HAL of a change of the radio operating mode
+ *   - mode is the new mode (OPMODE_SLEEP ... OPMODE_CAD)
+ *   - txpow is the effective TX power in dBm configured for the next transmission
+ */
+void hal_radioModeChanged(u1_t mode, s1_t txpow);
+
 /* represent the various radio TX power policy */
 enum	{
 	LMICHAL_radio_tx_power_policy_rfo	= 0,
@@ -441,6 +441,7 @@ static bit_t setDrTxpow (u1_t reason, u1_t dr, s1_t pow) {
 #if !defined(DISABLE_PING)
 void LMIC_stopPingable (void) {
     LMIC.opmode &= ~(OP_PINGABLE|OP_PINGINI);
+    LMIC.pingSlotInfoReq = 0;
 }
 
 
@@ -448,6 +449,8 @@ void LMIC_setPingable (u1_t intvExp) {
     // Change setting
     LMIC.ping.intvExp = (intvExp & 0x7);
     LMIC.opmode |= OP_PINGABLE;
+    // Tell the network about the periodicity with the next uplink
+    LMIC.pingSlotInfoReq = 1;
     // App may call LMIC_enableTracking() explicitely before
     // Otherwise tracking is implicitly enabled here
     if( (LMIC.opmode & (OP_TRACK|OP_SCAN)) == 0  &&  LMIC.bcninfoTries == 0 )
@@ -632,13 +635,10 @@ static lmic_beacon_error_t decodeBeacon (void) {
     xref2u1_t d = LMIC.frame;
     if(! LMICbandplan_isValidBeacon1(d))
         return LMIC_BEACON_ERROR_INVALID;   // first (common) part fails CRC check
-    // First set of fields is ok
-    u4_t bcnnetid = os_rlsbf4(&d[OFF_BCN_NETID]) & 0xFFFFFF;
-    if( bcnnetid != LMIC.netid )
-        return LMIC_BEACON_ERROR_WRONG_NETWORK;  // not the beacon we're looking for
-
+    // First set of fields is ok. Since LoRaWAN 1.0.3, beacons carry no NetID,
+    // so any valid beacon provides the time reference.
     LMIC.bcninfo.flags &= ~(BCN_PARTIAL|BCN_FULL);
-    // Match - update bcninfo structure
+    // Update bcninfo structure
     LMIC.bcninfo.snr    = LMIC.snr;
     LMIC.bcninfo.rssi   = LMIC.rssi;
     LMIC.bcninfo.txtime = LMIC.rxtime - AIRTIME_BCN_osticks;
@@ -646,7 +646,8 @@ static lmic_beacon_error_t decodeBeacon (void) {
     LMIC.bcninfo.flags |= BCN_PARTIAL;
 
     // Check 2nd set
-    if( os_rlsbf2(&d[OFF_BCN_CRC2]) != os_crc16(d,OFF_BCN_CRC2) )
+    // the second CRC only covers the gateway specific part (and RFU)
+    if( os_rlsbf2(&d[OFF_BCN_CRC2]) != os_crc16(&d[OFF_BCN_INFO], OFF_BCN_CRC2-OFF_BCN_INFO) )
         return LMIC_BEACON_ERROR_SUCCESS_PARTIAL;
     // Second set of fields is ok
     LMIC.bcninfo.lat    = (s4_t)os_rlsbf4(&d[OFF_BCN_LAT-1]) >> 8; // read as signed 24-bit
@@ -1070,6 +1071,13 @@ scan_mac_cmds(
         }
 #endif // !DISABLE_MCMD_PingSlotChannelReq && !DISABLE_PING
 
+#if !defined(DISABLE_PING)
+        case MCMD_PingSlotInfoAns: {
+            LMIC.pingSlotInfoReq = 0;
+            break;
+        } /* end case */
+#endif // !DISABLE_PING
+
 #if defined(ENABLE_MCMD_BeaconTimingAns) && !defined(DISABLE_BEACONS)
         case MCMD_BeaconTimingAns: {
             // Ignore if tracking already enabled or bcninfoTries == 0
@@ -1303,7 +1311,9 @@ static bit_t decodeFrame (void) {
         goto norx;
     }
 
-    if( LMIC.dnConf || (fct & FCT_MORE) )
+    // The client decides whether to poll for further pending downlinks
+    LMIC.moreData = (fct & FCT_MORE) != 0 ? 1 : 0;
+    if( LMIC.dnConf )
         LMIC.opmode |= OP_POLL;
 
     // We heard from network
@@ -1902,6 +1912,13 @@ static bit_t buildDataFrame (void) {
         LMIC.txDeviceTimeReqState = lmic_RequestTimeState_rx;
     }
 #endif // LMIC_ENABLE_DeviceTimeReq
+#if !defined(DISABLE_PING)
+    if ( LMIC.pingSlotInfoReq ) {
+        LMIC.frame[end+0] = MCMD_PingSlotInfoReq;
+        LMIC.frame[end+1] = LMIC.ping.intvExp;
+        end += 2;
+    }
+#endif // !DISABLE_PING
 #if !defined(DISABLE_BEACONS) && defined(ENABLE_MCMD_BeaconTimingAns)
     if ( LMIC.bcninfoTries > 0 ) {
         LMIC.frame[end+0] = MCMD_BeaconInfoReq;
@@ -1937,11 +1954,20 @@ static bit_t buildDataFrame (void) {
     }
 
     LMIC.frame[OFF_DAT_HDR] = HDR_FTYPE_DAUP | HDR_MAJOR_V1;
-    LMIC.frame[OFF_DAT_FCT] = (LMIC.dnConf | LMIC.adrEnabled
+    u1_t classB = 0;
+#if !defined(DISABLE_PING)
+    // announce Class B once the beacon is tracked
+    if( (LMIC.opmode & (OP_TRACK|OP_PINGABLE)) == (OP_TRACK|OP_PINGABLE) )
+        classB = FCT_CLASSB;
+#endif // !DISABLE_PING
+    LMIC.frame[OFF_DAT_FCT] = (LMIC.dnConf | LMIC.adrEnabled | classB
                               | (sendAdrAckReq() ? FCT_ADRACKReq : 0)
                               | (end-OFF_DAT_OPTS));
     os_wlsbf4(LMIC.frame+OFF_DAT_ADDR,  LMIC.devaddr);
 
+    // until the network indicates otherwise in a downlink
+    LMIC.moreData = 0;
+
     if( LMIC.txCnt == 0 && LMIC.upRepeatCount == 0 ) {
         LMIC.seqnoUp += 1;
         DO_DEVDB(LMIC.seqnoUp,seqnoUp);
@@ -2038,6 +2064,8 @@ static void startScan (void) {
         return;
     // Cancel onging TX/RX transaction
     LMIC.txCnt = LMIC.dnConf = LMIC.bcninfo.flags = 0;
+    // the scan takes over the radio from Class C reception
+    LMIC.rxcActive = 0;
     LMIC.opmode = (LMIC.opmode | OP_SCAN) & ~(OP_TXRXPEND);
     LMICbandplan_setBcnRxParams();
     LMIC.rxtime = LMIC.bcninfo.txtime = os_getTime() + sec2osticks(BCN_INTV_sec+1);
@@ -2058,7 +2086,13 @@ bit_t LMIC_enableTracking (u1_t tryBcnInfo) {
 
 
 void LMIC_disableTracking (void) {
-    LMIC.opmode &= ~(OP_SCAN|OP_TRACK);
+    // stop a beacon scan or a scheduled beacon/ping reception;
+    // engineUpdate() reschedules anything else
+    if( (LMIC.opmode & OP_TXRXPEND) == 0 ) {
+        os_radio(RADIO_RST);
+        os_clearCallback(&LMIC.osjob);
+    }
+    LMIC.opmode &= ~(OP_SCAN|OP_TRACK|OP_PINGINI);
     LMIC.bcninfoTries = 0;
     engineUpdate();
 }
@@ -2204,6 +2238,58 @@ static void processPingRx (xref2osjob_t osjob) {
 }
 #endif // !DISABLE_PING
 
+// ================================================================================
+//
+// Class C: receive on the RX2 frequency and data rate while no uplink is on air
+//
+// ================================================================================
+
+static void stopRxC (void) {
+    if (LMIC.rxcActive) {
+        LMIC.rxcActive = 0;
+        os_radio(RADIO_RST);
+    }
+}
+
+static void processRxC (xref2osjob_t osjob) {
+    LMIC_API_PARAMETER(osjob);
+
+    // reception was stopped after the frame had been read
+    if (! LMIC.rxcActive)
+        return;
+
+    if( LMIC.dataLen == 0 ) {
+        // the pending uplink is due (or an invalid frame was received):
+        // stop listening and let the engine decide
+        stopRxC();
+        engineUpdate();
+        return;
+    }
+
+    LMIC.rxcActive = 0;
+    initTxrxFlags(__func__, TXRX_DNW2);
+    if( decodeFrame() ) {
+        reportEventNoUpdate(EV_RXCOMPLETE);
+    }
+    // resume listening
+    engineUpdate();
+}
+
+static void startRxC (void) {
+    LMIC.freq    = LMIC.dn2Freq;
+    LMIC.rps     = dndr2rps(LMIC.dn2Dr);
+    LMIC.dataLen = 0;
+    LMIC.rxcActive = 1;
+    LMIC.osjob.func = FUNC_ADDR(processRxC);
+    os_radio(RADIO_RXON);
+}
+
+void LMIC_setClassC (bit_t enabled) {
+    LMIC.classC = enabled ? 1 : 0;
+    stopRxC();
+    engineUpdate();
+}
+
 // process downlink data at close of RX window.  Return zero if another RX window
 // should be scheduled, non-zero to prevent scheduling of RX2 (if relevant).
 // Confusingly, the caller actualyl does some of the calculation, so the answer from
@@ -2271,7 +2357,7 @@ static bit_t processDnData (void) {
 // nothing was received this window.
 static bit_t processDnData_norx(void) {
     if( LMIC.txCnt != 0 ) {
-        if( LMIC.txCnt < TXCONF_ATTEMPTS ) {
+        if( LMIC.txCnt < (LMIC.txConfAttempts != 0 ? LMIC.txConfAttempts : TXCONF_ATTEMPTS) ) {
             // Per [1.0.3] section 18.4, it is recommended that the device adjust datarate down.
             // The spec is not clear about what should happen in case the data size is too large
             // for the new frame len, but it seems that we should leave theframe len at the new
@@ -2280,7 +2366,7 @@ static bit_t processDnData_norx(void) {
             LMIC.txCnt += 1;
             // becase txCnt was at least 1 when we entered this branch, this if() will be taken
             // for txCnt == 3, 5, 7.
-            if (LMIC.txCnt & 1) {
+            if ((LMIC.txCnt & 1) && !LMIC.txConfNoDrFallback) {
                 dr_t adjustedDR;
                 // lower DR
                 adjustedDR = decDR(LMIC.datarate);
@@ -2289,7 +2375,10 @@ static bit_t processDnData_norx(void) {
 
             // TODO(tmm@mcci.com): check feasibility of lower datarate
             // Schedule another retransmission
-            txDelay(LMIC.rxtime, RETRY_PERIOD_secs);
+            if (LMIC.txConfRetryDelay != 0)
+                txDelay(LMIC.rxtime + LMIC.txConfRetryDelay, 0);
+            else
+                txDelay(LMIC.rxtime, RETRY_PERIOD_secs);
             LMIC.opmode &= ~OP_TXRXPEND;
             engineUpdate();
             return 1;
@@ -2525,6 +2614,9 @@ static void engineUpdate_inner (void) {
 #if LMIC_DEBUG_LEVEL > 0
     LMIC_DEBUG_PRINTF("%"LMIC_PRId_ostime_t": engineUpdate, opmode=0x%x\n", os_getTime(), LMIC.opmode);
 #endif
+    // Class C reception is restarted below if there is still nothing to do
+    stopRxC();
+
     // Check for ongoing state: scan or TX/RX transaction
     if( (LMIC.opmode & (OP_SCAN|OP_TXRXPEND|OP_SHUTDOWN)) != 0 )
         return;
@@ -2653,15 +2745,26 @@ static void engineUpdate_inner (void) {
             return;
         }
         // Cannot yet TX
-        if( (LMIC.opmode & OP_TRACK) == 0 )
+        if( (LMIC.opmode & OP_TRACK) == 0 ) {
+            if( LMIC.classC && LMIC.devaddr != 0 ) {
+                // Class C: listen on RX2 until the uplink is due. The timed job shares
+                // LMIC.osjob with the reception; processRxC() handles both.
+                startRxC();
+                os_setTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(processRxC));
+                return;
+            }
             goto txdelay; // We don't track the beacon - nothing else to do - so wait for the time to TX
+        }
         // Consider RX tasks
         if( txbeg == 0 ) // zero indicates no TX pending
             txbeg += 1;  // TX delayed by one tick (insignificant amount of time)
     } else {
-        // No TX pending - no scheduled RX
-        if( (LMIC.opmode & OP_TRACK) == 0 )
+        // No TX pending - no scheduled RX (except for Class C)
+        if( (LMIC.opmode & OP_TRACK) == 0 ) {
+            if( LMIC.classC && LMIC.devaddr != 0 )
+                startRxC();
             return;
+        }
     }
 
 #if !defined(DISABLE_BEACONS)
@@ -2865,6 +2968,21 @@ dr_t LMIC_feasibleDataRateForFrame(dr_t dr, u1_t payloadSize) {
     return dr;
 }
 
+// return the largest application payload that fits into a frame at the
+// given data rate, or 0 if the data rate is not feasible.
+u1_t LMIC_maxPayloadForDataRate(dr_t dr) {
+    if (! LMICbandplan_isDataRateFeasible(dr))
+        return 0;
+
+    const u1_t maxFrameLen = LMICbandplan_maxFrameLen(dr);
+    const u1_t overhead = OFF_DAT_OPTS + 5;
+    if (maxFrameLen <= overhead)
+        return 0;
+
+    const u1_t maxPayload = maxFrameLen - overhead;
+    return maxPayload < MAX_LEN_PAYLOAD ? maxPayload : MAX_LEN_PAYLOAD;
+}
+
 static bit_t isTxPathBusy(void) {
     return (LMIC.opmode & (OP_TXDATA|OP_JOINING)) != 0;
 }
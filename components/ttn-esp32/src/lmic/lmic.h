@@ -486,6 +486,7 @@ struct lmic_t {
 
 #if !defined(DISABLE_PING)
     rxsched_t   ping;         // pingable setup
+    u1_t        pingSlotInfoReq; // send PingSlotInfoReq until answered
 #endif
 
     // the radio driver portable context
@@ -601,7 +602,7 @@ struct lmic_t {
     u1_t        margin;
     s1_t        devAnsMargin; // SNR value between -32 and 31 (inclusive) for the last successfully received DevStatusReq command
     u1_t        adrEnabled;
-    u1_t        moreData;     // NWK has more data pending
+    u1_t        moreData;     // NWK has more data pending (FPending of last downlink)
 #if LMIC_ENABLE_TxParamSetupReq
     u1_t        txParam;        // the saved TX param byte.
 #endif
@@ -632,6 +633,11 @@ struct lmic_t {
 #endif
     // Public part of MAC state
     u1_t        txCnt;
+    u1_t        txConfAttempts; // max transmit attempts for confirmed frames (0 ==> TXCONF_ATTEMPTS)
+    u1_t        txConfNoDrFallback; // don't lower the data rate for retransmissions of confirmed frames
+    ostime_t    txConfRetryDelay;   // delay of the next retransmission after RX (0 ==> random RETRY_PERIOD_secs)
+    u1_t        classC;     // listen on RX2 while no uplink is pending
+    u1_t        rxcActive;  // continuous RX2 reception in progress
     u1_t        txrxFlags;  // transaction flags (TX-RX combo)
     u1_t        dataBeg;    // 0 or start of data (dataBeg-1 is port)
     u1_t        dataLen;    // 0 no data or zero length data, >0 byte count of data
@@ -661,6 +667,7 @@ bit_t LMIC_selectSubBand(u1_t band);
 
 void  LMIC_setDrTxpow   (dr_t dr, s1_t txpow);  // set default/start DR/txpow
 void  LMIC_setAdrMode   (bit_t enabled);        // set ADR mode (if mobile turn off)
+void  LMIC_setClassC    (bit_t enabled);        // continuous RX2 reception between uplinks
 
 #if !defined(DISABLE_JOIN)
 bit_t LMIC_startJoining (void);
@@ -680,6 +687,8 @@ lmic_tx_error_t LMIC_setTxData2_strict(u1_t port, xref2u1_t data, u1_t dlen, u1_
 lmic_tx_error_t LMIC_sendWithCallback(u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed, lmic_txmessage_cb_t *pCb, void *pUserData);
 lmic_tx_error_t LMIC_sendWithCallback_strict(u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed, lmic_txmessage_cb_t *pCb, void *pUserData);
 void  LMIC_sendAlive    (void);
+dr_t  LMIC_feasibleDataRateForFrame(dr_t dr, u1_t payloadSize);
+u1_t  LMIC_maxPayloadForDataRate(dr_t dr);
 
 #if !defined(DISABLE_BEACONS)
 bit_t LMIC_enableTracking  (u1_t tryBcnInfo);
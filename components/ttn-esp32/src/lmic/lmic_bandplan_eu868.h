@@ -51,7 +51,7 @@ ostime_t LMICeu868_dr2hsym(uint8_t dr);
 // spec. https://github.com/mcci-catena/arduino-lmic/issues/18
 static inline int
 LMICeu868_isValidBeacon1(const uint8_t *d) {
-    return d[OFF_BCN_CRC1] != (u1_t)os_crc16(d, OFF_BCN_CRC1);
+    return os_rlsbf2(&d[OFF_BCN_CRC1]) == os_crc16(d, OFF_BCN_CRC1);
 }
 
 #undef LMICbandplan_isValidBeacon1
@@ -46,7 +46,7 @@
 // provide a default for LMICbandplan_isValidBeacon1()
 static inline int
 LMICeulike_isValidBeacon1(const uint8_t *d) {
-        return os_rlsbf2(&d[OFF_BCN_CRC1]) != os_crc16(d, OFF_BCN_CRC1);
+        return os_rlsbf2(&d[OFF_BCN_CRC1]) == os_crc16(d, OFF_BCN_CRC1);
 }
 
 #define LMICbandplan_isValidBeacon1(pFrame) LMICeulike_isValidBeacon1(pFrame)
@@ -49,7 +49,7 @@ void LMICuslike_initJoinLoop(void);
 // provide the isValidBeacon1 function -- int for bool.
 static inline int
 LMICuslike_isValidBeacon1(const uint8_t *d) {
-        return os_rlsbf2(&d[OFF_BCN_CRC1]) != os_crc16(d, OFF_BCN_CRC1);
+        return os_rlsbf2(&d[OFF_BCN_CRC1]) == os_crc16(d, OFF_BCN_CRC1);
 }
 
 #define LMICbandplan_isValidBeacon1(pFrame) LMICuslike_isValidBeacon1(pFrame)
@@ -16,6 +16,7 @@ Author:
 #include "lmic_util.h"
 
 #include <math.h>
+#include <string.h>
 
 /*
 
@@ -333,3 +334,296 @@ LMIC_f2uflt12(
                 return (uint16_t)((iExp << 8u) | outputFraction);
                 }
         }
+
+/*
+
+Name:   lmic_f2flt_nobranch()
+
+Function:
+        Common branch-free encoder behind the LMIC_f2?flt??_n() functions.
+
+Definition:
+        static inline uint16_t lmic_f2flt_nobranch(
+                float f,
+                unsigned nFrac,
+                uint16_t signBit
+                );
+
+Description:
+        Produces the same encoding as the scalar LMIC_f2?flt??() function
+        with the same layout (nFrac fraction bits, a 4-bit exponent, and
+        signBit as sign bit or zero for the unsigned formats), but works on
+        the IEEE-754 representation of f instead of calling frexpf(), and
+        selects the saturated and special results with conditional
+        expressions rather than early returns.  This lets the compiler
+        turn the loops in the array variants into SIMD code on the host.
+
+        The results are identical to the scalar encoders for all inputs
+        except subnormals (encoded as zero) and NaNs (encoded as the
+        saturated value with the NaN's sign).
+
+Returns:
+        The encoded value.
+
+*/
+
+static inline uint32_t
+lmic_float_bits(
+        float f
+        )
+        {
+        uint32_t bits;
+
+        memcpy(&bits, &f, sizeof(bits));
+        return bits;
+        }
+
+static inline float
+lmic_bits_float(
+        uint32_t bits
+        )
+        {
+        float f;
+
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+        }
+
+static inline uint16_t
+lmic_f2flt_nobranch(
+        float f,
+        unsigned nFrac,
+        uint16_t signBit
+        )
+        {
+        const uint32_t bits = lmic_float_bits(f);
+        const uint32_t isNegative = bits >> 31;
+        const uint32_t floatExp = (bits >> 23) & 0xFF;
+        const uint16_t maxMagnitude = (uint16_t)((1u << (nFrac + 4)) - 1);
+
+        // frexpf() would return the 24-bit significand scaled to [0.5, 1);
+        // round it to nFrac bits the same way, i.e. half up.
+        uint32_t outputFraction = (((bits & 0x7FFFFF) | 0x800000) + (1u << (23 - nFrac))) >> (24 - nFrac);
+
+        // rounding up to 1.0 carries into the exponent.
+        const uint32_t carry = outputFraction >> nFrac;
+        outputFraction >>= carry;
+
+        // the frexpf() exponent is floatExp - 126; bias it by 15 and
+        // clamp underflow at zero before adding the carry, like the
+        // scalar encoders.
+        int32_t iExp = (int32_t)floatExp - 126 + 15;
+        iExp = iExp < 0 ? 0 : iExp;
+        iExp += carry;
+
+        const uint16_t sign = (uint16_t)(isNegative * signBit);
+        uint16_t result = (uint16_t)(sign | ((uint32_t)iExp << nFrac) | outputFraction);
+
+        // overflow (including |f| >= 1.0, infinities and NaNs) saturates.
+        result = iExp > 15 ? (uint16_t)(maxMagnitude | sign) : result;
+
+        // frexpf(0) yields exponent 0, which the scalar encoders bias to 15
+        // with an empty fraction and no sign.
+        result = floatExp == 0 ? (uint16_t)(15u << nFrac) : result;
+
+        // the unsigned formats clamp negative values to zero.
+        result = (signBit == 0 && isNegative && floatExp != 0) ? 0 : result;
+
+        return result;
+        }
+
+/*
+
+Name:   LMIC_f2sflt16_n()
+
+Function:
+        Encode an array of floating point numbers as sflt16 values.
+
+Definition:
+        void LMIC_f2sflt16_n(
+                uint16_t *pOut,
+                const float *pIn,
+                size_t n
+                );
+
+Description:
+        Encodes n values from pIn into pOut, as if LMIC_f2sflt16() were
+        called for each value.  The loop is branch-free, so it can be
+        vectorized by the compiler.  See lmic_f2flt_nobranch() for the
+        handling of subnormals and NaNs.
+
+        LMIC_f2sflt12_n(), LMIC_f2uflt16_n() and LMIC_f2uflt12_n() work the
+        same way for the other formats.
+
+Returns:
+        No explicit result.
+
+*/
+
+void
+LMIC_f2sflt16_n(
+        uint16_t *pOut,
+        const float *pIn,
+        size_t n
+        )
+        {
+        for (size_t i = 0; i < n; ++i)
+                pOut[i] = lmic_f2flt_nobranch(pIn[i], 11, 0x8000);
+        }
+
+void
+LMIC_f2sflt12_n(
+        uint16_t *pOut,
+        const float *pIn,
+        size_t n
+        )
+        {
+        for (size_t i = 0; i < n; ++i)
+                pOut[i] = lmic_f2flt_nobranch(pIn[i], 7, 0x800);
+        }
+
+void
+LMIC_f2uflt16_n(
+        uint16_t *pOut,
+        const float *pIn,
+        size_t n
+        )
+        {
+        for (size_t i = 0; i < n; ++i)
+                pOut[i] = lmic_f2flt_nobranch(pIn[i], 12, 0);
+        }
+
+void
+LMIC_f2uflt12_n(
+        uint16_t *pOut,
+        const float *pIn,
+        size_t n
+        )
+        {
+        for (size_t i = 0; i < n; ++i)
+                pOut[i] = lmic_f2flt_nobranch(pIn[i], 8, 0);
+        }
+
+/*
+
+Name:   LMIC_sflt162f()
+
+Function:
+        Decode an sflt16 value into a floating point number.
+
+Definition:
+        float LMIC_sflt162f(
+                uint16_t v
+                );
+
+Description:
+        Inverse of LMIC_f2sflt16(): the result is
+
+                sign * (fraction / 2^11) * 2^(exponent - 15)
+
+        where the fields are laid out as documented for LMIC_f2sflt16().
+        0x8000 decodes to -0.0.
+
+        LMIC_sflt122f(), LMIC_uflt162f() and LMIC_uflt122f() decode the
+        other formats; bits above the encoded width are ignored.  The
+        decoders are branch-free as well, and LMIC_sflt162f_n() etc.
+        decode whole arrays.
+
+Returns:
+        The decoded value.
+
+*/
+
+static inline float
+lmic_flt2f_nobranch(
+        uint16_t v,
+        unsigned nFrac,
+        uint16_t signBit
+        )
+        {
+        const uint32_t fraction = v & ((1u << nFrac) - 1);
+        const uint32_t iExp = (v >> nFrac) & 0xF;
+        const uint32_t sign = (uint32_t)((v & signBit) != 0) << 31;
+
+        // 2^(iExp - 15 - nFrac) is always a normal float, so it can be
+        // built directly from its bits instead of calling ldexpf().
+        const float scale = lmic_bits_float((iExp + 127 - 15 - nFrac) << 23);
+
+        return lmic_bits_float(lmic_float_bits((float)fraction * scale) | sign);
+        }
+
+float
+LMIC_sflt162f(
+        uint16_t v
+        )
+        {
+        return lmic_flt2f_nobranch(v, 11, 0x8000);
+        }
+
+float
+LMIC_sflt122f(
+        uint16_t v
+        )
+        {
+        return lmic_flt2f_nobranch(v, 7, 0x800);
+        }
+
+float
+LMIC_uflt162f(
+        uint16_t v
+        )
+        {
+        return lmic_flt2f_nobranch(v, 12, 0);
+        }
+
+float
+LMIC_uflt122f(
+        uint16_t v
+        )
+        {
+        return lmic_flt2f_nobranch(v, 8, 0);
+        }
+
+void
+LMIC_sflt162f_n(
+        float *pOut,
+        const uint16_t *pIn,
+        size_t n
+        )
+        {
+        for (size_t i = 0; i < n; ++i)
+                pOut[i] = lmic_flt2f_nobranch(pIn[i], 11, 0x8000);
+        }
+
+void
+LMIC_sflt122f_n(
+        float *pOut,
+        const uint16_t *pIn,
+        size_t n
+        )
+        {
+        for (size_t i = 0; i < n; ++i)
+                pOut[i] = lmic_flt2f_nobranch(pIn[i], 7, 0x800);
+        }
+
+void
+LMIC_uflt162f_n(
+        float *pOut,
+        const uint16_t *pIn,
+        size_t n
+        )
+        {
+        for (size_t i = 0; i < n; ++i)
+                pOut[i] = lmic_flt2f_nobranch(pIn[i], 12, 0);
+        }
+
+void
+LMIC_uflt122f_n(
+        float *pOut,
+        const uint16_t *pIn,
+        size_t n
+        )
+        {
+        for (size_t i = 0; i < n; ++i)
+                pOut[i] = lmic_flt2f_nobranch(pIn[i], 8, 0);
+        }
@@ -21,12 +21,28 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 
 uint16_t LMIC_f2sflt16(float);
 uint16_t LMIC_f2sflt12(float);
 uint16_t LMIC_f2uflt16(float);
 uint16_t LMIC_f2uflt12(float);
 
+void LMIC_f2sflt16_n(uint16_t *pOut, const float *pIn, size_t n);
+void LMIC_f2sflt12_n(uint16_t *pOut, const float *pIn, size_t n);
+void LMIC_f2uflt16_n(uint16_t *pOut, const float *pIn, size_t n);
+void LMIC_f2uflt12_n(uint16_t *pOut, const float *pIn, size_t n);
+
+float LMIC_sflt162f(uint16_t);
+float LMIC_sflt122f(uint16_t);
+float LMIC_uflt162f(uint16_t);
+float LMIC_uflt122f(uint16_t);
+
+void LMIC_sflt162f_n(float *pOut, const uint16_t *pIn, size_t n);
+void LMIC_sflt122f_n(float *pOut, const uint16_t *pIn, size_t n);
+void LMIC_uflt162f_n(float *pOut, const uint16_t *pIn, size_t n);
+void LMIC_uflt122f_n(float *pOut, const uint16_t *pIn, size_t n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -147,10 +147,11 @@ enum { AIRTIME_BCN = 144384 };  // micros
 enum { LMIC_REGION_EIRP = EU868_LMIC_REGION_EIRP };         // region uses EIRP
 
 enum {
-        // Beacon frame format EU SF9
-        OFF_BCN_NETID = 0,
-        OFF_BCN_TIME = 3,
-        OFF_BCN_CRC1 = 7,
+        // Beacon frame format EU SF9 (LoRaWAN 1.0.3)
+        // RFU(2) Time(4) CRC(2) GwSpecific(7) CRC(2)
+        OFF_BCN_RFU = 0,
+        OFF_BCN_TIME = 2,
+        OFF_BCN_CRC1 = 6,
         OFF_BCN_INFO = 8,
         OFF_BCN_LAT = 9,
         OFF_BCN_LON = 12,
@@ -193,21 +194,22 @@ enum { FREQ_DNW2         = US915_500kHz_DNFBASE + 0*US915_500kHz_DNFSTEP };
 enum { DR_DNW2           = US915_DR_SF12CR };
 enum { CHNL_BCN          = 0 }; // used only for default init of state (rotating beacon scheme)
 enum { DR_BCN            = US915_DR_SF12CR };
-// TODO(tmm@mcci.com): check this, as beacon DR was SF10 in IBM code.
-enum { AIRTIME_BCN       = 72192 };  // micros
+// 23 bytes at SF12/500kHz, implicit header, no CRC, CR 4/5, 10 symbol preamble
+enum { AIRTIME_BCN       = 305152 };  // micros
 enum { LMIC_REGION_EIRP = US915_LMIC_REGION_EIRP };         // region uses EIRP
 
 enum {
-    // Beacon frame format US SF10
-    OFF_BCN_NETID    = 0,
-    OFF_BCN_TIME     = 3,
-    OFF_BCN_CRC1     = 7,
-    OFF_BCN_INFO     = 9,
-    OFF_BCN_LAT      = 10,
-    OFF_BCN_LON      = 13,
-    OFF_BCN_RFU1     = 16,
-    OFF_BCN_CRC2     = 17,
-    LEN_BCN          = 19
+    // Beacon frame format US SF12 500kHz (LoRaWAN 1.0.3)
+    // RFU(5) Time(4) CRC(2) GwSpecific(7) RFU(3) CRC(2)
+    OFF_BCN_RFU      = 0,
+    OFF_BCN_TIME     = 5,
+    OFF_BCN_CRC1     = 9,
+    OFF_BCN_INFO     = 11,
+    OFF_BCN_LAT      = 12,
+    OFF_BCN_LON      = 15,
+    OFF_BCN_RFU1     = 18,
+    OFF_BCN_CRC2     = 21,
+    LEN_BCN          = 23
 };
 
 # if LMIC_DR_LEGACY
@@ -246,21 +248,23 @@ enum { DR_PING          = AU915_DR_SF10CR };       // default ping DR
 enum { FREQ_DNW2        = AU915_500kHz_DNFBASE + 0*AU915_500kHz_DNFSTEP };
 enum { DR_DNW2          = AU915_DR_SF12CR };                  // DR8
 enum { CHNL_BCN         = 0 }; // used only for default init of state (rotating beacon scheme)
-enum { DR_BCN           = AU915_DR_SF10CR };
-enum { AIRTIME_BCN      = 72192 };  // micros ... TODO(tmm@mcci.com) check.
+enum { DR_BCN           = AU915_DR_SF12CR };                  // DR8
+// 23 bytes at SF12/500kHz, implicit header, no CRC, CR 4/5, 10 symbol preamble
+enum { AIRTIME_BCN      = 305152 };  // micros
 enum { LMIC_REGION_EIRP = AU915_LMIC_REGION_EIRP };         // region uses EIRP
 
 enum {
-        // Beacon frame format AU DR10/SF10 500kHz
-        OFF_BCN_NETID = 0,
-        OFF_BCN_TIME = 3,
-        OFF_BCN_CRC1 = 7,
-        OFF_BCN_INFO = 9,
-        OFF_BCN_LAT = 10,
-        OFF_BCN_LON = 13,
-        OFF_BCN_RFU1 = 16,
-        OFF_BCN_CRC2 = 17,
-        LEN_BCN = 19
+        // Beacon frame format AU 500kHz (LoRaWAN 1.0.3)
+        // RFU(5) Time(4) CRC(2) GwSpecific(7) RFU(3) CRC(2)
+        OFF_BCN_RFU = 0,
+        OFF_BCN_TIME = 5,
+        OFF_BCN_CRC1 = 9,
+        OFF_BCN_INFO = 11,
+        OFF_BCN_LAT = 12,
+        OFF_BCN_LON = 15,
+        OFF_BCN_RFU1 = 18,
+        OFF_BCN_CRC2 = 21,
+        LEN_BCN = 23
 };
 
 # if LMIC_DR_LEGACY
@@ -304,8 +308,9 @@ enum { AIRTIME_BCN = 144384 };  // micros
 enum { LMIC_REGION_EIRP = AS923_LMIC_REGION_EIRP };         // region uses EIRP
 
 enum {
-        // Beacon frame format AS SF9
-        OFF_BCN_NETID = 0,
+        // Beacon frame format AS SF9 (LoRaWAN 1.0.3)
+        // RFU(2) Time(4) CRC(2) GwSpecific(7) CRC(2)
+        OFF_BCN_RFU = 0,
         OFF_BCN_TIME = 2,
         OFF_BCN_CRC1 = 6,
         OFF_BCN_INFO = 8,
@@ -351,8 +356,9 @@ enum { AIRTIME_BCN = 144384 };  // micros
 enum { LMIC_REGION_EIRP = KR920_LMIC_REGION_EIRP };         // region uses EIRP
 
 enum {
-        // Beacon frame format KR SF9
-        OFF_BCN_NETID = 0,
+        // Beacon frame format KR SF9 (LoRaWAN 1.0.3)
+        // RFU(2) Time(4) CRC(2) GwSpecific(7) CRC(2)
+        OFF_BCN_RFU = 0,
         OFF_BCN_TIME = 2,
         OFF_BCN_CRC1 = 6,
         OFF_BCN_INFO = 8,
@@ -395,13 +401,15 @@ enum { AIRTIME_BCN = 144384 };  // micros
 enum { LMIC_REGION_EIRP = IN866_LMIC_REGION_EIRP };         // region uses EIRP
 
 enum {
-        // Beacon frame format IN SF9
-        OFF_BCN_NETID = 0,
+        // Beacon frame format IN SF8 (LoRaWAN 1.0.3)
+        // RFU(1) Time(4) CRC(2) GwSpecific(7) RFU(3) CRC(2)
+        OFF_BCN_RFU = 0,
         OFF_BCN_TIME = 1,
         OFF_BCN_CRC1 = 5,
         OFF_BCN_INFO = 7,
         OFF_BCN_LAT = 8,
         OFF_BCN_LON = 11,
+        OFF_BCN_RFU1 = 14,
         OFF_BCN_CRC2 = 17,
         LEN_BCN = 19
 };
@@ -401,11 +401,15 @@ static void requestModuleActive(bit_t state) {
         hal_waitUntil(os_getTime() + ticks);;
 }
 
+// effective TX power set by configPower(), for energy accounting
+static s1_t radioTxPow;
+
 static void writeOpmode(u1_t mode) {
     u1_t const maskedMode = mode & OPMODE_MASK;
     if (maskedMode != OPMODE_SLEEP)
         requestModuleActive(1);
     writeReg(RegOpMode, mode);
+    hal_radioModeChanged(maskedMode, radioTxPow);
     if (maskedMode == OPMODE_SLEEP)
         requestModuleActive(0);
 }
@@ -720,6 +724,7 @@ static void configPower () {
     writeReg(RegPaConfig, rPaConfig);
     writeReg(RegPaDac, (readReg(RegPaDac) & ~SX127X_PADAC_POWER_MASK) | rPaDac);
     writeReg(RegOcp, rOcp | SX127X_OCP_ENA);
+    radioTxPow = eff_pw;
 }
 
 static void setupFskRxTx(bit_t fDisableAutoClear) {
@@ -1283,6 +1288,11 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
         LMIC.saveIrqFlags = flags;
         LMICOS_logEventUint32("radio_irq_handler_v2: LoRa", flags);
         LMIC_X_DEBUG_PRINTF("IRQ=%02x\n", flags);
+        if( (flags & (IRQ_LORA_TXDONE_MASK|IRQ_LORA_RXDONE_MASK|IRQ_LORA_RXTOUT_MASK)) == 0 ) {
+            // stale interrupt, e.g. a Class C reception that completed just
+            // before the radio was reconfigured for a transmission: ignore
+            return;
+        }
         if( flags & IRQ_LORA_TXDONE_MASK ) {
             // save exact tx time
             LMIC.txend = now - us2osticks(43); // TXDONE FIXUP
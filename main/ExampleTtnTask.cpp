@@ -2,8 +2,13 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "Metrics.h"
 #include "ExampleTtnTask.h"
 
+static scsystem::Counter sendSuccess {"ttn.send.success"};
+static scsystem::Counter sendFailure {"ttn.send.failure"};
+static scsystem::Counter downlinks {"ttn.downlinks"};
+
 ExampleTtnTask::ExampleTtnTask(TheThingsNetwork& ttnParam): 
     ttn{ttnParam}
 {
@@ -13,8 +18,9 @@ void ExampleTtnTask::launch() {
 
     printf("start: TtnExampleTask::launch(...)\n");      
 
-    // Se instala el listener de los mensajes desde la red
-    //ttn.onMessage(messageReceived);
+    // Se instala el listener de los mensajes desde la red (puertos de aplicación 1-223)
+    router.addHandler(1, 223, messageReceivedHandler, this);
+    router.start(ttn);
 
     // Se instalar la tarea que se encarga de transmitir los mensakes hacia la red  
     //TaskFunction_t t = static_cast<TaskFunction_t>(txTask);
@@ -33,13 +39,24 @@ void ExampleTtnTask::txTask(void* pvParameter)
         printf("Sending message...\n");
         TTNResponseCode res = ttn.transmitMessage(msgData, sizeof(msgData) - 1);
         printf(res == kTTNSuccessfulTransmission ? "Message sent.\n" : "Transmission failed.\n");
+        if (res == kTTNSuccessfulTransmission) {
+            sendSuccess.increment();
+        } else {
+            sendFailure.increment();
+        }
 
         vTaskDelay(TX_INTERVAL * 1000 / portTICK_PERIOD_MS);
     }
 }
 
+void ExampleTtnTask::messageReceivedHandler(const TTNDownlink* downlink, void* context)
+{
+    static_cast<ExampleTtnTask*>(context)->messageReceived(downlink->payload, downlink->length, downlink->port);
+}
+
 void ExampleTtnTask::messageReceived(const uint8_t* message, size_t length, port_t port)
 {
+    downlinks.increment();
     printf("Message of %d bytes received on port %d:", length, port);
     for (int i = 0; i < length; i++)
         printf(" %02x", message[i]);
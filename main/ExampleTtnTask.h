@@ -1,6 +1,7 @@
 #pragma once
 
 #include "TheThingsNetwork.h"
+#include "TTNDownlinkRouter.h"
 
 class ExampleTtnTask {
 
@@ -10,9 +11,11 @@ class ExampleTtnTask {
 
     private:
         TheThingsNetwork ttn;
+        TTNDownlinkRouter router;
 
         void txTask(void* pvParameter);
         void messageReceived(const uint8_t* message, size_t length, port_t port);
+        static void messageReceivedHandler(const TTNDownlink* downlink, void* context);
 
 
 };
\ No newline at end of file
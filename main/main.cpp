@@ -1,9 +1,17 @@
 
+#include "Metrics.h"
+
+constexpr uint32_t METRICS_EXPORT_PERIOD_MS = 60 * 1000;
+
 extern void mainFreeRtos();
 extern void mainTtn();
 
 extern "C" void app_main(void)
 {
+    // Se vuelcan periodicamente las metricas por la UART de consola
+    static scsystem::MetricsExporter metricsExporter {METRICS_EXPORT_PERIOD_MS};
+    metricsExporter.start();
+
     mainFreeRtos();
     //mainTtn();
 }
@@ -17,12 +17,13 @@ void mainTtn(void)
     scttn::TtnProvisioning ttnProvisioning { devEui, appEui, appKey };
 
     // Se crea el driver para comunicar con la red LoraWan
-    scttn::TtnDriver ttndriver {ttnProvisioning};
+    // (estatico: el join continua en segundo plano al volver de connect)
+    static scttn::TtnDriver ttndriver {ttnProvisioning};
 
     // Se encargara de crear la tarea que se hara cargo de la session con la red.
-    ExampleTtnTaskFactory exampleTtnTaskFactory{};
+    static ExampleTtnTaskFactory exampleTtnTaskFactory{};
 
-    // Se intenta conectar y cuando se consiga se crea y inicia la tarea
+    // Se intenta conectar sin bloquear y cuando se consiga se crea y inicia la tarea
     ttndriver.connect(exampleTtnTaskFactory);
 
 }